@@ -0,0 +1,353 @@
+#include "assets.h"
+#include "SDL2/SDL_image.h"
+#include "map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// baked atlases start with this header and a manifest entry for each sheet,
+// followed by the pixels, pitch bytes a row. like saved maps, the header and
+// entries are 64 bytes each so the pixels start on a cache line, and fields
+// are stored in the machine's own byte order
+#define ATLAS_FILE_VERSION 1
+
+// sheets are packed left to right in rows no wider than this
+#define ATLAS_MAX_WIDTH 1024
+
+typedef struct AtlasFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;     // SDL_PixelFormatEnum of the pixels
+    uint32_t color_key;  // the transparent pixel, in that format
+    int32_t width;
+    int32_t height;
+    int32_t pitch;
+    int32_t sheet_count;
+    uint64_t source_hash;  // of the images it was baked from, see hashSources
+    uint64_t pixels_offset;
+    uint64_t pixels_size;
+    uint64_t checksum;     // of the pixels
+} AtlasFileHeader;
+
+typedef struct AtlasSheetEntry {
+    char name[48];  // the image the sheet was baked from
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} AtlasSheetEntry;
+
+static const char ATLAS_FILE_MAGIC[4] = { 'Y', 'Z', 'A', 'T' };
+
+#define HASH_START 0xCBF29CE484222325ull
+
+// FNV-1a, same as saved maps but carried on from a previous hash
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001B3ull;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// what an atlas baked from paths for format would be keyed on: the file
+// version, the format and every image's name and contents. false if any of
+// the images can't be read
+static bool hashSources(const char *const *paths, int count,
+                        const SDL_PixelFormat *format, uint64_t *hash) {
+    uint32_t key[3] = { ATLAS_FILE_VERSION, format->format, (uint32_t)count };
+    *hash = hashBytes(HASH_START, key, sizeof(key));
+    for (int i = 0; i < count; i++) {
+        size_t size = 0;
+        void *data = mapFile(paths[i], &size);
+        if (data == NULL) {
+            return false;
+        }
+        uint64_t length = size;
+        *hash = hashBytes(*hash, paths[i], strlen(paths[i]) + 1);
+        *hash = hashBytes(*hash, &length, sizeof(length));
+        *hash = hashBytes(*hash, data, size);
+        unmapFile(data, size);
+    }
+    return true;
+}
+
+// maps a baked atlas and checks that it fits what is being asked for, or
+// returns NULL. source_hash is NULL when there are no images to compare with
+static SpriteAtlas* openAtlas(const char *path, int count,
+                              const SDL_PixelFormat *format,
+                              const uint64_t *source_hash) {
+    size_t size = 0;
+    uint8_t *data = (uint8_t *)mapFile(path, &size);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    const AtlasFileHeader *header = (const AtlasFileHeader *)data;
+    const AtlasSheetEntry *entries =
+        (const AtlasSheetEntry *)(data + sizeof(AtlasFileHeader));
+    size_t pixels_offset =
+        sizeof(AtlasFileHeader) + sizeof(AtlasSheetEntry) * count;
+    bool valid = size >= pixels_offset
+                 && memcmp(header->magic, ATLAS_FILE_MAGIC,
+                           sizeof(header->magic)) == 0
+                 && header->version == ATLAS_FILE_VERSION
+                 && header->format == format->format
+                 && header->color_key == SDL_MapRGB(format, 0, 0, 0)
+                 && header->sheet_count == count
+                 && header->width > 0 && header->height > 0
+                 && header->pitch >= header->width * format->BytesPerPixel
+                 && header->pixels_offset == pixels_offset
+                 && header->pixels_size
+                    == (uint64_t)header->pitch * header->height
+                 && header->pixels_offset + header->pixels_size == size;
+    for (int i = 0; valid && i < count; i++) {
+        valid = entries[i].x >= 0 && entries[i].y >= 0
+                && entries[i].width > 0 && entries[i].height > 0
+                && entries[i].x + entries[i].width <= header->width
+                && entries[i].y + entries[i].height <= header->height
+                // printed with %s if a sheet goes wrong later on
+                && memchr(entries[i].name, '\0',
+                          sizeof(entries[i].name)) != NULL;
+    }
+
+    if (!valid) {
+        printf("Sprite atlas %s is damaged or from another version\n", path);
+    }
+    else if (source_hash != NULL && header->source_hash != *source_hash) {
+        printf("Sprite atlas %s is out of date\n", path);
+        valid = false;
+    }
+    else if (hashBytes(HASH_START, data + pixels_offset, header->pixels_size)
+             != header->checksum) {
+        printf("Sprite atlas %s failed its checksum!\n", path);
+        valid = false;
+    }
+
+    SpriteAtlas *atlas =
+        valid ? (SpriteAtlas *)calloc(1, sizeof(SpriteAtlas)) : NULL;
+    if (atlas == NULL) {
+        unmapFile(data, size);
+        return NULL;
+    }
+    atlas->mapped = true;
+    atlas->data = data;
+    atlas->size = size;
+    return atlas;
+}
+
+// the slow way: decodes and converts every image, then packs them into a
+// freshly allocated atlas laid out just like the file
+static SpriteAtlas* bakeAtlas(const char *const *paths, int count,
+                              SDL_PixelFormat *format, uint64_t source_hash) {
+    SDL_Surface *converted[ATLAS_MAX_SHEETS] = { NULL };
+    AtlasSheetEntry entries[ATLAS_MAX_SHEETS];
+    memset(entries, 0, sizeof(entries));
+
+    // sheets go in rows, left to right, a new row whenever one is full
+    int width = 0;
+    int height = 0;
+    int row_x = 0;
+    int row_height = 0;
+    bool loaded = true;
+    for (int i = 0; i < count; i++) {
+        SDL_Surface *image = IMG_Load(paths[i]);
+        if (image == NULL) {
+            printf("Unable to load image %s! SDL Error: %s\n", paths[i],
+                   IMG_GetError());
+            loaded = false;
+            break;
+        }
+        converted[i] = SDL_ConvertSurface(image, format, 0);
+        SDL_FreeSurface(image);
+        if (converted[i] == NULL) {
+            printf("Unable to optimize image %s! SDL Error: %s\n", paths[i],
+                   SDL_GetError());
+            loaded = false;
+            break;
+        }
+
+        if (row_x > 0 && row_x + converted[i]->w > ATLAS_MAX_WIDTH) {
+            height += row_height;
+            row_x = 0;
+            row_height = 0;
+        }
+        strncpy(entries[i].name, paths[i], sizeof(entries[i].name) - 1);
+        entries[i].x = row_x;
+        entries[i].y = height;
+        entries[i].width = converted[i]->w;
+        entries[i].height = converted[i]->h;
+        row_x += converted[i]->w;
+        if (row_x > width) {
+            width = row_x;
+        }
+        if (converted[i]->h > row_height) {
+            row_height = converted[i]->h;
+        }
+    }
+    height += row_height;
+
+    SpriteAtlas *atlas = NULL;
+    int bytes_per_pixel = format->BytesPerPixel;
+    int pitch = (width * bytes_per_pixel + 3) & ~3;
+    size_t pixels_offset =
+        sizeof(AtlasFileHeader) + sizeof(AtlasSheetEntry) * count;
+    size_t pixels_size = (size_t)pitch * height;
+    uint8_t *data = loaded ? (uint8_t *)calloc(1, pixels_offset + pixels_size)
+                           : NULL;
+    if (loaded && data == NULL) {
+        printf("Could not allocate %dx%d sprite atlas!\n", width, height);
+    }
+
+    if (data != NULL) {
+        // the gaps between sheets are left zeroed, nothing ever draws them
+        uint8_t *pixels = data + pixels_offset;
+        for (int i = 0; i < count; i++) {
+            SDL_Surface *sheet = converted[i];
+            SDL_LockSurface(sheet);
+            for (int y = 0; y < sheet->h; y++) {
+                memcpy(pixels + (size_t)(entries[i].y + y) * pitch
+                       + (size_t)entries[i].x * bytes_per_pixel,
+                       (const uint8_t *)sheet->pixels + (size_t)y * sheet->pitch,
+                       (size_t)sheet->w * bytes_per_pixel);
+            }
+            SDL_UnlockSurface(sheet);
+        }
+
+        AtlasFileHeader *header = (AtlasFileHeader *)data;
+        memcpy(header->magic, ATLAS_FILE_MAGIC, sizeof(header->magic));
+        header->version = ATLAS_FILE_VERSION;
+        header->format = format->format;
+        header->color_key = SDL_MapRGB(format, 0, 0, 0);
+        header->width = width;
+        header->height = height;
+        header->pitch = pitch;
+        header->sheet_count = count;
+        header->source_hash = source_hash;
+        header->pixels_offset = pixels_offset;
+        header->pixels_size = pixels_size;
+        header->checksum = hashBytes(HASH_START, pixels, pixels_size);
+        memcpy(data + sizeof(AtlasFileHeader), entries,
+               sizeof(AtlasSheetEntry) * count);
+
+        atlas = (SpriteAtlas *)calloc(1, sizeof(SpriteAtlas));
+        if (atlas == NULL) {
+            free(data);
+        }
+        else {
+            atlas->mapped = false;
+            atlas->data = data;
+            atlas->size = pixels_offset + pixels_size;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        SDL_FreeSurface(converted[i]);
+    }
+    return atlas;
+}
+
+// saves a fresh bake for next time. failing to is no reason to stop, it only
+// means baking again on the next run
+static void writeAtlas(const SpriteAtlas *atlas, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Could not save sprite atlas %s! %s\n", path, strerror(errno));
+        return;
+    }
+    bool written = fwrite(atlas->data, atlas->size, 1, file) == 1;
+    if (fclose(file) != 0 || !written) {
+        printf("Could not save sprite atlas %s! %s\n", path, strerror(errno));
+        remove(path);
+    }
+}
+
+// points a surface at each sheet's pixels in the atlas. the surfaces don't
+// own the pixels, so SDL leaves them be when it RLE encodes them
+static bool attachSheets(SpriteAtlas *atlas, SDL_PixelFormat *format) {
+    const AtlasFileHeader *header = (const AtlasFileHeader *)atlas->data;
+    const AtlasSheetEntry *entries =
+        (const AtlasSheetEntry *)(atlas->data + sizeof(AtlasFileHeader));
+    uint8_t *pixels = atlas->data + header->pixels_offset;
+
+    atlas->sheet_count = header->sheet_count;
+    for (int i = 0; i < header->sheet_count; i++) {
+        atlas->sheets[i] = SDL_CreateRGBSurfaceWithFormatFrom(
+            pixels + (size_t)entries[i].y * header->pitch
+            + (size_t)entries[i].x * format->BytesPerPixel,
+            entries[i].width, entries[i].height, format->BitsPerPixel,
+            header->pitch, format->format);
+        if (atlas->sheets[i] == NULL) {
+            printf("Unable to use sheet %s of the sprite atlas! SDL Error: %s\n",
+                   entries[i].name, SDL_GetError());
+            return false;
+        }
+
+        // TODO: may want to remap alpha color to something other than black
+        if (SDL_SetColorKey(atlas->sheets[i], SDL_TRUE, header->color_key) < 0
+            || SDL_SetSurfaceRLE(atlas->sheets[i], 1) < 0) {
+            printf("Unable to set transparent pixel for sheet %s! SDL Error: "
+                   "%s\n", entries[i].name, SDL_GetError());
+            return false;
+        }
+    }
+    return true;
+}
+
+// loads the images at paths as sheets of one atlas in format, from the baked
+// atlas at cache_path if it is up to date, baking it there if not. NULL for
+// no cache at all. NULL if the sheets can't be had either way
+SpriteAtlas* loadSpriteAtlas(const char *const *paths, int count,
+                             SDL_PixelFormat *format, const char *cache_path) {
+    if (count < 1 || count > ATLAS_MAX_SHEETS) {
+        printf("A sprite atlas holds 1 to %d sheets, not %d!\n",
+               ATLAS_MAX_SHEETS, count);
+        return NULL;
+    }
+
+    uint64_t source_hash = 0;
+    bool have_sources = hashSources(paths, count, format, &source_hash);
+    SpriteAtlas *atlas = NULL;
+    if (cache_path != NULL) {
+        atlas = openAtlas(cache_path, count, format,
+                          have_sources ? &source_hash : NULL);
+    }
+    if (atlas == NULL) {
+        atlas = bakeAtlas(paths, count, format, source_hash);
+        if (atlas == NULL) {
+            return NULL;
+        }
+        if (cache_path != NULL) {
+            writeAtlas(atlas, cache_path);
+        }
+    }
+
+    if (!attachSheets(atlas, format)) {
+        destroySpriteAtlas(atlas);
+        return NULL;
+    }
+    return atlas;
+}
+
+void destroySpriteAtlas(SpriteAtlas *atlas) {
+    if (atlas == NULL) {
+        return;
+    }
+    for (int i = 0; i < atlas->sheet_count; i++) {
+        SDL_FreeSurface(atlas->sheets[i]);
+    }
+    if (atlas->mapped) {
+        unmapFile(atlas->data, atlas->size);
+    }
+    else {
+        free(atlas->data);
+    }
+    free(atlas);
+}
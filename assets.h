@@ -0,0 +1,35 @@
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include "SDL2/SDL.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the sprite sheets, baked. decoding the PNGs and converting them to the
+// display's pixel format is most of what startup costs, so the first run does
+// that once and writes every sheet into one atlas file: a manifest of where
+// each sheet sits, then raw pixels already in the display's format. later runs
+// map the file and point a surface for each sheet straight at its pixels,
+// with the colour key and RLE set up as before
+//
+// a baked atlas is only used if it was made from the same images for the same
+// pixel format. anything else (a sheet edited, another display, a damaged
+// file) bakes it again. the images aren't needed once baked: without them the
+// atlas is taken as it is
+
+#define ATLAS_MAX_SHEETS 8
+
+typedef struct SpriteAtlas {
+    SDL_Surface *sheets[ATLAS_MAX_SHEETS];  // in the order they were asked for
+    int sheet_count;
+    bool mapped;     // data is the mapped atlas file rather than a fresh bake
+    uint8_t *data;   // the whole atlas, laid out as in the file
+    size_t size;
+} SpriteAtlas;
+
+SpriteAtlas* loadSpriteAtlas(const char *const *, int, SDL_PixelFormat *,
+                             const char *);
+void destroySpriteAtlas(SpriteAtlas *);
+
+#endif /* __ASSETS_H__ */
@@ -0,0 +1,265 @@
+#include "autotile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// how far past the view a streamed world's window reaches, so small camera
+// moves don't recompute it
+#define AUTOTILE_WINDOW_MARGIN 32
+
+static inline int lowestBit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+TileVariants* initTileVariants(void) {
+    TileVariants *variants = (TileVariants *)calloc(1, sizeof(TileVariants));
+    if (variants == NULL) {
+        printf("Could not allocate tile variants!\n");
+    }
+    return variants;
+}
+
+void destroyTileVariants(TileVariants *variants) {
+    if (variants == NULL) {
+        return;
+    }
+    free(variants->variants);
+    free(variants->rows);
+    free(variants);
+}
+
+static inline int tileAt(GameMap *game_map, int x, int y) {
+    // nothing past the edge of a flat map, which draws like wall
+    if (game_map->chunks == NULL
+        && (x < 0 || y < 0 || x >= game_map->width || y >= game_map->height)) {
+        return MAP_WALL;
+    }
+    return mapTileAt(game_map, x, y);
+}
+
+// packs the floor tiles of map row y into row, one bit per cell: bit i is the
+// tile at variants->x - 1 + i, so the window has a column of neighbours on
+// either side. rows inside the window also get their tile IDs written out
+static void packRow(TileVariants *variants, GameMap *game_map, int y,
+                    uint64_t *row) {
+    memset(row, 0, sizeof(uint64_t) * (variants->row_words - 2));
+    bool inside = y >= variants->y && y < variants->y + variants->height;
+    TileVariant *out = inside
+        ? variants->variants + (size_t)(y - variants->y) * variants->width
+        : NULL;
+
+    int first = variants->x - 1;
+    int last = variants->x + variants->width;
+    if (game_map->chunks == NULL && y >= 0 && y < game_map->height) {
+        // a flat map row can be read straight through, 64 cells to a word
+        MapCell *cells = mapRow(game_map, y);
+        int from = first < 0 ? 0 : first;
+        int to = last >= game_map->width ? game_map->width - 1 : last;
+        for (int x = from; x <= to;) {
+            int i = x - first;
+            int count = 64 - i % 64;
+            count = count < to - x + 1 ? count : to - x + 1;
+            uint64_t word = 0;
+            int bit = 0;
+            for (; bit + 8 <= count; bit += 8) {
+                word |= (uint64_t)mapFloorBits8(cells + x + bit) << bit;
+            }
+            for (; bit < count; bit++) {
+                int tile = cells[x + bit] & MAP_TILE_MASK;
+                word |= (uint64_t)(tile == MAP_FLOOR) << bit;
+            }
+            row[i / 64] |= word << (i % 64);
+            x += count;
+        }
+        if (out != NULL) {
+            int from_inside = variants->x > from ? variants->x : from;
+            int to_inside = last - 1 < to ? last - 1 : to;
+            // any of the window hanging off the map
+            for (int x = variants->x; x < from_inside && x < last; x++) {
+                out[x - variants->x] = (TileVariant)(MAP_WALL << 4);
+            }
+            for (int x = to_inside + 1 > variants->x ? to_inside + 1
+                                                     : variants->x;
+                 x < last; x++) {
+                out[x - variants->x] = (TileVariant)(MAP_WALL << 4);
+            }
+            for (int x = from_inside; x <= to_inside; x++) {
+                out[x - variants->x] =
+                    (TileVariant)((cells[x] & MAP_TILE_MASK) << 4);
+            }
+        }
+        return;
+    }
+
+    for (int x = first; x <= last; x++) {
+        int tile = tileAt(game_map, x, y);
+        int i = x - first;
+        row[i / 64] |= (uint64_t)(tile == MAP_FLOOR) << (i % 64);
+        if (out != NULL && x >= variants->x && x < last) {
+            out[x - variants->x] = (TileVariant)(tile << 4);
+        }
+    }
+}
+
+// adds the edges of window row y, given the floor bits of it and the rows
+// above and below. each side is one shift and one and-not for 64 cells at a
+// time, and only cells that ended up with an edge are written to
+static void edgeRow(TileVariants *variants, int y, const uint64_t *above,
+                    const uint64_t *row, const uint64_t *below) {
+    TileVariant *out =
+        variants->variants + (size_t)(y - variants->y) * variants->width;
+    int words = variants->row_words - 2;
+
+    for (int k = 0; k < words; k++) {
+        uint64_t walls = ~row[k];
+        // row[-1] and row[words] are zero guards
+        uint64_t east = (row[k] >> 1) | (row[k + 1] << 63);
+        uint64_t west = (row[k] << 1) | (row[k - 1] >> 63);
+        uint64_t north = above[k] & walls;
+        uint64_t south = below[k] & walls;
+        east &= walls;
+        west &= walls;
+
+        uint64_t any = north | south | east | west;
+        while (any != 0) {
+            int bit = lowestBit(any);
+            any &= any - 1;
+            int i = k * 64 + bit;
+            if (i < 1 || i > variants->width) {
+                continue;  // one of the neighbour columns
+            }
+            out[i - 1] |= (TileVariant)(((north >> bit) & 1)
+                                        | ((south >> bit) & 1) << 1
+                                        | ((east >> bit) & 1) << 2
+                                        | ((west >> bit) & 1) << 3);
+        }
+    }
+}
+
+// computes the variants of the width x height tiles at x, y (in tiles),
+// replacing whatever was cached before
+int computeTileVariants(TileVariants *variants, GameMap *game_map, int x,
+                        int y, int width, int height) {
+    width = width > 0 ? width : 0;
+    height = height > 0 ? height : 0;
+    size_t cells = (size_t)width * height;
+    if (cells > variants->capacity) {
+        TileVariant *grown = (TileVariant *)
+            realloc(variants->variants, sizeof(TileVariant) * cells);
+        if (grown == NULL) {
+            printf("Could not allocate tile variants for %dx%d tiles!\n",
+                   width, height);
+            variants->valid = false;
+            return -1;
+        }
+        variants->variants = grown;
+        variants->capacity = cells;
+    }
+
+    // a guard word on either side of each row
+    int row_words = (width + 2 + 63) / 64 + 2;
+    if (row_words > variants->row_words) {
+        uint64_t *rows = (uint64_t *)
+            realloc(variants->rows, sizeof(uint64_t) * row_words * 3);
+        if (rows == NULL) {
+            printf("Could not allocate tile variants for %dx%d tiles!\n",
+                   width, height);
+            variants->valid = false;
+            return -1;
+        }
+        variants->rows = rows;
+    }
+    variants->row_words = row_words;
+    memset(variants->rows, 0, sizeof(uint64_t) * row_words * 3);
+
+    variants->x = x;
+    variants->y = y;
+    variants->width = width;
+    variants->height = height;
+
+    uint64_t *above = variants->rows + 1;
+    uint64_t *row = above + row_words;
+    uint64_t *below = row + row_words;
+    if (height > 0) {
+        packRow(variants, game_map, y - 1, above);
+        packRow(variants, game_map, y, row);
+    }
+    for (int r = y; r < y + height; r++) {
+        packRow(variants, game_map, r + 1, below);
+        edgeRow(variants, r, above, row, below);
+
+        uint64_t *swap = above;
+        above = row;
+        row = below;
+        below = swap;
+    }
+
+    variants->valid = true;
+    return 0;
+}
+
+// makes sure the tiles from first_x, first_y to last_x, last_y (exclusive)
+// are cached, computing them if they aren't
+int ensureTileVariants(TileVariants *variants, GameMap *game_map, int first_x,
+                       int first_y, int last_x, int last_y) {
+    if (variants->valid && first_x >= variants->x && first_y >= variants->y
+        && last_x <= variants->x + variants->width
+        && last_y <= variants->y + variants->height) {
+        return 0;
+    }
+    if (game_map->chunks == NULL) {
+        return computeTileVariants(variants, game_map, 0, 0, game_map->width,
+                                   game_map->height);
+    }
+    return computeTileVariants(variants, game_map,
+                               first_x - AUTOTILE_WINDOW_MARGIN,
+                               first_y - AUTOTILE_WINDOW_MARGIN,
+                               last_x - first_x + AUTOTILE_WINDOW_MARGIN * 2,
+                               last_y - first_y + AUTOTILE_WINDOW_MARGIN * 2);
+}
+
+// refreshes what changing the tile at x, y affects: the tile itself and its
+// four neighbours. O(1), so it can follow every mapSetTileAt
+void updateTileVariants(TileVariants *variants, GameMap *game_map, int x,
+                        int y) {
+    static const int offsets[5][2] = {
+        {0, 0}, {0, -1}, {0, 1}, {1, 0}, {-1, 0}
+    };
+    if (!variants->valid) {
+        return;
+    }
+    for (int i = 0; i < 5; i++) {
+        int tile_x = x + offsets[i][0];
+        int tile_y = y + offsets[i][1];
+        if (tile_x < variants->x || tile_y < variants->y
+            || tile_x >= variants->x + variants->width
+            || tile_y >= variants->y + variants->height) {
+            continue;
+        }
+
+        int tile = tileAt(game_map, tile_x, tile_y);
+        int edges = 0;
+        if (tile != MAP_FLOOR) {
+            edges = (tileAt(game_map, tile_x, tile_y - 1) == MAP_FLOOR
+                     ? TILE_EDGE_NORTH : 0)
+                    | (tileAt(game_map, tile_x, tile_y + 1) == MAP_FLOOR
+                       ? TILE_EDGE_SOUTH : 0)
+                    | (tileAt(game_map, tile_x + 1, tile_y) == MAP_FLOOR
+                       ? TILE_EDGE_EAST : 0)
+                    | (tileAt(game_map, tile_x - 1, tile_y) == MAP_FLOOR
+                       ? TILE_EDGE_WEST : 0);
+        }
+        variants->variants[(size_t)(tile_y - variants->y) * variants->width
+                           + (tile_x - variants->x)] =
+            (TileVariant)(tile << 4 | edges);
+    }
+}
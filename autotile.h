@@ -0,0 +1,64 @@
+#ifndef __AUTOTILE_H__
+#define __AUTOTILE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// works out once how every tile should be drawn, so the renderer doesn't have
+// to look at neighbours every frame. a wall that borders floor gets the edge
+// overlays from the WALLS row of yarz-terrain.png on those sides, one column
+// per side in the order of enum tileEdge
+//
+// a TileVariant packs the tile ID in the high nibble and the edges in the low
+// one. they are cached for a window of the map: the whole map when it is
+// small enough to have a tiles array, the part around the view otherwise
+
+enum tileEdge {
+    TILE_EDGE_NORTH = 1,
+    TILE_EDGE_SOUTH = 2,
+    TILE_EDGE_EAST = 4,
+    TILE_EDGE_WEST = 8
+};
+
+#define TILE_EDGE_COUNT 4
+
+typedef uint8_t TileVariant;
+
+typedef struct TileVariants {
+    // the window of the map covered, in tiles. valid is false until the
+    // first computeTileVariants, and again after the map is replaced
+    int x;
+    int y;
+    int width;
+    int height;
+    bool valid;
+
+    TileVariant *variants;  // row-major, width * height
+    size_t capacity;
+    uint64_t *rows;         // bitboard scratch, three rows of floor bits
+    int row_words;
+} TileVariants;
+
+TileVariants* initTileVariants(void);
+void destroyTileVariants(TileVariants *);
+int computeTileVariants(TileVariants *, GameMap *, int, int, int, int);
+int ensureTileVariants(TileVariants *, GameMap *, int, int, int, int);
+void updateTileVariants(TileVariants *, GameMap *, int, int);
+
+static inline int tileVariantTile(TileVariant variant) {
+    return variant >> 4;
+}
+
+static inline int tileVariantEdges(TileVariant variant) {
+    return variant & 0x0F;
+}
+
+// the cached variant of the tile at x, y, which has to be inside the window
+static inline TileVariant tileVariantAt(const TileVariants *variants, int x,
+                                        int y) {
+    return variants->variants[(size_t)(y - variants->y) * variants->width
+                              + (x - variants->x)];
+}
+
+#endif /* __AUTOTILE_H__ */
@@ -0,0 +1,827 @@
+#include "SDL2/SDL.h"
+#include "SDL2/SDL_ttf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "yarz.h"
+#include "map.h"
+#include "cave.h"
+#include "rng.h"
+#include "entity.h"
+#include "turn.h"
+#include "spatial.h"
+#include "autotile.h"
+#include "fov.h"
+#include "path.h"
+#include "region.h"
+#include "profile.h"
+#include "blit.h"
+#include "renderer.h"
+
+// inputs replayed during --bench, one per frame, round and round. moves and
+// ends turns, pans and zooms the camera
+static const SDL_Keycode BENCH_SCRIPT[] = {
+    SDLK_KP_6, SDLK_KP_ENTER, SDLK_d, SDLK_KP_2, SDLK_KP_ENTER, SDLK_s,
+    SDLK_KP_4, SDLK_KP_ENTER, SDLK_a, SDLK_KP_8, SDLK_KP_ENTER, SDLK_w,
+    SDLK_EQUALS, SDLK_KP_5, SDLK_MINUS, SDLK_KP_9, SDLK_KP_ENTER, SDLK_0
+};
+
+// every so many frames the script also asks for a new map
+#define BENCH_NEW_MAP_EVERY 250
+
+BenchResult* addBenchResult(BenchReport *report, const char *name,
+                            int capacity, double ops_per_sample) {
+    if (report->count == MAX_BENCH_RESULTS) {
+        return NULL;
+    }
+    BenchResult *result = &report->results[report->count];
+    result->samples = (double *)malloc(sizeof(double) * capacity);
+    if (result->samples == NULL) {
+        printf("Could not allocate benchmark samples!\n");
+        return NULL;
+    }
+    result->name = name;
+    result->count = 0;
+    result->capacity = capacity;
+    result->ops_per_sample = ops_per_sample;
+    report->count++;
+    return result;
+}
+
+void benchRecord(BenchResult *result, double seconds) {
+    if (result != NULL && result->count < result->capacity) {
+        result->samples[result->count++] = seconds;
+    }
+}
+
+static int compareSamples(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// sorts the samples in place
+void benchSummary(const BenchResult *result, double *min, double *median,
+                  double *p99) {
+    *min = *median = *p99 = 0;
+    if (result->count == 0) {
+        return;
+    }
+    qsort(result->samples, result->count, sizeof(double), compareSamples);
+    *min = result->samples[0];
+    *median = result->samples[result->count / 2];
+    int rank = (result->count * 99 + 99) / 100;
+    *p99 = result->samples[rank - 1];
+}
+
+void destroyBenchReport(BenchReport *report) {
+    for (int i = 0; i < report->count; i++) {
+        free(report->results[i].samples);
+    }
+    report->count = 0;
+}
+
+uint64_t benchNow() {
+    return SDL_GetPerformanceCounter();
+}
+
+double benchSeconds(uint64_t start, uint64_t end) {
+    return (double)(end - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+// keeps the compiler from throwing away benchmark loops
+static volatile uint64_t bench_sink;
+
+// things worth tracking that don't happen every frame: map generation at the
+// game's size and at a size where threading matters, turn scheduling for a
+// big crowd, and our generator against the libc rand() it replaced
+void runMicroBenchmarks(BenchReport *report, uint64_t seed, int threads) {
+    GameMap *small_map = initMap(100, 100);
+    BenchResult *result = addBenchResult(report, "cave_100x100", 200, 1);
+    for (int i = 0; small_map != NULL && i < 200; i++) {
+        uint64_t start = benchNow();
+        caveGenerate(small_map, seed + i, threads);
+        benchRecord(result, benchSeconds(start, benchNow()));
+    }
+    if (small_map != NULL) {
+        destroyMap(small_map);
+    }
+
+    GameMap *large_map = initMap(4096, 4096);
+    result = addBenchResult(report, "cave_4096x4096", 5, 1);
+    for (int i = 0; large_map != NULL && i < 5; i++) {
+        uint64_t start = benchNow();
+        caveGenerate(large_map, seed + i, threads);
+        benchRecord(result, benchSeconds(start, benchNow()));
+    }
+
+    // the size the generator is meant to manage in well under a second
+    GameMap *huge_map = initMap(8192, 8192);
+    result = addBenchResult(report, "cave_8192x8192", 3, 1);
+    for (int i = 0; huge_map != NULL && i < 3; i++) {
+        uint64_t start = benchNow();
+        caveGenerate(huge_map, seed + i, threads);
+        benchRecord(result, benchSeconds(start, benchNow()));
+    }
+    if (huge_map != NULL) {
+        destroyMap(huge_map);
+    }
+
+    // autotiling the last of those caves
+    TileVariants *variants = initTileVariants();
+    if (large_map != NULL && variants != NULL) {
+        result = addBenchResult(report, "autotile_4096x4096", 10, 1);
+        for (int i = 0; i < 10; i++) {
+            uint64_t start = benchNow();
+            computeTileVariants(variants, large_map, 0, 0, 4096, 4096);
+            benchRecord(result, benchSeconds(start, benchNow()));
+        }
+    }
+    destroyTileVariants(variants);
+
+    // and finding which parts of it connect
+    MapRegions *regions = initMapRegions();
+    if (large_map != NULL && regions != NULL) {
+        result = addBenchResult(report, "regions_4096x4096", 10, 1);
+        for (int i = 0; i < 10; i++) {
+            uint64_t start = benchNow();
+            labelRegions(regions, large_map, threads);
+            benchRecord(result, benchSeconds(start, benchNow()));
+        }
+    }
+    destroyMapRegions(regions);
+
+    // field of view from random floor tiles of the same cave, one viewer at
+    // a time and then a crowd of them at once
+    OpacityMap *opacity = initOpacityMap();
+    FovCache *fov_cache = initFovCache();
+    const int viewers = 10000;
+    Entity *viewer = (Entity *)malloc(sizeof(Entity) * viewers);
+    int *viewer_x = (int *)malloc(sizeof(int) * viewers);
+    int *viewer_y = (int *)malloc(sizeof(int) * viewers);
+    if (large_map != NULL && opacity != NULL && fov_cache != NULL
+        && viewer != NULL && viewer_x != NULL && viewer_y != NULL
+        && buildOpacityMap(opacity, large_map, 0, 0, 4096, 4096) == 0) {
+        Rng fov_rng;
+        rngSeed(&fov_rng, seed);
+        for (int i = 0; i < viewers; i++) {
+            viewer[i] = (Entity)i;
+            do {
+                viewer_x[i] = rngRange(&fov_rng, 0, 4095);
+                viewer_y[i] = rngRange(&fov_rng, 0, 4095);
+            } while (opaqueAt(opacity, viewer_x[i], viewer_y[i]));
+        }
+
+        const int radii[] = { 8, 30 };
+        const char *fov_names[] = { "fov_radius_8", "fov_radius_30" };
+        const char *batch_names[] = { "fov_batch_radius_8",
+                                      "fov_batch_radius_30" };
+        FovResult fov = { .valid = false };
+        for (int r = 0; r < 2; r++) {
+            result = addBenchResult(report, fov_names[r], 10, viewers);
+            for (int i = 0; i < 10; i++) {
+                uint64_t start = benchNow();
+                for (int j = 0; j < viewers; j++) {
+                    fovCompute(&fov, opacity, viewer_x[j], viewer_y[j],
+                               radii[r]);
+                }
+                benchRecord(result, benchSeconds(start, benchNow()));
+                bench_sink += fov.bits[0];
+            }
+
+            // a new build leaves every cached result stale, as if they had
+            // all moved
+            result = addBenchResult(report, batch_names[r], 10, viewers);
+            for (int i = 0; i < 10; i++) {
+                opacity->build++;
+                uint64_t start = benchNow();
+                fovComputeBatch(fov_cache, opacity, viewer, viewer_x,
+                                viewer_y, viewers, radii[r], threads);
+                benchRecord(result, benchSeconds(start, benchNow()));
+            }
+        }
+
+        // tiles changing under the crowd: half of them right next to a
+        // viewer, half anywhere, most of which nobody is near. only the
+        // viewers with a change in their radius should be computed again,
+        // and what the cache then holds has to match a fresh field of view
+        const int changes = 64;
+        const int change_radius = 8;
+        int change_x[changes];
+        int change_y[changes];
+        int recomputed = 0;
+        int expected = 0;
+        fovComputeBatch(fov_cache, opacity, viewer, viewer_x, viewer_y,
+                        viewers, change_radius, threads);
+        result = addBenchResult(report, "fov_changes_radius_8", 10, viewers);
+        for (int i = 0; i < 10; i++) {
+            for (int c = 0; c < changes; c++) {
+                if (c % 2 == 0) {
+                    int near = rngRange(&fov_rng, 0, viewers - 1);
+                    change_x[c] = viewer_x[near] + change_radius / 2;
+                    change_y[c] = viewer_y[near];
+                }
+                else {
+                    change_x[c] = rngRange(&fov_rng, 0, 4095);
+                    change_y[c] = rngRange(&fov_rng, 0, 4095);
+                }
+                setOpacity(opacity, change_x[c], change_y[c],
+                           !opaqueAt(opacity, change_x[c], change_y[c]));
+            }
+            for (int j = 0; j < viewers; j++) {
+                for (int c = 0; c < changes; c++) {
+                    if (abs(change_x[c] - viewer_x[j]) <= change_radius
+                        && abs(change_y[c] - viewer_y[j]) <= change_radius) {
+                        expected++;
+                        break;
+                    }
+                }
+            }
+            uint64_t start = benchNow();
+            recomputed += fovComputeBatch(fov_cache, opacity, viewer, viewer_x,
+                                          viewer_y, viewers, change_radius,
+                                          threads);
+            benchRecord(result, benchSeconds(start, benchNow()));
+        }
+        if (recomputed != expected) {
+            printf("Field of view recomputed %d results for changes in view "
+                   "of %d!\n", recomputed, expected);
+        }
+        for (int j = 0; j < viewers; j++) {
+            FovResult *cached = fovFor(fov_cache, opacity, viewer[j],
+                                       viewer_x[j], viewer_y[j],
+                                       change_radius);
+            if (cached == NULL || fovCompute(&fov, opacity, viewer_x[j],
+                                             viewer_y[j], change_radius) != 0) {
+                continue;
+            }
+            bool same = true;
+            for (int y = viewer_y[j] - change_radius;
+                 same && y <= viewer_y[j] + change_radius; y++) {
+                for (int x = viewer_x[j] - change_radius;
+                     x <= viewer_x[j] + change_radius; x++) {
+                    same = same && fovVisible(cached, x, y)
+                                   == fovVisible(&fov, x, y);
+                }
+            }
+            if (!same) {
+                printf("Cached field of view of viewer %d is out of date!\n",
+                       j);
+                break;
+            }
+        }
+        fovFree(&fov);
+
+        // paths between random floor tiles up to 64 apart, in a 1024 tile
+        // corner of the cave so the finder's arena stays a sensible size
+        const int routes = 1000;
+        PathFinder *finder = initPathFinder();
+        PathCache *path_cache = initPathCache();
+        FlowMap *flow = initFlowMap();
+        if (finder != NULL && path_cache != NULL && flow != NULL
+            && buildOpacityMap(opacity, large_map, 0, 0, 1024, 1024) == 0) {
+            for (int i = 0; i < routes; i++) {
+                do {
+                    viewer_x[i] = rngRange(&fov_rng, 0, 1023);
+                    viewer_y[i] = rngRange(&fov_rng, 0, 1023);
+                } while (opaqueAt(opacity, viewer_x[i], viewer_y[i]));
+                // goals go in the second half of the viewer arrays
+                do {
+                    viewer_x[routes + i] = viewer_x[i]
+                                           + rngRange(&fov_rng, -64, 64);
+                    viewer_y[routes + i] = viewer_y[i]
+                                           + rngRange(&fov_rng, -64, 64);
+                } while (opaqueAt(opacity, viewer_x[routes + i],
+                                  viewer_y[routes + i]));
+                // a goal walled off from the start costs a search of
+                // everything the start can reach, so only time real routes
+                if (findPath(finder, opacity, PATH_JPS, viewer_x[i],
+                             viewer_y[i], viewer_x[routes + i],
+                             viewer_y[routes + i], NULL, 0) < 0) {
+                    i--;
+                }
+            }
+
+            const char *path_names[] = { "path_astar_64", "path_jps_64" };
+            for (int algorithm = PATH_ASTAR; algorithm <= PATH_JPS;
+                 algorithm++) {
+                result = addBenchResult(report, path_names[algorithm], 10,
+                                        routes);
+                for (int i = 0; i < 10; i++) {
+                    uint64_t start = benchNow();
+                    for (int j = 0; j < routes; j++) {
+                        bench_sink += (uint64_t)findPath(
+                            finder, opacity, algorithm, viewer_x[j],
+                            viewer_y[j], viewer_x[routes + j],
+                            viewer_y[routes + j], NULL, 0);
+                    }
+                    benchRecord(result, benchSeconds(start, benchNow()));
+                }
+            }
+
+            // every route asked for again from where it started, as an
+            // entity standing still would each turn
+            int length;
+            for (int j = 0; j < routes; j++) {
+                pathFor(path_cache, finder, opacity, PATH_JPS, (Entity)j,
+                        viewer_x[j], viewer_y[j], viewer_x[routes + j],
+                        viewer_y[routes + j], &length);
+            }
+            result = addBenchResult(report, "path_cached", 10, routes);
+            for (int i = 0; i < 10; i++) {
+                uint64_t start = benchNow();
+                for (int j = 0; j < routes; j++) {
+                    pathFor(path_cache, finder, opacity, PATH_JPS, (Entity)j,
+                            viewer_x[j], viewer_y[j], viewer_x[routes + j],
+                            viewer_y[routes + j], &length);
+                    bench_sink += length;
+                }
+                benchRecord(result, benchSeconds(start, benchNow()));
+            }
+
+            // a turn of the whole crowd closing in on the first goal: one
+            // search over the whole 1024 tiles, then a step each
+            result = addBenchResult(report, "flow_turn_1024x1024", 10,
+                                    routes);
+            for (int i = 0; i < 10; i++) {
+                uint64_t start = benchNow();
+                clearFlowMap(flow, opacity);
+                addFlowSource(flow, viewer_x[routes], viewer_y[routes]);
+                computeFlowMap(flow, opacity, 0);
+                for (int j = 0; j < routes; j++) {
+                    int next_x;
+                    int next_y;
+                    bench_sink += flowStep(flow, opacity, viewer_x[j],
+                                           viewer_y[j], &next_x, &next_y);
+                }
+                benchRecord(result, benchSeconds(start, benchNow()));
+            }
+        }
+        destroyFlowMap(flow);
+        destroyPathCache(path_cache);
+        destroyPathFinder(finder);
+    }
+    free(viewer);
+    free(viewer_x);
+    free(viewer_y);
+    destroyFovCache(fov_cache);
+    destroyOpacityMap(opacity);
+
+    // all of generateCaveTerrain, the automaton above plus joining up the
+    // pockets of floor it leaves cut off. last, as it changes the cave
+    result = addBenchResult(report, "terrain_4096x4096", 5, 1);
+    for (int i = 0; large_map != NULL && i < 5; i++) {
+        MapGenOptions options = { .seed = seed + i, .threads = threads,
+                                  .connectivity = MAP_CONNECT_TUNNEL,
+                                  .chunked = false };
+        uint64_t start = benchNow();
+        generateCaveTerrain(large_map, &options);
+        benchRecord(result, benchSeconds(start, benchNow()));
+    }
+
+    if (large_map != NULL) {
+        destroyMap(large_map);
+    }
+
+    // a crowd's worth of turns through each scheduler
+    const int actors = 100000;
+    Rng turn_rng;
+    rngSeed(&turn_rng, seed);
+    EntityStore *crowd = initEntityStore(actors);
+    for (int i = 0; crowd != NULL && i < actors; i++) {
+        Entity entity = addEntity(crowd, 0, i, 0, 0);
+        crowd->speed[entityIndex(crowd, entity)] = 50 + i % 100;
+    }
+    const char *turn_names[] = { "turns_shuffled", "turns_energy" };
+    for (int mode = TURN_SHUFFLED; crowd != NULL && mode <= TURN_ENERGY;
+         mode++) {
+        TurnScheduler *turns = initTurnScheduler(mode);
+        if (turns == NULL) {
+            break;
+        }
+        for (int i = 0; i < crowd->count; i++) {
+            scheduleEntity(turns, crowd, &turn_rng, crowd->handle[i]);
+        }
+        result = addBenchResult(report, turn_names[mode], 20, actors);
+        for (int i = 0; i < 20; i++) {
+            uint64_t sum = 0;
+            uint64_t start = benchNow();
+            for (int j = 0; j < actors; j++) {
+                sum += nextTurn(turns, crowd, &turn_rng);
+            }
+            benchRecord(result, benchSeconds(start, benchNow()));
+            bench_sink += sum;
+        }
+        destroyTurnScheduler(turns);
+    }
+
+    // the same crowd spread over a 1024x1024 map, looked up by position.
+    // scan_radius is what finding neighbours cost before the index
+    const int side = 1024;
+    const int queries = 10000;
+    SpatialIndex *spatial =
+        crowd != NULL ? initSpatialIndex(side, side, actors) : NULL;
+    for (int i = 0; spatial != NULL && i < crowd->count; i++) {
+        crowd->x[i] = rngRange(&turn_rng, 0, side - 1);
+        crowd->y[i] = rngRange(&turn_rng, 0, side - 1);
+        spatialInsert(spatial, crowd->handle[i], crowd->x[i], crowd->y[i]);
+    }
+    Entity found[1024];
+    if (spatial != NULL) {
+        result = addBenchResult(report, "spatial_radius_8", 20, queries);
+        for (int i = 0; i < 20; i++) {
+            uint64_t sum = 0;
+            uint64_t start = benchNow();
+            for (int j = 0; j < queries; j++) {
+                sum += spatialQueryRadius(spatial,
+                                          rngRange(&turn_rng, 0, side - 1),
+                                          rngRange(&turn_rng, 0, side - 1), 8,
+                                          found, 1024);
+            }
+            benchRecord(result, benchSeconds(start, benchNow()));
+            bench_sink += sum;
+        }
+
+        result = addBenchResult(report, "scan_radius_8", 5, 100);
+        for (int i = 0; i < 5; i++) {
+            uint64_t sum = 0;
+            uint64_t start = benchNow();
+            for (int j = 0; j < 100; j++) {
+                int x = rngRange(&turn_rng, 0, side - 1);
+                int y = rngRange(&turn_rng, 0, side - 1);
+                for (int k = 0; k < crowd->count; k++) {
+                    int dx = crowd->x[k] - x;
+                    int dy = crowd->y[k] - y;
+                    sum += dx * dx + dy * dy <= 64;
+                }
+            }
+            benchRecord(result, benchSeconds(start, benchNow()));
+            bench_sink += sum;
+        }
+
+        // everyone takes a step
+        result = addBenchResult(report, "spatial_move", 20, crowd->count);
+        for (int i = 0; i < 20; i++) {
+            uint64_t start = benchNow();
+            for (int k = 0; k < crowd->count; k++) {
+                int x = crowd->x[k] + rngRange(&turn_rng, -1, 1);
+                int y = crowd->y[k] + rngRange(&turn_rng, -1, 1);
+                x = x < 0 ? 0 : (x >= side ? side - 1 : x);
+                y = y < 0 ? 0 : (y >= side ? side - 1 : y);
+                crowd->x[k] = x;
+                crowd->y[k] = y;
+                spatialMove(spatial, crowd->handle[k], x, y);
+            }
+            benchRecord(result, benchSeconds(start, benchNow()));
+        }
+    }
+    destroySpatialIndex(spatial);
+    destroyEntityStore(crowd);
+
+    const int draws = 1000000;
+    Rng rng;
+    rngSeed(&rng, seed);
+
+    result = addBenchResult(report, "rng_next", 20, draws);
+    for (int i = 0; i < 20; i++) {
+        uint64_t sum = 0;
+        uint64_t start = benchNow();
+        for (int j = 0; j < draws; j++) {
+            sum += rngNext(&rng);
+        }
+        benchRecord(result, benchSeconds(start, benchNow()));
+        bench_sink += sum;
+    }
+
+    result = addBenchResult(report, "rng_range", 20, draws);
+    for (int i = 0; i < 20; i++) {
+        uint64_t sum = 0;
+        uint64_t start = benchNow();
+        for (int j = 0; j < draws; j++) {
+            sum += rngRange(&rng, 0, 99);
+        }
+        benchRecord(result, benchSeconds(start, benchNow()));
+        bench_sink += sum;
+    }
+
+    // the baselines
+    srand((unsigned int)seed);
+    result = addBenchResult(report, "libc_rand", 20, draws);
+    for (int i = 0; i < 20; i++) {
+        uint64_t sum = 0;
+        uint64_t start = benchNow();
+        for (int j = 0; j < draws; j++) {
+            sum += rand();
+        }
+        benchRecord(result, benchSeconds(start, benchNow()));
+        bench_sink += sum;
+    }
+
+    result = addBenchResult(report, "libc_rand_modulo", 20, draws);
+    for (int i = 0; i < 20; i++) {
+        uint64_t sum = 0;
+        uint64_t start = benchNow();
+        for (int j = 0; j < draws; j++) {
+            sum += rand() % 100;
+        }
+        benchRecord(result, benchSeconds(start, benchNow()));
+        bench_sink += sum;
+    }
+}
+
+void printBenchReport(FILE *out, const BenchReport *report) {
+    fprintf(out, "%-24s %8s %12s %12s %12s %14s\n",
+            "", "samples", "min (us)", "median (us)", "p99 (us)", "ops/s");
+    for (int i = 0; i < report->count; i++) {
+        const BenchResult *result = &report->results[i];
+        double min, median, p99;
+        benchSummary(result, &min, &median, &p99);
+        fprintf(out, "%-24s %8d %12.1f %12.1f %12.1f %14.0f\n",
+                result->name, result->count, min * 1e6, median * 1e6,
+                p99 * 1e6, median > 0 ? result->ops_per_sample / median : 0);
+    }
+}
+
+static const char* backendName(int backend) {
+    switch (backend) {
+        case RENDERER_BACKEND:
+        return "renderer";
+
+        case SOFTWARE_RENDERER_BACKEND:
+        return "software";
+
+        default:
+        return "surface";
+    }
+}
+
+// one object per run. times are in microseconds
+void writeBenchJson(FILE *out, const BenchReport *report,
+                    GameState *game_state, RenderTarget *render_target,
+                    GameMap *game_map, int frames) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"seed\": %llu,\n", (unsigned long long)game_state->seed);
+    fprintf(out, "  \"frames\": %d,\n", frames);
+    fprintf(out, "  \"backend\": \"%s\",\n",
+            backendName(render_target->backend));
+    fprintf(out, "  \"threads\": %d,\n", game_state->map_options.threads);
+    fprintf(out, "  \"extra_critters\": %d,\n", game_state->extra_critters);
+    fprintf(out, "  \"screen\": { \"width\": %d, \"height\": %d },\n",
+            render_target->screen_width, render_target->screen_height);
+    fprintf(out, "  \"map\": { \"width\": %d, \"height\": %d, "
+            "\"chunked\": %s },\n", game_map->width, game_map->height,
+            game_map->chunks != NULL ? "true" : "false");
+    fprintf(out, "  \"results\": {\n");
+    for (int i = 0; i < report->count; i++) {
+        const BenchResult *result = &report->results[i];
+        double min, median, p99;
+        benchSummary(result, &min, &median, &p99);
+        fprintf(out, "    \"%s\": { \"samples\": %d, \"min_us\": %.3f, "
+                "\"median_us\": %.3f, \"p99_us\": %.3f, "
+                "\"ops_per_second\": %.1f }%s\n",
+                result->name, result->count, min * 1e6, median * 1e6,
+                p99 * 1e6, median > 0 ? result->ops_per_sample / median : 0,
+                i + 1 < report->count ? "," : "");
+    }
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+}
+
+// whether two surfaces of the same size and format show the same colours.
+// bits no channel uses, the X of RGB888, don't count: SDL_BlitSurface clears
+// them where blitTile copies whatever the sheet had there
+static bool sameColours(SDL_Surface *a, SDL_Surface *b) {
+    int bytes = a->format->BytesPerPixel;
+    Uint32 mask = a->format->Rmask | a->format->Gmask | a->format->Bmask
+                  | a->format->Amask;
+    for (int y = 0; y < a->h; y++) {
+        const uint8_t *row_a = (const uint8_t *)a->pixels + y * a->pitch;
+        const uint8_t *row_b = (const uint8_t *)b->pixels + y * b->pitch;
+        if (bytes != 4 || mask == 0) {
+            if (memcmp(row_a, row_b, (size_t)a->w * bytes) != 0) {
+                return false;
+            }
+            continue;
+        }
+        for (int x = 0; x < a->w; x++) {
+            Uint32 pixel_a, pixel_b;
+            memcpy(&pixel_a, row_a + x * 4, 4);
+            memcpy(&pixel_b, row_b + x * 4, 4);
+            if (((pixel_a ^ pixel_b) & mask) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// the terrain sheet at each depth a window is likely to have, drawn over a
+// view half a tile off the grid (so the edges get clipped) a tile at a time:
+// a floor or cave tile, then a wall edge on top. SDL_BlitSurface against
+// blitTile, which also have to agree on what they drew
+static void benchTileBlits(BenchReport *report, SDL_Surface *terrain) {
+    static const Uint32 formats[] = { SDL_PIXELFORMAT_RGB565,
+                                      SDL_PIXELFORMAT_RGB24,
+                                      SDL_PIXELFORMAT_RGB888 };
+    static const char *sdl_names[] = { "blit_sdl_16bpp", "blit_sdl_24bpp",
+                                       "blit_sdl_32bpp" };
+    static const char *tile_names[] = { "blit_tiles_16bpp",
+                                        "blit_tiles_24bpp",
+                                        "blit_tiles_32bpp" };
+    const int width = 1024;
+    const int height = 768;
+    int columns = width / TILE_SIZE + 1;
+    int rows = height / TILE_SIZE + 1;
+    int edges = terrain->w / TILE_SIZE;
+
+    for (int f = 0; f < 3; f++) {
+        SDL_Surface *sheet = SDL_CreateRGBSurfaceWithFormat(0, terrain->w,
+            terrain->h, SDL_BITSPERPIXEL(formats[f]), formats[f]);
+        SDL_Surface *views[2] = {
+            SDL_CreateRGBSurfaceWithFormat(0, width, height,
+                SDL_BITSPERPIXEL(formats[f]), formats[f]),
+            SDL_CreateRGBSurfaceWithFormat(0, width, height,
+                SDL_BITSPERPIXEL(formats[f]), formats[f]) };
+        TileSheet *tiles = NULL;
+        if (sheet != NULL) {
+            // the key survives the conversion, the sheet's RLE doesn't
+            Uint32 key;
+            if (SDL_GetColorKey(terrain, &key) == 0) {
+                Uint8 r, g, b;
+                SDL_GetRGB(key, terrain->format, &r, &g, &b);
+                key = SDL_MapRGB(sheet->format, r, g, b);
+                SDL_FillRect(sheet, NULL, key);
+                SDL_BlitSurface(terrain, NULL, sheet, NULL);
+                SDL_SetColorKey(sheet, SDL_TRUE, key);
+            }
+            else {
+                SDL_BlitSurface(terrain, NULL, sheet, NULL);
+            }
+            tiles = initTileSheet(sheet);
+        }
+
+        if (tiles != NULL && views[0] != NULL && views[1] != NULL) {
+            BenchResult *sdl = addBenchResult(report, sdl_names[f], 20,
+                                              columns * rows * 2);
+            BenchResult *ours = addBenchResult(report, tile_names[f], 20,
+                                               columns * rows * 2);
+            for (int sample = 0; sample < 20; sample++) {
+                for (int pass = 0; pass < 2; pass++) {
+                    SDL_FillRect(views[pass], NULL, 0);
+                    uint64_t start = benchNow();
+                    for (int y = 0; y < rows; y++) {
+                        for (int x = 0; x < columns; x++) {
+                            int left = x * TILE_SIZE - TILE_SIZE / 2;
+                            int top = y * TILE_SIZE - TILE_SIZE / 2;
+                            int base = (x + y) % 2 == 0 ? FLOOR : CAVE;
+                            int edge = (x * 7 + y) % edges;
+                            if (pass == 0) {
+                                SDL_Rect source = {
+                                    .x = 0, .y = base * TILE_SIZE,
+                                    .w = TILE_SIZE, .h = TILE_SIZE };
+                                SDL_Rect destination = {.x = left, .y = top};
+                                SDL_BlitSurface(sheet, &source, views[0],
+                                                &destination);
+                                source.x = edge * TILE_SIZE;
+                                source.y = WALLS * TILE_SIZE;
+                                destination = (SDL_Rect){.x = left, .y = top};
+                                SDL_BlitSurface(sheet, &source, views[0],
+                                                &destination);
+                            }
+                            else {
+                                blitTile(tiles, base, 0, left, top, views[1]);
+                                blitTile(tiles, WALLS, edge, left, top,
+                                         views[1]);
+                            }
+                        }
+                    }
+                    benchRecord(pass == 0 ? sdl : ours,
+                                benchSeconds(start, benchNow()));
+                }
+            }
+
+            if (!sameColours(views[0], views[1])) {
+                printf("blitTile and SDL_BlitSurface disagree at %d bpp!\n",
+                       views[0]->format->BytesPerPixel * 8);
+            }
+        }
+
+        destroyTileSheet(tiles);
+        SDL_FreeSurface(sheet);
+        SDL_FreeSurface(views[0]);
+        SDL_FreeSurface(views[1]);
+    }
+}
+
+static void pushKey(SDL_Keycode key) {
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_KEYDOWN;
+    event.key.state = SDL_PRESSED;
+    event.key.keysym.sym = key;
+    SDL_PushEvent(&event);
+}
+
+// the main loop, but for a fixed number of frames of scripted input and with
+// every phase timed. the same seed and script always play the same game
+int runBenchmark(GameState *game_state, RenderTarget *render_target,
+                 Resources *resources, GameMap **game_map, Camera *camera) {
+    int frames = game_state->bench_frames;
+    BenchReport report = { .count = 0 };
+    BenchResult *input = addBenchResult(&report, "input", frames, 1);
+    BenchResult *update = addBenchResult(&report, "update", frames, 1);
+    BenchResult *draw = addBenchResult(&report, "render", frames, 1);
+    BenchResult *frame = addBenchResult(&report, "frame", frames, 1);
+    SDL_Event e;
+
+    int played = 0;
+    int script_length = sizeof(BENCH_SCRIPT) / sizeof(BENCH_SCRIPT[0]);
+    while (game_state->status != EXITING && played < frames) {
+        pushKey(BENCH_SCRIPT[played % script_length]);
+        if (played % BENCH_NEW_MAP_EVERY == BENCH_NEW_MAP_EVERY - 1) {
+            pushKey(SDLK_n);
+        }
+
+        PROFILE_BEGIN(frame);
+        uint64_t start = benchNow();
+        processInputs(&e, game_state, render_target, camera);
+        uint64_t inputs_done = benchNow();
+        gameUpdate(game_state, resources, game_map, render_target);
+        uint64_t update_done = benchNow();
+        if (render(render_target, camera, resources, *game_map, game_state)) {
+            noteFirstFrame(game_state);
+        }
+        uint64_t render_done = benchNow();
+        PROFILE_END_FRAME(frame);
+
+        benchRecord(input, benchSeconds(start, inputs_done));
+        benchRecord(update, benchSeconds(inputs_done, update_done));
+        benchRecord(draw, benchSeconds(update_done, render_done));
+        benchRecord(frame, benchSeconds(start, render_done));
+        played++;
+    }
+
+    // the debug overlay redone from scratch, as often as a 60 Hz HUD would:
+    // new text, laid out and drawn from the glyph cache the way the backend
+    // draws it, blitted onto a surface in the window's format or batched
+    // from the glyph texture
+    bool surface = render_target->backend == SURFACE_BACKEND;
+    SDL_Surface *overlay = !surface ? NULL
+        : SDL_CreateRGBSurfaceWithFormat(0, render_target->screen_width,
+            render_target->screen_height,
+            resources->glyphs->sheet->format->BitsPerPixel,
+            resources->glyphs->sheet->format->format);
+    if (overlay != NULL || !surface) {
+        BenchResult *result = addBenchResult(&report, "overlay_text", 60, 1);
+        for (int sample = 0; sample < 60; sample++) {
+            uint64_t start = benchNow();
+            updateDebugInfo(resources->glyphs, render_target, *game_map,
+                            camera->scale + sample % 2);
+            if (surface) {
+                drawText(resources->glyphs, render_target->debug_text, 0, 0,
+                         overlay);
+            }
+            else {
+                renderText(render_target, resources,
+                           render_target->debug_text, 0, 0);
+            }
+            benchRecord(result, benchSeconds(start, benchNow()));
+        }
+        SDL_FreeSurface(overlay);
+        render_target->debug_info_changed = true;
+    }
+
+    benchTileBlits(&report, resources->terrain);
+
+    // one sample each, from launching this run
+    benchRecord(addBenchResult(&report, "startup", 1, 1),
+                game_state->startup_seconds);
+    benchRecord(addBenchResult(&report, "startup_assets", 1, 1),
+                game_state->asset_seconds);
+
+    runMicroBenchmarks(&report, game_state->seed,
+                       game_state->map_options.threads);
+
+    printf("%d frames from seed %llu\n", played,
+           (unsigned long long)game_state->seed);
+    printBenchReport(stdout, &report);
+
+    if (game_state->bench_json != NULL) {
+        FILE *out = strcmp(game_state->bench_json, "-") == 0
+                    ? stdout : fopen(game_state->bench_json, "w");
+        if (out == NULL) {
+            printf("Could not write %s!\n", game_state->bench_json);
+        }
+        else {
+            writeBenchJson(out, &report, game_state, render_target,
+                           *game_map, played);
+            if (out != stdout) {
+                fclose(out);
+            }
+        }
+    }
+
+    destroyBenchReport(&report);
+    return played == frames ? 0 : -1;
+}
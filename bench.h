@@ -0,0 +1,47 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "yarz.h"
+
+// the benchmark harness. --bench N plays N frames with scripted inputs, times
+// every phase of every frame, runs a few standalone benchmarks and reports
+// min/median/p99 for each, as a table and optionally as JSON. with --headless
+// it needs no display, see `make bench`
+
+#define MAX_BENCH_RESULTS 48
+
+// every timing taken for one thing being measured, in seconds
+typedef struct BenchResult {
+    const char *name;
+    double *samples;
+    int count;
+    int capacity;
+    // for benchmarks that do many operations per sample. ops_per_sample / the
+    // median sample gives a rate (e.g. queries per second)
+    double ops_per_sample;
+} BenchResult;
+
+typedef struct BenchReport {
+    BenchResult results[MAX_BENCH_RESULTS];
+    int count;
+} BenchReport;
+
+BenchResult* addBenchResult(BenchReport *, const char *, int, double);
+void benchRecord(BenchResult *, double);
+void benchSummary(const BenchResult *, double *, double *, double *);
+void destroyBenchReport(BenchReport *);
+
+uint64_t benchNow();
+double benchSeconds(uint64_t, uint64_t);
+
+void runMicroBenchmarks(BenchReport *, uint64_t, int);
+void printBenchReport(FILE *, const BenchReport *);
+void writeBenchJson(FILE *, const BenchReport *, GameState *, RenderTarget *,
+                    GameMap *, int);
+
+int runBenchmark(GameState *, RenderTarget *, Resources *, GameMap **,
+                 Camera *);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,252 @@
+#include "blit.h"
+#include "map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the pixel at p, the way SDL reads it
+static Uint32 readPixel(const uint8_t *p, int bytes) {
+    Uint16 pixel16;
+    Uint32 pixel32;
+    switch (bytes) {
+        case 2:
+        memcpy(&pixel16, p, sizeof(pixel16));
+        return pixel16;
+
+        case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+        return p[0] | p[1] << 8 | (Uint32)p[2] << 16;
+#else
+        return (Uint32)p[0] << 16 | p[1] << 8 | p[2];
+#endif
+
+        default:
+        memcpy(&pixel32, p, sizeof(pixel32));
+        return pixel32;
+    }
+}
+
+// writes the spans of one tile row to spans and returns how many there are,
+// never more than BLIT_TILE_SIZE / 2. the colour key is compared the way
+// SDL does, without alpha
+static int rowSpans(const uint8_t *row, int bytes, bool keyed, Uint32 key,
+                    Uint32 mask, TileSpan *spans) {
+    int count = 0;
+    int x = 0;
+    while (x < BLIT_TILE_SIZE) {
+        while (x < BLIT_TILE_SIZE && keyed
+               && (readPixel(row + x * bytes, bytes) & mask) == key) {
+            x++;
+        }
+        int start = x;
+        while (x < BLIT_TILE_SIZE && !(keyed
+               && (readPixel(row + x * bytes, bytes) & mask) == key)) {
+            x++;
+        }
+        if (x > start) {
+            spans[count++] = (TileSpan){ .x = (uint8_t)start,
+                                         .length = (uint8_t)(x - start) };
+        }
+    }
+    return count;
+}
+
+// whether drawing surface is a plain copy of whatever isn't colour key: no
+// blending, no colour or alpha mod, and pixels we can read
+static bool sheetCopies(SDL_Surface *surface) {
+    SDL_BlendMode blend;
+    Uint8 r, g, b, a;
+    SDL_GetSurfaceBlendMode(surface, &blend);
+    SDL_GetSurfaceColorMod(surface, &r, &g, &b);
+    SDL_GetSurfaceAlphaMod(surface, &a);
+    return TILE_SIZE == BLIT_TILE_SIZE && surface->pixels != NULL
+           && surface->format->BytesPerPixel >= 2
+           && (blend == SDL_BLENDMODE_NONE || surface->format->Amask == 0)
+           && r == 255 && g == 255 && b == 255 && a == 255;
+}
+
+// sorts out every tile of surface. the surface has to outlive the sheet, and
+// be left as it is
+TileSheet* initTileSheet(SDL_Surface *surface) {
+    TileSheet *sheet = (TileSheet *)calloc(1, sizeof(TileSheet));
+    if (sheet == NULL) {
+        printf("Could not allocate tile sheet!\n");
+        return NULL;
+    }
+    sheet->surface = surface;
+    sheet->columns = surface->w / BLIT_TILE_SIZE;
+    sheet->tiles = sheet->columns * (surface->h / BLIT_TILE_SIZE);
+    if (!sheetCopies(surface) || sheet->tiles == 0) {
+        return sheet;
+    }
+
+    int bytes = surface->format->BytesPerPixel;
+    Uint32 mask = ~surface->format->Amask;
+    Uint32 key = 0;
+    bool keyed = SDL_GetColorKey(surface, &key) == 0;
+    key &= mask;
+    const uint8_t *pixels = (const uint8_t *)surface->pixels;
+
+    sheet->kinds = (uint8_t *)malloc(sheet->tiles);
+    sheet->rows = (int *)malloc(sizeof(int)
+                                * (sheet->tiles * BLIT_TILE_SIZE + 1));
+    if (sheet->kinds == NULL || sheet->rows == NULL) {
+        printf("Could not allocate tile sheet!\n");
+        destroyTileSheet(sheet);
+        return NULL;
+    }
+
+    // counted first, so the spans go in one allocation
+    TileSpan row_spans[BLIT_TILE_SIZE / 2];
+    int count = 0;
+    for (int tile = 0; tile < sheet->tiles; tile++) {
+        const uint8_t *corner =
+            pixels + tile / sheet->columns * BLIT_TILE_SIZE * surface->pitch
+            + tile % sheet->columns * BLIT_TILE_SIZE * bytes;
+        bool opaque = true;
+        int first = count;
+        for (int row = 0; row < BLIT_TILE_SIZE; row++) {
+            sheet->rows[tile * BLIT_TILE_SIZE + row] = count;
+            int spans = rowSpans(corner + row * surface->pitch, bytes, keyed,
+                                 key, mask, row_spans);
+            opaque = opaque && spans == 1
+                     && row_spans[0].length == BLIT_TILE_SIZE;
+            count += spans;
+        }
+        sheet->kinds[tile] = count == first ? TILE_BLANK
+                             : opaque ? TILE_OPAQUE : TILE_KEYED;
+    }
+    sheet->rows[sheet->tiles * BLIT_TILE_SIZE] = count;
+
+    sheet->spans = (TileSpan *)malloc(sizeof(TileSpan) * (count + 1));
+    if (sheet->spans == NULL) {
+        printf("Could not allocate %d tile spans!\n", count);
+        destroyTileSheet(sheet);
+        return NULL;
+    }
+    for (int tile = 0; tile < sheet->tiles; tile++) {
+        const uint8_t *corner =
+            pixels + tile / sheet->columns * BLIT_TILE_SIZE * surface->pitch
+            + tile % sheet->columns * BLIT_TILE_SIZE * bytes;
+        for (int row = 0; row < BLIT_TILE_SIZE; row++) {
+            rowSpans(corner + row * surface->pitch, bytes, keyed, key, mask,
+                     &sheet->spans[sheet->rows[tile * BLIT_TILE_SIZE + row]]);
+        }
+    }
+
+    sheet->pixels = pixels;
+    sheet->pitch = surface->pitch;
+    sheet->bytes = bytes;
+    return sheet;
+}
+
+void destroyTileSheet(TileSheet *sheet) {
+    if (sheet == NULL) {
+        return;
+    }
+    free(sheet->kinds);
+    free(sheet->rows);
+    free(sheet->spans);
+    free(sheet);
+}
+
+// whether blitTile copies sheet's tiles onto destination itself, rather than
+// handing them to SDL_BlitSurface
+bool tileSheetBlits(const TileSheet *sheet, const SDL_Surface *destination) {
+    return sheet->pixels != NULL && !SDL_MUSTLOCK(destination)
+           && destination->format->format == sheet->surface->format->format;
+}
+
+// a whole opaque tile, row_bytes being a constant so each copy is a few
+// moves rather than a call
+static inline void copyTile(uint8_t *to, int to_pitch, const uint8_t *from,
+                            int from_pitch, size_t row_bytes) {
+    for (int row = 0; row < BLIT_TILE_SIZE; row++) {
+        memcpy(to, from, row_bytes);
+        to += to_pitch;
+        from += from_pitch;
+    }
+}
+
+// draws the tile at (offset, sprite) of sheet, in tiles, with its top left at
+// x, y of destination. same as SDL_BlitSurface with that TILE_SIZE square
+void blitTile(const TileSheet *sheet, int sprite, int offset, int x, int y,
+              SDL_Surface *destination) {
+    if (!tileSheetBlits(sheet, destination)) {
+        SDL_Rect source_rect = {.h = BLIT_TILE_SIZE, .w = BLIT_TILE_SIZE,
+                                .x = offset * BLIT_TILE_SIZE,
+                                .y = sprite * BLIT_TILE_SIZE};
+        SDL_Rect destination_rect = {.h = 0, .w = 0, .x = x, .y = y};
+        SDL_BlitSurface(sheet->surface, &source_rect, destination,
+                        &destination_rect);
+        return;
+    }
+
+    if (sprite < 0 || offset < 0 || offset >= sheet->columns) {
+        return;
+    }
+    int tile = sprite * sheet->columns + offset;
+    if (tile >= sheet->tiles || sheet->kinds[tile] == TILE_BLANK) {
+        return;
+    }
+
+    // what of the tile is inside the clip rectangle, in tile pixels
+    const SDL_Rect *clip = &destination->clip_rect;
+    int left = x < clip->x ? clip->x - x : 0;
+    int top = y < clip->y ? clip->y - y : 0;
+    int right = x + BLIT_TILE_SIZE > clip->x + clip->w
+                ? clip->x + clip->w - x : BLIT_TILE_SIZE;
+    int bottom = y + BLIT_TILE_SIZE > clip->y + clip->h
+                 ? clip->y + clip->h - y : BLIT_TILE_SIZE;
+    if (left >= right || top >= bottom) {
+        return;
+    }
+
+    int bytes = sheet->bytes;
+    const uint8_t *from = sheet->pixels
+                          + (sprite * BLIT_TILE_SIZE + top) * sheet->pitch
+                          + offset * BLIT_TILE_SIZE * bytes;
+    uint8_t *to = (uint8_t *)destination->pixels
+                  + (y + top) * destination->pitch;
+
+    if (sheet->kinds[tile] == TILE_OPAQUE && left == 0 && top == 0
+        && right == BLIT_TILE_SIZE && bottom == BLIT_TILE_SIZE) {
+        to += x * bytes;
+        switch (bytes) {
+            case 2:
+            copyTile(to, destination->pitch, from, sheet->pitch,
+                     BLIT_TILE_SIZE * 2);
+            break;
+
+            case 3:
+            copyTile(to, destination->pitch, from, sheet->pitch,
+                     BLIT_TILE_SIZE * 3);
+            break;
+
+            default:
+            copyTile(to, destination->pitch, from, sheet->pitch,
+                     BLIT_TILE_SIZE * 4);
+            break;
+        }
+        return;
+    }
+
+    // keyed, or over an edge. an opaque row is a single span all the way
+    // across, so both come down to copying what of each span is inside
+    const int *rows = &sheet->rows[tile * BLIT_TILE_SIZE];
+    for (int row = top; row < bottom; row++) {
+        const TileSpan *span = &sheet->spans[rows[row]];
+        const TileSpan *end = &sheet->spans[rows[row + 1]];
+        for (; span < end; span++) {
+            int start = span->x > left ? span->x : left;
+            int stop = span->x + span->length < right
+                       ? span->x + span->length : right;
+            if (start < stop) {
+                memcpy(to + (x + start) * bytes, from + start * bytes,
+                       (size_t)(stop - start) * bytes);
+            }
+        }
+        to += destination->pitch;
+        from += sheet->pitch;
+    }
+}
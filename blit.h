@@ -0,0 +1,53 @@
+#ifndef __BLIT_H__
+#define __BLIT_H__
+
+#include "SDL2/SDL.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// a blitter for what the surface backend draws all day: one TILE_SIZE square
+// of a sheet onto a surface of the same pixel format. SDL_BlitSurface works
+// out clipping, format conversion and the colour key all over again on every
+// call. here the sheet is looked at once instead: each tile is found to be
+// blank, opaque or keyed, and each row of a keyed tile becomes the spans of
+// pixels that aren't the colour key. an opaque tile is then a straight copy
+// of 32 rows, a keyed one a copy of each span, and clipping only happens for
+// tiles over the edge of the destination's clip rectangle
+//
+// anything else (another pixel format, a sheet that blends or is tinted, or
+// whose pixels RLE took away) goes to SDL_BlitSurface as before
+
+#define BLIT_TILE_SIZE 32  // has to match TILE_SIZE, or nothing is sped up
+
+enum tileKind {
+    TILE_BLANK,   // all colour key, nothing to draw
+    TILE_OPAQUE,  // no colour key anywhere
+    TILE_KEYED
+};
+
+// a run of pixels in a tile row to copy
+typedef struct TileSpan {
+    uint8_t x;
+    uint8_t length;
+} TileSpan;
+
+typedef struct TileSheet {
+    SDL_Surface *surface;   // not ours
+    const uint8_t *pixels;  // NULL: every tile goes through SDL_BlitSurface
+    int pitch;
+    int bytes;              // per pixel
+    int columns;            // tiles across the sheet
+    int tiles;
+    uint8_t *kinds;         // enum tileKind, for each tile
+    // the spans of row r of tile t are spans[rows[t * BLIT_TILE_SIZE + r]]
+    // up to spans[rows[t * BLIT_TILE_SIZE + r + 1]]
+    int *rows;
+    TileSpan *spans;
+} TileSheet;
+
+TileSheet* initTileSheet(SDL_Surface *);
+void destroyTileSheet(TileSheet *);
+bool tileSheetBlits(const TileSheet *, const SDL_Surface *);
+void blitTile(const TileSheet *, int, int, int, int, SDL_Surface *);
+
+#endif /* __BLIT_H__ */
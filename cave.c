@@ -0,0 +1,592 @@
+#include "cave.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAVE_HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// every kernel processes this many words per loop, so rows are padded to it
+#define CAVE_ROW_WORD_MULTIPLE 4
+
+typedef void (*CaveRowKernel)(const uint64_t *, const uint64_t *,
+                              const uint64_t *, const uint64_t *,
+                              uint64_t *, int);
+
+CaveBoard* initCaveBoard(int width, int height) {
+    CaveBoard *board = (CaveBoard *)malloc(sizeof(CaveBoard));
+    if (board == NULL) {
+        return NULL;
+    }
+
+    int words = (width + 63) / 64;
+    words = (words + CAVE_ROW_WORD_MULTIPLE - 1)
+            / CAVE_ROW_WORD_MULTIPLE * CAVE_ROW_WORD_MULTIPLE;
+
+    board->width = width;
+    board->height = height;
+    board->stride = words + 2;
+
+    size_t buffer_words = (size_t)board->stride * height;
+    board->cells = (uint64_t *)calloc(buffer_words, sizeof(uint64_t));
+    board->next = (uint64_t *)calloc(buffer_words, sizeof(uint64_t));
+    board->interior = (uint64_t *)calloc(board->stride, sizeof(uint64_t));
+    if (board->cells == NULL || board->next == NULL
+        || board->interior == NULL) {
+        destroyCaveBoard(board);
+        return NULL;
+    }
+
+    // the outermost ring of the map is left alone, same as the old generator
+    for (int x = 1; x < width - 1; x++) {
+        board->interior[1 + x / 64] |= (uint64_t)1 << (x % 64);
+    }
+
+    return board;
+}
+
+void destroyCaveBoard(CaveBoard *board) {
+    if (board == NULL) {
+        return;
+    }
+    free(board->cells);
+    free(board->next);
+    free(board->interior);
+    free(board);
+}
+
+// writes rows [first, last) of the given buffer into game_map, keeping any
+// cell flags
+static void caveUnpackRows(CaveBoard *board, uint64_t *buffer,
+                           GameMap *game_map, int first, int last) {
+    for (int y = first; y < last; y++) {
+        MapCell *cells = mapRow(game_map, y);
+        uint64_t *row = caveRow(board, buffer, y);
+        for (int x = 0; x < board->width; x += 64) {
+            int count = board->width - x < 64 ? board->width - x : 64;
+            uint64_t word = row[x / 64];
+            for (int bit = 0; bit < count; bit++) {
+                cells[x + bit] = (cells[x + bit] & MAP_FLAG_MASK)
+                                 | ((word >> bit) & 1 ? MAP_WALL : MAP_FLOOR);
+            }
+        }
+    }
+}
+
+// rolls row y of a fresh map straight into the board: a ring of wall around
+// the edge and CAVE_WALL_PROBABILITY noise inside it. the noise is keyed by
+// world position, so the board can be a window onto a bigger world
+static void caveFillRow(CaveBoard *board, uint64_t *buffer, int y,
+                        uint64_t seed, int origin_x, int origin_y) {
+    uint64_t *row = caveRow(board, buffer, y);
+    memset(row, 0, sizeof(uint64_t) * (board->stride - 2));
+    bool border_row = y == 0 || y == board->height - 1;
+    for (int x = 0; x < board->width; x++) {
+        uint64_t wall = 1;
+        if (!border_row && x != 0 && x != board->width - 1) {
+            int roll = mapNoiseRange(mapNoise(seed, origin_x + x, origin_y + y),
+                                     0, 100);
+            wall = roll < CAVE_WALL_PROBABILITY;
+        }
+        row[x / 64] |= wall << (x % 64);
+    }
+}
+
+// Every kernel below evaluates the same bit-sliced adder network: the eight
+// neighbour bitplanes are summed into a 4-bit count (ones, twos, fours,
+// eights) 64 cells at a time, without ever branching on a cell.
+// A wall survives with 4 or more wall neighbours and a floor fills in with 5
+// or more, which works out to: eights | (fours & (ones | twos | current))
+//
+// West and east neighbours come from shifting the row one bit and carrying
+// the edge bit in from the adjacent word, hence the guard words.
+
+static void caveRowScalar(const uint64_t *above, const uint64_t *row,
+                          const uint64_t *below, const uint64_t *interior,
+                          uint64_t *out, int words) {
+    for (int i = 0; i < words; i++) {
+        uint64_t a_west = (above[i] << 1) | (above[i - 1] >> 63);
+        uint64_t a_east = (above[i] >> 1) | (above[i + 1] << 63);
+        uint64_t c_west = (row[i] << 1) | (row[i - 1] >> 63);
+        uint64_t c_east = (row[i] >> 1) | (row[i + 1] << 63);
+        uint64_t b_west = (below[i] << 1) | (below[i - 1] >> 63);
+        uint64_t b_east = (below[i] >> 1) | (below[i + 1] << 63);
+
+        uint64_t a_sum = a_west ^ above[i] ^ a_east;
+        uint64_t a_carry = (a_west & above[i]) | (a_east & (a_west ^ above[i]));
+        uint64_t b_sum = b_west ^ below[i] ^ b_east;
+        uint64_t b_carry = (b_west & below[i]) | (b_east & (b_west ^ below[i]));
+        uint64_t c_sum = c_west ^ c_east;
+        uint64_t c_carry = c_west & c_east;
+
+        uint64_t ones = a_sum ^ b_sum ^ c_sum;
+        uint64_t ones_carry = (a_sum & b_sum) | (c_sum & (a_sum ^ b_sum));
+        uint64_t twos_partial = a_carry ^ b_carry ^ c_carry;
+        uint64_t fours_partial = (a_carry & b_carry)
+                                 | (c_carry & (a_carry ^ b_carry));
+        uint64_t twos = twos_partial ^ ones_carry;
+        uint64_t twos_carry = twos_partial & ones_carry;
+        uint64_t fours = fours_partial ^ twos_carry;
+        uint64_t eights = fours_partial & twos_carry;
+
+        uint64_t result = eights | (fours & (ones | twos | row[i]));
+        out[i] = (result & interior[i]) | (row[i] & ~interior[i]);
+    }
+}
+
+#ifdef CAVE_HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void caveRowSSE2(const uint64_t *above, const uint64_t *row,
+                        const uint64_t *below, const uint64_t *interior,
+                        uint64_t *out, int words) {
+    for (int i = 0; i < words; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(above + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(below + i));
+        __m128i mask = _mm_loadu_si128((const __m128i *)(interior + i));
+
+        __m128i a_west = _mm_or_si128(_mm_slli_epi64(a, 1), _mm_srli_epi64(
+            _mm_loadu_si128((const __m128i *)(above + i - 1)), 63));
+        __m128i a_east = _mm_or_si128(_mm_srli_epi64(a, 1), _mm_slli_epi64(
+            _mm_loadu_si128((const __m128i *)(above + i + 1)), 63));
+        __m128i c_west = _mm_or_si128(_mm_slli_epi64(c, 1), _mm_srli_epi64(
+            _mm_loadu_si128((const __m128i *)(row + i - 1)), 63));
+        __m128i c_east = _mm_or_si128(_mm_srli_epi64(c, 1), _mm_slli_epi64(
+            _mm_loadu_si128((const __m128i *)(row + i + 1)), 63));
+        __m128i b_west = _mm_or_si128(_mm_slli_epi64(b, 1), _mm_srli_epi64(
+            _mm_loadu_si128((const __m128i *)(below + i - 1)), 63));
+        __m128i b_east = _mm_or_si128(_mm_srli_epi64(b, 1), _mm_slli_epi64(
+            _mm_loadu_si128((const __m128i *)(below + i + 1)), 63));
+
+        __m128i a_half = _mm_xor_si128(a_west, a);
+        __m128i a_sum = _mm_xor_si128(a_half, a_east);
+        __m128i a_carry = _mm_or_si128(_mm_and_si128(a_west, a),
+                                       _mm_and_si128(a_east, a_half));
+        __m128i b_half = _mm_xor_si128(b_west, b);
+        __m128i b_sum = _mm_xor_si128(b_half, b_east);
+        __m128i b_carry = _mm_or_si128(_mm_and_si128(b_west, b),
+                                       _mm_and_si128(b_east, b_half));
+        __m128i c_sum = _mm_xor_si128(c_west, c_east);
+        __m128i c_carry = _mm_and_si128(c_west, c_east);
+
+        __m128i ab_sum = _mm_xor_si128(a_sum, b_sum);
+        __m128i ones = _mm_xor_si128(ab_sum, c_sum);
+        __m128i ones_carry = _mm_or_si128(_mm_and_si128(a_sum, b_sum),
+                                          _mm_and_si128(c_sum, ab_sum));
+        __m128i ab_carry = _mm_xor_si128(a_carry, b_carry);
+        __m128i twos_partial = _mm_xor_si128(ab_carry, c_carry);
+        __m128i fours_partial = _mm_or_si128(_mm_and_si128(a_carry, b_carry),
+                                             _mm_and_si128(c_carry, ab_carry));
+        __m128i twos = _mm_xor_si128(twos_partial, ones_carry);
+        __m128i twos_carry = _mm_and_si128(twos_partial, ones_carry);
+        __m128i fours = _mm_xor_si128(fours_partial, twos_carry);
+        __m128i eights = _mm_and_si128(fours_partial, twos_carry);
+
+        __m128i result = _mm_or_si128(eights, _mm_and_si128(fours,
+            _mm_or_si128(_mm_or_si128(ones, twos), c)));
+        result = _mm_or_si128(_mm_and_si128(mask, result),
+                              _mm_andnot_si128(mask, c));
+        _mm_storeu_si128((__m128i *)(out + i), result);
+    }
+}
+
+__attribute__((target("avx2")))
+static void caveRowAVX2(const uint64_t *above, const uint64_t *row,
+                        const uint64_t *below, const uint64_t *interior,
+                        uint64_t *out, int words) {
+    for (int i = 0; i < words; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(above + i));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(row + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(below + i));
+        __m256i mask = _mm256_loadu_si256((const __m256i *)(interior + i));
+
+        __m256i a_west = _mm256_or_si256(_mm256_slli_epi64(a, 1),
+            _mm256_srli_epi64(
+                _mm256_loadu_si256((const __m256i *)(above + i - 1)), 63));
+        __m256i a_east = _mm256_or_si256(_mm256_srli_epi64(a, 1),
+            _mm256_slli_epi64(
+                _mm256_loadu_si256((const __m256i *)(above + i + 1)), 63));
+        __m256i c_west = _mm256_or_si256(_mm256_slli_epi64(c, 1),
+            _mm256_srli_epi64(
+                _mm256_loadu_si256((const __m256i *)(row + i - 1)), 63));
+        __m256i c_east = _mm256_or_si256(_mm256_srli_epi64(c, 1),
+            _mm256_slli_epi64(
+                _mm256_loadu_si256((const __m256i *)(row + i + 1)), 63));
+        __m256i b_west = _mm256_or_si256(_mm256_slli_epi64(b, 1),
+            _mm256_srli_epi64(
+                _mm256_loadu_si256((const __m256i *)(below + i - 1)), 63));
+        __m256i b_east = _mm256_or_si256(_mm256_srli_epi64(b, 1),
+            _mm256_slli_epi64(
+                _mm256_loadu_si256((const __m256i *)(below + i + 1)), 63));
+
+        __m256i a_half = _mm256_xor_si256(a_west, a);
+        __m256i a_sum = _mm256_xor_si256(a_half, a_east);
+        __m256i a_carry = _mm256_or_si256(_mm256_and_si256(a_west, a),
+                                          _mm256_and_si256(a_east, a_half));
+        __m256i b_half = _mm256_xor_si256(b_west, b);
+        __m256i b_sum = _mm256_xor_si256(b_half, b_east);
+        __m256i b_carry = _mm256_or_si256(_mm256_and_si256(b_west, b),
+                                          _mm256_and_si256(b_east, b_half));
+        __m256i c_sum = _mm256_xor_si256(c_west, c_east);
+        __m256i c_carry = _mm256_and_si256(c_west, c_east);
+
+        __m256i ab_sum = _mm256_xor_si256(a_sum, b_sum);
+        __m256i ones = _mm256_xor_si256(ab_sum, c_sum);
+        __m256i ones_carry = _mm256_or_si256(_mm256_and_si256(a_sum, b_sum),
+                                             _mm256_and_si256(c_sum, ab_sum));
+        __m256i ab_carry = _mm256_xor_si256(a_carry, b_carry);
+        __m256i twos_partial = _mm256_xor_si256(ab_carry, c_carry);
+        __m256i fours_partial =
+            _mm256_or_si256(_mm256_and_si256(a_carry, b_carry),
+                            _mm256_and_si256(c_carry, ab_carry));
+        __m256i twos = _mm256_xor_si256(twos_partial, ones_carry);
+        __m256i twos_carry = _mm256_and_si256(twos_partial, ones_carry);
+        __m256i fours = _mm256_xor_si256(fours_partial, twos_carry);
+        __m256i eights = _mm256_and_si256(fours_partial, twos_carry);
+
+        __m256i result = _mm256_or_si256(eights, _mm256_and_si256(fours,
+            _mm256_or_si256(_mm256_or_si256(ones, twos), c)));
+        result = _mm256_or_si256(_mm256_and_si256(mask, result),
+                                 _mm256_andnot_si256(mask, c));
+        _mm256_storeu_si256((__m256i *)(out + i), result);
+    }
+}
+
+#endif /* CAVE_HAVE_X86_KERNELS */
+
+// picks the widest kernel this CPU can run
+int caveDetectKernel(void) {
+#ifdef CAVE_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return CAVE_KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return CAVE_KERNEL_SSE2;
+    }
+#endif
+    return CAVE_KERNEL_SCALAR;
+}
+
+const char* caveKernelName(int kernel) {
+    switch (kernel) {
+        case CAVE_KERNEL_AUTO:
+        return "auto";
+
+        case CAVE_KERNEL_SSE2:
+        return "sse2";
+
+        case CAVE_KERNEL_AVX2:
+        return "avx2";
+
+        default:
+        return "scalar";
+    }
+}
+
+static CaveRowKernel caveRowKernel(int kernel) {
+    if (kernel == CAVE_KERNEL_AUTO) {
+        kernel = caveDetectKernel();
+    }
+#ifdef CAVE_HAVE_X86_KERNELS
+    if (kernel == CAVE_KERNEL_AVX2) {
+        return caveRowAVX2;
+    }
+    if (kernel == CAVE_KERNEL_SSE2) {
+        return caveRowSSE2;
+    }
+#endif
+    return caveRowScalar;
+}
+
+// computes rows [first, last) of the generation after src into dst. the top
+// and bottom rows are border and are carried over untouched
+static void caveStepRows(CaveBoard *board, uint64_t *src, uint64_t *dst,
+                         int first, int last, CaveRowKernel row_kernel) {
+    int words = board->stride - 2;
+    uint64_t *interior = board->interior + 1;
+
+    for (int y = first; y < last; y++) {
+        uint64_t *row = caveRow(board, src, y);
+        uint64_t *out = caveRow(board, dst, y);
+        if (y == 0 || y == board->height - 1) {
+            memcpy(out, row, sizeof(uint64_t) * words);
+            continue;
+        }
+        row_kernel(caveRow(board, src, y - 1), row,
+                   caveRow(board, src, y + 1), interior, out, words);
+    }
+}
+
+// the straightforward one-cell-at-a-time version of the automaton, run over
+// an already randomized map. it is far slower, but it is the definition the
+// bitboard kernels must match, see caveCheck
+void caveRunAutomatonReference(GameMap *game_map, int iterations) {
+    size_t cells = (size_t)game_map->width * game_map->height;
+    MapCell *current = (MapCell *)malloc(cells);
+    MapCell *next = (MapCell *)malloc(cells);
+    if (current == NULL || next == NULL) {
+        free(current);
+        free(next);
+        return;
+    }
+
+    for (size_t i = 0; i < cells; i++) {
+        current[i] = game_map->tiles[i] & MAP_TILE_MASK;
+    }
+    memcpy(next, current, cells);
+
+    int width = game_map->width;
+    for (int step = 0; step < iterations; step++) {
+        for (int y = 1; y < game_map->height - 1; y++) {
+            for (int x = 1; x < width - 1; x++) {
+                int wall_count = 0;
+                for (int k = -1; k <= 1; k++) {
+                    for (int l = -1; l <= 1; l++) {
+                        if ((k != 0 || l != 0)
+                            && current[(y + k) * width + x + l] == MAP_WALL) {
+                            wall_count++;
+                        }
+                    }
+                }
+
+                int tile = current[y * width + x];
+                if (tile == MAP_WALL && wall_count < 4) {
+                    tile = MAP_FLOOR;
+                }
+                else if (tile == MAP_FLOOR && wall_count > 4) {
+                    tile = MAP_WALL;
+                }
+                next[y * width + x] = tile;
+            }
+        }
+
+        MapCell *swap = current;
+        current = next;
+        next = swap;
+    }
+
+    for (size_t i = 0; i < cells; i++) {
+        game_map->tiles[i] = (game_map->tiles[i] & MAP_FLAG_MASK) | current[i];
+    }
+
+    free(current);
+    free(next);
+}
+
+// shared by every thread working on one caveGenerate call
+typedef struct CaveJob {
+    CaveBoard *board;
+    GameMap *game_map;
+    uint64_t seed;
+    int origin_x;
+    int origin_y;
+    int iterations;
+    CaveRowKernel row_kernel;
+    pthread_barrier_t barrier;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    bool ready;
+} CaveJob;
+
+typedef struct CaveBand {
+    CaveJob *job;
+    int first;
+    int last;
+} CaveBand;
+
+// each thread owns a band of rows for the whole generation. a band only
+// writes its own rows but reads one halo row above and below it from the
+// shared source buffer, so every step ends on a barrier before the buffers
+// are swapped and the next step may read the neighbours' results
+static void* caveBandWorker(void *data) {
+    CaveBand *band = (CaveBand *)data;
+    CaveJob *job = band->job;
+
+    // bands are only final once every thread has been started
+    pthread_mutex_lock(&job->lock);
+    while (!job->ready) {
+        pthread_cond_wait(&job->start, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    CaveBoard *board = job->board;
+    uint64_t *current = board->cells;
+    uint64_t *next = board->next;
+
+    for (int y = band->first; y < band->last; y++) {
+        caveFillRow(board, current, y, job->seed, job->origin_x,
+                    job->origin_y);
+    }
+    pthread_barrier_wait(&job->barrier);
+
+    for (int step = 0; step < job->iterations; step++) {
+        caveStepRows(board, current, next, band->first, band->last,
+                     job->row_kernel);
+        pthread_barrier_wait(&job->barrier);
+
+        uint64_t *swap = current;
+        current = next;
+        next = swap;
+    }
+
+    caveUnpackRows(board, current, job->game_map, band->first, band->last);
+    return NULL;
+}
+
+static void caveGenerateSteps(GameMap *, uint64_t, int, int, int, int, int);
+
+// generates a complete cave into game_map from seed, splitting the rows across
+// a fixed pool of threads. the noise is keyed by tile rather than drawn from a
+// sequence and each step is double-buffered, so the result is the same for
+// any thread count and kernel (caveCheck makes sure of it)
+void caveGenerate(GameMap *game_map, uint64_t seed, int threads) {
+    caveGenerateRegion(game_map, seed, 0, 0, threads, CAVE_KERNEL_AUTO);
+}
+
+// same as caveGenerate, but game_map holds the part of the world starting at
+// origin_x, origin_y, and the automaton runs on the given kernel. the ring of
+// wall still goes around game_map's edge and its influence creeps one tile
+// further in with every iteration, so only tiles at least
+// CAVE_GENERATOR_ITERATIONS + 1 in from the edge match what a bigger map
+// would have there. see the apron in chunk.c
+void caveGenerateRegion(GameMap *game_map, uint64_t seed, int origin_x,
+                        int origin_y, int threads, int kernel) {
+    caveGenerateSteps(game_map, seed, origin_x, origin_y, threads, kernel,
+                      CAVE_GENERATOR_ITERATIONS);
+}
+
+// caveGenerateRegion for any number of iterations. none leaves the noise
+static void caveGenerateSteps(GameMap *game_map, uint64_t seed, int origin_x,
+                              int origin_y, int threads, int kernel,
+                              int iterations) {
+    if (game_map->width < 3 || game_map->height < 3) {
+        return;
+    }
+
+    CaveBoard *board = initCaveBoard(game_map->width, game_map->height);
+    if (board == NULL) {
+        printf("Could not allocate cave board for %dx%d map!\n",
+               game_map->width, game_map->height);
+        return;
+    }
+
+    // no point in bands thinner than a handful of rows
+    int bands = threads < 1 ? 1 : threads;
+    if (bands > board->height / 4) {
+        bands = board->height / 4 > 0 ? board->height / 4 : 1;
+    }
+
+    CaveJob job = { .board = board, .game_map = game_map, .seed = seed,
+                    .origin_x = origin_x, .origin_y = origin_y,
+                    .iterations = iterations,
+                    .row_kernel = caveRowKernel(kernel),
+                    .ready = false };
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.start, NULL);
+
+    CaveBand band_list[bands];
+    pthread_t thread_list[bands];
+    for (int i = 0; i < bands; i++) {
+        band_list[i].job = &job;
+    }
+
+    // the calling thread works the first band itself. if we can't get all the
+    // threads we asked for, the ones we did get split the map between them
+    int started = 1;
+    for (int i = 1; i < bands; i++) {
+        if (pthread_create(&thread_list[i], NULL, caveBandWorker,
+                           &band_list[i]) != 0) {
+            printf("Could only start %d of %d generator threads\n", i, bands);
+            break;
+        }
+        started++;
+    }
+
+    pthread_mutex_lock(&job.lock);
+    for (int i = 0; i < started; i++) {
+        band_list[i].first = (int)((int64_t)board->height * i / started);
+        band_list[i].last = (int)((int64_t)board->height * (i + 1) / started);
+    }
+    pthread_barrier_init(&job.barrier, NULL, started);
+    job.ready = true;
+    pthread_cond_broadcast(&job.start);
+    pthread_mutex_unlock(&job.lock);
+
+    caveBandWorker(&band_list[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(thread_list[i], NULL);
+    }
+
+    pthread_barrier_destroy(&job.barrier);
+    pthread_cond_destroy(&job.start);
+    pthread_mutex_destroy(&job.lock);
+    destroyCaveBoard(board);
+}
+
+// generates caves of a few awkward sizes (a word and a bit, less than a word,
+// odd heights) from a few seeds with every kernel this CPU has and a range of
+// thread counts, and compares each with the noise run through
+// caveRunAutomatonReference. returns how many differed
+int caveCheck(void) {
+    static const int sizes[][2] = { {3, 3}, {63, 17}, {64, 64}, {65, 33},
+                                    {127, 9}, {130, 100}, {257, 129} };
+    static const uint64_t seeds[] = { 1, 2, 0x9e3779b97f4a7c15ull };
+    static const int thread_counts[] = { 1, 2, 3, 5, 8, 32 };
+    int size_count = sizeof(sizes) / sizeof(sizes[0]);
+    int seed_count = sizeof(seeds) / sizeof(seeds[0]);
+    int thread_count = sizeof(thread_counts) / sizeof(thread_counts[0]);
+    int widest = caveDetectKernel();
+    int checked = 0;
+    int failed = 0;
+
+    for (int s = 0; s < size_count; s++) {
+        for (int i = 0; i < seed_count; i++) {
+            int width = sizes[s][0];
+            int height = sizes[s][1];
+            // away from the origin, so chunk style windows get checked too
+            int origin_x = i * 97;
+            int origin_y = -i * 31;
+            GameMap *expected = initMap(width, height);
+            GameMap *actual = initMap(width, height);
+            if (expected == NULL || actual == NULL) {
+                printf("Could not allocate %dx%d maps to check!\n", width,
+                       height);
+                destroyMap(expected);
+                destroyMap(actual);
+                return failed + 1;
+            }
+            caveGenerateSteps(expected, seeds[i], origin_x, origin_y, 1,
+                              CAVE_KERNEL_SCALAR, 0);
+            caveRunAutomatonReference(expected, CAVE_GENERATOR_ITERATIONS);
+
+            size_t bytes = (size_t)width * height * sizeof(MapCell);
+            for (int kernel = CAVE_KERNEL_SCALAR; kernel <= widest; kernel++) {
+                for (int t = 0; t < thread_count; t++) {
+                    memset(actual->tiles, 0, bytes);
+                    caveGenerateRegion(actual, seeds[i], origin_x, origin_y,
+                                       thread_counts[t], kernel);
+                    checked++;
+                    if (memcmp(actual->tiles, expected->tiles, bytes) != 0) {
+                        printf("%dx%d cave from seed %llu differs from the "
+                               "reference with the %s kernel on %d threads\n",
+                               width, height, (unsigned long long)seeds[i],
+                               caveKernelName(kernel), thread_counts[t]);
+                        failed++;
+                    }
+                }
+            }
+            destroyMap(expected);
+            destroyMap(actual);
+        }
+    }
+
+    printf("%d of %d caves matched the reference (kernels up to %s)\n",
+           checked - failed, checked, caveKernelName(widest));
+    return failed;
+}
@@ -0,0 +1,43 @@
+#ifndef __CAVE_H__
+#define __CAVE_H__
+
+#include <stdint.h>
+#include "map.h"
+
+// the cellular automaton behind generateCaveTerrain. walls are packed one bit
+// per cell into 64-bit words and every step reads one board and writes the
+// other, so a cell never sees its neighbours' new values mid-step
+typedef struct CaveBoard {
+    int width;
+    int height;
+    int stride;         // words per row, including one guard word on each side
+    uint64_t *cells;    // the current generation
+    uint64_t *next;     // scratch for the generation being computed
+    uint64_t *interior; // which bits of a row the automaton may change
+} CaveBoard;
+
+enum caveKernel {
+    CAVE_KERNEL_AUTO,
+    CAVE_KERNEL_SCALAR,
+    CAVE_KERNEL_SSE2,
+    CAVE_KERNEL_AVX2
+};
+
+CaveBoard* initCaveBoard(int, int);
+void destroyCaveBoard(CaveBoard *);
+int caveDetectKernel(void);
+const char* caveKernelName(int);
+void caveRunAutomatonReference(GameMap *, int);
+void caveGenerate(GameMap *, uint64_t, int);
+void caveGenerateRegion(GameMap *, uint64_t, int, int, int, int);
+int caveCheck(void);
+
+// returns a pointer to the first word of row y in the given buffer. word -1
+// and word (stride - 2) are always zero so kernels can shift across words
+// without special-casing the row ends
+static inline uint64_t* caveRow(const CaveBoard *board, uint64_t *buffer,
+                                int y) {
+    return buffer + (size_t)y * board->stride + 1;
+}
+
+#endif /* __CAVE_H__ */
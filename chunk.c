@@ -0,0 +1,511 @@
+#include "chunk.h"
+#include "cave.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// chunks are generated with this many extra tiles on every side and then
+// cropped. the automaton's wall border creeps one tile inwards per iteration,
+// so with a wide enough apron the crop is exactly what that part of one
+// endless cave would look like and neighbouring chunks join up seamlessly
+#define CHUNK_APRON (CAVE_GENERATOR_ITERATIONS + 1)
+
+static const char CHUNK_MAGIC[4] = { 'Y', 'Z', 'C', 'K' };
+
+static void* chunkWorker(void *);
+
+static GameMap* initChunkScratch() {
+    int size = CHUNK_SIZE + 2 * CHUNK_APRON;
+    return initMap(size, size);
+}
+
+// wraps a new chunk store in a GameMap. the map has no tiles of its own; see
+// mapTileAt
+GameMap* initChunkedMap(const MapGenOptions *options) {
+    ChunkedMap *chunks = (ChunkedMap *)calloc(1, sizeof(ChunkedMap));
+    GameMap *game_map = initMap(0, 0);
+    if (chunks == NULL || game_map == NULL) {
+        printf("Could not allocate chunked map!\n");
+        free(chunks);
+        free(game_map);
+        return NULL;
+    }
+
+    chunks->seed = options->seed;
+    snprintf(chunks->directory, sizeof(chunks->directory), "%s",
+             options->chunk_directory != NULL ? options->chunk_directory
+                                              : "world");
+#ifdef _WIN32
+    _mkdir(chunks->directory);
+#else
+    mkdir(chunks->directory, 0755);
+#endif
+
+    chunks->max_chunks = (int)(options->memory_budget / sizeof(Chunk));
+    if (chunks->max_chunks < 64) {
+        chunks->max_chunks = 64;
+    }
+    chunks->max_pending = chunks->max_chunks / 4 < CHUNK_REQUEST_QUEUE
+                          ? chunks->max_chunks / 4 : CHUNK_REQUEST_QUEUE;
+
+    // roughly two buckets per chunk we may hold
+    chunks->bucket_count = 1;
+    while (chunks->bucket_count < chunks->max_chunks * 2) {
+        chunks->bucket_count <<= 1;
+    }
+    chunks->buckets = (Chunk **)calloc(chunks->bucket_count, sizeof(Chunk *));
+    chunks->scratch = initChunkScratch();
+    if (chunks->buckets == NULL || chunks->scratch == NULL) {
+        printf("Could not allocate chunked map!\n");
+        free(chunks->buckets);
+        free(chunks->scratch);
+        free(chunks);
+        free(game_map);
+        return NULL;
+    }
+
+    pthread_mutex_init(&chunks->lock, NULL);
+    pthread_cond_init(&chunks->wake, NULL);
+    chunks->worker_running =
+        pthread_create(&chunks->worker, NULL, chunkWorker, chunks) == 0;
+    if (!chunks->worker_running) {
+        printf("Could not start chunk prefetch thread, chunks will only be "
+               "generated on demand\n");
+    }
+
+    game_map->width = WORLD_SIZE_IN_CHUNKS * CHUNK_SIZE;
+    game_map->height = WORLD_SIZE_IN_CHUNKS * CHUNK_SIZE;
+    game_map->chunks = chunks;
+    return game_map;
+}
+
+// generates chunk (chunk_x, chunk_y) of the world for seed into tiles, using
+// scratch (from initChunkScratch) as working space
+void generateChunk(uint64_t seed, int chunk_x, int chunk_y, GameMap *scratch,
+                   MapCell *tiles) {
+    caveGenerateRegion(scratch, seed, chunk_x * CHUNK_SIZE - CHUNK_APRON,
+                       chunk_y * CHUNK_SIZE - CHUNK_APRON, 1,
+                       CAVE_KERNEL_AUTO);
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        memcpy(&tiles[y * CHUNK_SIZE],
+               mapRow(scratch, y + CHUNK_APRON) + CHUNK_APRON, CHUNK_SIZE);
+    }
+}
+
+static void chunkPath(ChunkedMap *chunks, int chunk_x, int chunk_y,
+                      char *path, size_t length) {
+    snprintf(path, length, "%s/%016llx_%d_%d.chunk", chunks->directory,
+             (unsigned long long)chunks->seed, chunk_x, chunk_y);
+}
+
+// only modified chunks are ever written. an untouched chunk is cheaper to
+// generate again than to read back. the chunk goes to a temporary file that
+// is then renamed over the old one, so a failed save never leaves half a
+// chunk behind. returns whether it was saved; if not, it stays modified
+static bool saveChunk(ChunkedMap *chunks, Chunk *chunk) {
+    char path[320];
+    char temporary[330];
+    chunkPath(chunks, chunk->x, chunk->y, path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        printf("Could not save chunk %s! %s\n", path, strerror(errno));
+        return false;
+    }
+
+    int32_t header[2] = { chunk->x, chunk->y };
+    bool saved = fwrite(CHUNK_MAGIC, sizeof(CHUNK_MAGIC), 1, file) == 1
+                 && fwrite(header, sizeof(header), 1, file) == 1
+                 && fwrite(chunk->tiles, sizeof(chunk->tiles), 1, file) == 1;
+    // a full disk may only show up when the last of it is flushed
+    if (fclose(file) != 0) {
+        saved = false;
+    }
+    if (saved) {
+#ifdef _WIN32
+        remove(path);  // rename won't replace a file there
+#endif
+        saved = rename(temporary, path) == 0;
+    }
+    if (!saved) {
+        printf("Could not save chunk %s! %s\n", path, strerror(errno));
+        remove(temporary);
+        return false;
+    }
+
+    chunk->modified = false;
+    return true;
+}
+
+// reads back a chunk saved by saveChunk. returns false if there is none
+static bool loadChunk(ChunkedMap *chunks, Chunk *chunk) {
+    char path[320];
+    chunkPath(chunks, chunk->x, chunk->y, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    char magic[sizeof(CHUNK_MAGIC)];
+    int32_t header[2];
+    bool loaded = fread(magic, sizeof(magic), 1, file) == 1
+                  && memcmp(magic, CHUNK_MAGIC, sizeof(magic)) == 0
+                  && fread(header, sizeof(header), 1, file) == 1
+                  && header[0] == chunk->x && header[1] == chunk->y
+                  && fread(chunk->tiles, sizeof(chunk->tiles), 1, file) == 1;
+    fclose(file);
+
+    if (!loaded) {
+        printf("Ignoring damaged chunk file %s\n", path);
+    }
+    return loaded;
+}
+
+static int chunkBucket(ChunkedMap *chunks, int chunk_x, int chunk_y) {
+    return (int)(rngMix64(((uint64_t)(uint32_t)chunk_y << 32)
+                          | (uint32_t)chunk_x)
+                 & (uint64_t)(chunks->bucket_count - 1));
+}
+
+static Chunk* findChunk(ChunkedMap *chunks, int chunk_x, int chunk_y) {
+    Chunk *chunk = chunks->buckets[chunkBucket(chunks, chunk_x, chunk_y)];
+    while (chunk != NULL && (chunk->x != chunk_x || chunk->y != chunk_y)) {
+        chunk = chunk->next_in_bucket;
+    }
+    return chunk;
+}
+
+static void unlinkLRU(ChunkedMap *chunks, Chunk *chunk) {
+    if (chunk->newer != NULL) {
+        chunk->newer->older = chunk->older;
+    }
+    else {
+        chunks->newest = chunk->older;
+    }
+    if (chunk->older != NULL) {
+        chunk->older->newer = chunk->newer;
+    }
+    else {
+        chunks->oldest = chunk->newer;
+    }
+    chunk->newer = NULL;
+    chunk->older = NULL;
+}
+
+static void pushLRU(ChunkedMap *chunks, Chunk *chunk) {
+    chunk->older = chunks->newest;
+    chunk->newer = NULL;
+    if (chunks->newest != NULL) {
+        chunks->newest->newer = chunk;
+    }
+    chunks->newest = chunk;
+    if (chunks->oldest == NULL) {
+        chunks->oldest = chunk;
+    }
+}
+
+static void removeChunk(ChunkedMap *chunks, Chunk *chunk) {
+    Chunk **link = &chunks->buckets[chunkBucket(chunks, chunk->x, chunk->y)];
+    while (*link != chunk) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = chunk->next_in_bucket;
+
+    if (chunk->state == CHUNK_READY) {
+        unlinkLRU(chunks, chunk);
+    }
+    else {
+        chunks->pending_chunks--;
+    }
+    if (chunks->last_used == chunk) {
+        chunks->last_used = NULL;
+    }
+    chunks->loaded_chunks--;
+    free(chunk);
+}
+
+// drops least recently used chunks until no more than limit are loaded,
+// saving the ones that were changed. keep is never evicted, and neither is a
+// changed chunk that couldn't be saved: losing the changes is worse than
+// going over budget
+static void evictChunks(ChunkedMap *chunks, Chunk *keep, int limit) {
+    Chunk *chunk = chunks->oldest;
+    while (chunks->loaded_chunks > limit && chunk != NULL) {
+        Chunk *newer = chunk->newer;
+        if (chunk != keep
+            && (!chunk->modified || saveChunk(chunks, chunk))) {
+            removeChunk(chunks, chunk);
+        }
+        chunk = newer;
+    }
+}
+
+static void markReady(ChunkedMap *chunks, Chunk *chunk) {
+    if (chunk->state == CHUNK_PENDING) {
+        chunks->pending_chunks--;
+    }
+    chunk->state = CHUNK_READY;
+    pushLRU(chunks, chunk);
+}
+
+static Chunk* addChunk(ChunkedMap *chunks, int chunk_x, int chunk_y,
+                       int state) {
+    Chunk *chunk = (Chunk *)malloc(sizeof(Chunk));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->x = chunk_x;
+    chunk->y = chunk_y;
+    chunk->state = state;
+    chunk->modified = false;
+    chunk->newer = NULL;
+    chunk->older = NULL;
+    if (state == CHUNK_PENDING) {
+        chunks->pending_chunks++;
+    }
+
+    int bucket = chunkBucket(chunks, chunk_x, chunk_y);
+    chunk->next_in_bucket = chunks->buckets[bucket];
+    chunks->buckets[bucket] = chunk;
+    chunks->loaded_chunks++;
+    return chunk;
+}
+
+// moves everything the prefetch thread finished into the chunk table
+static void collectResults(ChunkedMap *chunks) {
+    pthread_mutex_lock(&chunks->lock);
+    ChunkResult *result = chunks->results;
+    chunks->results = NULL;
+    pthread_mutex_unlock(&chunks->lock);
+
+    while (result != NULL) {
+        ChunkResult *next = result->next;
+        Chunk *chunk = findChunk(chunks, result->x, result->y);
+        // the main thread may have needed it first and made its own
+        if (chunk != NULL && chunk->state == CHUNK_PENDING) {
+            memcpy(chunk->tiles, result->tiles, sizeof(chunk->tiles));
+            markReady(chunks, chunk);
+        }
+        free(result);
+        result = next;
+    }
+}
+
+// returns the chunk holding chunk_x, chunk_y, loading or generating it on the
+// spot if it isn't cached yet
+static Chunk* getChunk(ChunkedMap *chunks, int chunk_x, int chunk_y) {
+    Chunk *chunk = chunks->last_used;
+    if (chunk != NULL && chunk->x == chunk_x && chunk->y == chunk_y) {
+        return chunk;
+    }
+
+    chunk = findChunk(chunks, chunk_x, chunk_y);
+    if (chunk != NULL && chunk->state == CHUNK_PENDING) {
+        collectResults(chunks);
+    }
+
+    if (chunk == NULL) {
+        chunk = addChunk(chunks, chunk_x, chunk_y, CHUNK_PENDING);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        if (loadChunk(chunks, chunk)) {
+            markReady(chunks, chunk);
+        }
+    }
+
+    if (chunk->state == CHUNK_PENDING) {
+        // saved chunks were already looked for when the chunk was queued
+        generateChunk(chunks->seed, chunk_x, chunk_y, chunks->scratch,
+                      chunk->tiles);
+        markReady(chunks, chunk);
+    }
+    else {
+        unlinkLRU(chunks, chunk);
+        pushLRU(chunks, chunk);
+    }
+
+    evictChunks(chunks, chunk, chunks->max_chunks);
+    chunks->last_used = chunk;
+    return chunk;
+}
+
+// x and y are in tiles. everything outside the world is solid wall
+int chunkedMapGet(ChunkedMap *chunks, int x, int y) {
+    int world_size = WORLD_SIZE_IN_CHUNKS * CHUNK_SIZE;
+    if (x < 0 || y < 0 || x >= world_size || y >= world_size) {
+        return MAP_WALL;
+    }
+
+    Chunk *chunk = getChunk(chunks, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    if (chunk == NULL) {
+        return MAP_WALL;
+    }
+    return chunk->tiles[(y & CHUNK_MASK) * CHUNK_SIZE + (x & CHUNK_MASK)]
+           & MAP_TILE_MASK;
+}
+
+void chunkedMapSet(ChunkedMap *chunks, int x, int y, int tile) {
+    int world_size = WORLD_SIZE_IN_CHUNKS * CHUNK_SIZE;
+    if (x < 0 || y < 0 || x >= world_size || y >= world_size) {
+        return;
+    }
+
+    Chunk *chunk = getChunk(chunks, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    if (chunk == NULL) {
+        return;
+    }
+    MapCell *cell =
+        &chunk->tiles[(y & CHUNK_MASK) * CHUNK_SIZE + (x & CHUNK_MASK)];
+    *cell = (*cell & MAP_FLAG_MASK) | (tile & MAP_TILE_MASK);
+    chunk->modified = true;
+}
+
+// asks the prefetch thread for every chunk overlapping the given block of
+// tiles (first inclusive, last exclusive) plus a ring of one chunk around it,
+// so chunks are usually ready before the camera gets to them. also picks up
+// whatever the thread has finished since the last call
+void chunkedMapPrefetch(ChunkedMap *chunks, int first_x, int first_y,
+                        int last_x, int last_y) {
+    collectResults(chunks);
+    if (!chunks->worker_running) {
+        return;
+    }
+
+    int first_chunk_x = (first_x >> CHUNK_SHIFT) - 1;
+    int first_chunk_y = (first_y >> CHUNK_SHIFT) - 1;
+    int last_chunk_x = ((last_x - 1) >> CHUNK_SHIFT) + 1;
+    int last_chunk_y = ((last_y - 1) >> CHUNK_SHIFT) + 1;
+    first_chunk_x = first_chunk_x < 0 ? 0 : first_chunk_x;
+    first_chunk_y = first_chunk_y < 0 ? 0 : first_chunk_y;
+    last_chunk_x = last_chunk_x >= WORLD_SIZE_IN_CHUNKS
+                   ? WORLD_SIZE_IN_CHUNKS - 1 : last_chunk_x;
+    last_chunk_y = last_chunk_y >= WORLD_SIZE_IN_CHUNKS
+                   ? WORLD_SIZE_IN_CHUNKS - 1 : last_chunk_y;
+
+    for (int chunk_y = first_chunk_y; chunk_y <= last_chunk_y; chunk_y++) {
+        for (int chunk_x = first_chunk_x; chunk_x <= last_chunk_x; chunk_x++) {
+            if (findChunk(chunks, chunk_x, chunk_y) != NULL) {
+                continue;
+            }
+            // pending chunks can't be evicted, so only so many at once
+            if (chunks->pending_chunks >= chunks->max_pending) {
+                return;
+            }
+            // room is made by dropping whatever was used longest ago, which
+            // is what the next chunk needed on the spot would drop anyway
+            if (chunks->loaded_chunks >= chunks->max_chunks) {
+                evictChunks(chunks, NULL, chunks->max_chunks - 1);
+                if (chunks->loaded_chunks >= chunks->max_chunks) {
+                    return;
+                }
+            }
+
+            // a chunk saved to disk is read right away, it is cheap enough
+            Chunk *chunk = addChunk(chunks, chunk_x, chunk_y, CHUNK_PENDING);
+            if (chunk == NULL) {
+                return;
+            }
+            if (loadChunk(chunks, chunk)) {
+                markReady(chunks, chunk);
+                continue;
+            }
+
+            // with the queue full the chunk just stays pending, and gets
+            // generated on the spot if it is needed before we ask again
+            pthread_mutex_lock(&chunks->lock);
+            if (chunks->request_count < CHUNK_REQUEST_QUEUE) {
+                int slot = (chunks->request_head + chunks->request_count)
+                           % CHUNK_REQUEST_QUEUE;
+                chunks->requests[slot][0] = chunk_x;
+                chunks->requests[slot][1] = chunk_y;
+                chunks->request_count++;
+                pthread_cond_signal(&chunks->wake);
+            }
+            pthread_mutex_unlock(&chunks->lock);
+        }
+    }
+}
+
+static void* chunkWorker(void *data) {
+    ChunkedMap *chunks = (ChunkedMap *)data;
+    GameMap *scratch = initChunkScratch();
+    if (scratch == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&chunks->lock);
+    while (!chunks->quitting) {
+        if (chunks->request_count == 0) {
+            pthread_cond_wait(&chunks->wake, &chunks->lock);
+            continue;
+        }
+
+        int chunk_x = chunks->requests[chunks->request_head][0];
+        int chunk_y = chunks->requests[chunks->request_head][1];
+        chunks->request_head = (chunks->request_head + 1) % CHUNK_REQUEST_QUEUE;
+        chunks->request_count--;
+        pthread_mutex_unlock(&chunks->lock);
+
+        ChunkResult *result = (ChunkResult *)malloc(sizeof(ChunkResult));
+        if (result != NULL) {
+            result->x = chunk_x;
+            result->y = chunk_y;
+            generateChunk(chunks->seed, chunk_x, chunk_y, scratch,
+                          result->tiles);
+        }
+
+        pthread_mutex_lock(&chunks->lock);
+        if (result != NULL) {
+            result->next = chunks->results;
+            chunks->results = result;
+        }
+    }
+    pthread_mutex_unlock(&chunks->lock);
+
+    destroyMap(scratch);
+    return NULL;
+}
+
+// stops the prefetch thread, saves every modified chunk and frees the lot
+void destroyChunkedMap(ChunkedMap *chunks) {
+    if (chunks->worker_running) {
+        pthread_mutex_lock(&chunks->lock);
+        chunks->quitting = true;
+        pthread_cond_signal(&chunks->wake);
+        pthread_mutex_unlock(&chunks->lock);
+        pthread_join(chunks->worker, NULL);
+    }
+
+    ChunkResult *result = chunks->results;
+    while (result != NULL) {
+        ChunkResult *next = result->next;
+        free(result);
+        result = next;
+    }
+
+    for (int i = 0; i < chunks->bucket_count; i++) {
+        Chunk *chunk = chunks->buckets[i];
+        while (chunk != NULL) {
+            Chunk *next = chunk->next_in_bucket;
+            if (chunk->modified) {
+                saveChunk(chunks, chunk);
+            }
+            free(chunk);
+            chunk = next;
+        }
+    }
+
+    pthread_cond_destroy(&chunks->wake);
+    pthread_mutex_destroy(&chunks->lock);
+    free(chunks->buckets);
+    destroyMap(chunks->scratch);
+    free(chunks);
+}
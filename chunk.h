@@ -0,0 +1,82 @@
+#ifndef __CHUNK_H__
+#define __CHUNK_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// a chunked world is cut into CHUNK_SIZE x CHUNK_SIZE tile chunks. a chunk is
+// generated from (seed, chunk x, chunk y) the first time any of its tiles is
+// touched, stays cached until the memory budget runs out, and is written to
+// disk on eviction if it was modified since it was generated
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+
+// worlds are big, not infinite: this many chunks along each side
+#define WORLD_SIZE_IN_CHUNKS 16384
+
+#define CHUNK_REQUEST_QUEUE 256
+
+enum chunkState {
+    CHUNK_PENDING,  // queued for the prefetch thread, tiles not ready yet
+    CHUNK_READY
+};
+
+typedef struct Chunk {
+    int x;  // in chunks
+    int y;
+    int state;
+    bool modified;
+    struct Chunk *next_in_bucket;
+    struct Chunk *newer;  // LRU order, only for ready chunks
+    struct Chunk *older;
+    MapCell tiles[CHUNK_SIZE * CHUNK_SIZE];
+} Chunk;
+
+// a chunk finished by the prefetch thread, waiting for the main thread to
+// pick it up
+typedef struct ChunkResult {
+    int x;
+    int y;
+    struct ChunkResult *next;
+    MapCell tiles[CHUNK_SIZE * CHUNK_SIZE];
+} ChunkResult;
+
+typedef struct ChunkedMap {
+    uint64_t seed;
+    char directory[256];
+    int max_chunks;
+    int loaded_chunks;   // ready and pending
+    int pending_chunks;  // waiting on the prefetch thread, not in the LRU
+    int max_pending;
+    int bucket_count;  // always a power of 2
+    Chunk **buckets;
+    Chunk *newest;
+    Chunk *oldest;
+    Chunk *last_used;  // tile lookups mostly hit the same chunk in a row
+    GameMap *scratch;  // generation area for the main thread
+
+    // the chunk table is only ever touched by the main thread. the prefetch
+    // thread just takes coordinates off requests and hands back results,
+    // both under lock
+    pthread_t worker;
+    bool worker_running;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool quitting;
+    int requests[CHUNK_REQUEST_QUEUE][2];
+    int request_head;
+    int request_count;
+    ChunkResult *results;
+} ChunkedMap;
+
+GameMap* initChunkedMap(const MapGenOptions *);
+void destroyChunkedMap(ChunkedMap *);
+int chunkedMapGet(ChunkedMap *, int, int);
+void chunkedMapSet(ChunkedMap *, int, int, int);
+void chunkedMapPrefetch(ChunkedMap *, int, int, int, int);
+void generateChunk(uint64_t, int, int, GameMap *, MapCell *);
+
+#endif /* __CHUNK_H__ */
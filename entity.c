@@ -0,0 +1,157 @@
+#include "entity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// grows every component array to hold capacity entities
+static bool growComponents(EntityStore *store, int capacity) {
+    int *x = (int *)realloc(store->x, sizeof(int) * capacity);
+    if (x != NULL) {
+        store->x = x;
+    }
+    int *y = (int *)realloc(store->y, sizeof(int) * capacity);
+    if (y != NULL) {
+        store->y = y;
+    }
+    int *sprite_ID = (int *)realloc(store->sprite_ID, sizeof(int) * capacity);
+    if (sprite_ID != NULL) {
+        store->sprite_ID = sprite_ID;
+    }
+    uint32_t *flags =
+        (uint32_t *)realloc(store->flags, sizeof(uint32_t) * capacity);
+    if (flags != NULL) {
+        store->flags = flags;
+    }
+    int *speed = (int *)realloc(store->speed, sizeof(int) * capacity);
+    if (speed != NULL) {
+        store->speed = speed;
+    }
+    Entity *handle = (Entity *)realloc(store->handle, sizeof(Entity) * capacity);
+    if (handle != NULL) {
+        store->handle = handle;
+    }
+
+    if (x == NULL || y == NULL || sprite_ID == NULL || flags == NULL
+        || speed == NULL || handle == NULL) {
+        printf("Could not grow entity store to %d entities!\n", capacity);
+        return false;
+    }
+    store->capacity = capacity;
+    return true;
+}
+
+static bool growSlots(EntityStore *store, int capacity) {
+    int *slot_index = (int *)realloc(store->slot_index, sizeof(int) * capacity);
+    if (slot_index != NULL) {
+        store->slot_index = slot_index;
+    }
+    uint32_t *slot_generation = (uint32_t *)
+        realloc(store->slot_generation, sizeof(uint32_t) * capacity);
+    if (slot_generation != NULL) {
+        store->slot_generation = slot_generation;
+    }
+
+    if (slot_index == NULL || slot_generation == NULL) {
+        printf("Could not grow entity store to %d entities!\n", capacity);
+        return false;
+    }
+    store->slot_capacity = capacity;
+    return true;
+}
+
+EntityStore* initEntityStore(int capacity) {
+    EntityStore *store = (EntityStore *)calloc(1, sizeof(EntityStore));
+    if (store == NULL) {
+        printf("Could not allocate entity store!\n");
+        return NULL;
+    }
+    store->free_slot = -1;
+
+    capacity = capacity > 16 ? capacity : 16;
+    if (!growComponents(store, capacity) || !growSlots(store, capacity)) {
+        destroyEntityStore(store);
+        return NULL;
+    }
+    return store;
+}
+
+void destroyEntityStore(EntityStore *store) {
+    if (store == NULL) {
+        return;
+    }
+    free(store->x);
+    free(store->y);
+    free(store->sprite_ID);
+    free(store->flags);
+    free(store->speed);
+    free(store->handle);
+    free(store->slot_index);
+    free(store->slot_generation);
+    free(store);
+}
+
+// adds an entity at x, y (in level pixels) and returns its handle, or
+// ENTITY_NONE if the store is full and can't grow
+Entity addEntity(EntityStore *store, int sprite_ID, int x, int y,
+                 uint32_t flags) {
+    if (store->count == store->capacity
+        && (store->capacity >= MAX_ENTITIES
+            || !growComponents(store, store->capacity * 2))) {
+        return ENTITY_NONE;
+    }
+
+    // reuse a free slot when there is one, otherwise hand out a new one
+    int slot = store->free_slot;
+    if (slot >= 0) {
+        store->free_slot = store->slot_index[slot];
+    }
+    else {
+        // the last slot would make ENTITY_NONE a valid handle
+        if (store->slot_count == MAX_ENTITIES - 1
+            || (store->slot_count == store->slot_capacity
+                && !growSlots(store, store->slot_capacity * 2))) {
+            return ENTITY_NONE;
+        }
+        slot = store->slot_count++;
+        store->slot_generation[slot] = 0;
+    }
+
+    int index = store->count++;
+    Entity entity = (store->slot_generation[slot] << ENTITY_SLOT_BITS)
+                    | (uint32_t)slot;
+    store->slot_index[slot] = index;
+    store->x[index] = x;
+    store->y[index] = y;
+    store->sprite_ID[index] = sprite_ID;
+    store->flags[index] = flags;
+    store->speed[index] = ENTITY_NORMAL_SPEED;
+    store->handle[index] = entity;
+    return entity;
+}
+
+// removes entity by moving the last entity into its place. returns false if
+// it was already gone
+bool removeEntity(EntityStore *store, Entity entity) {
+    int index = entityIndex(store, entity);
+    if (index < 0) {
+        return false;
+    }
+
+    int last = --store->count;
+    if (index != last) {
+        store->x[index] = store->x[last];
+        store->y[index] = store->y[last];
+        store->sprite_ID[index] = store->sprite_ID[last];
+        store->flags[index] = store->flags[last];
+        store->speed[index] = store->speed[last];
+        store->handle[index] = store->handle[last];
+        store->slot_index[store->handle[index] & ENTITY_SLOT_MASK] = index;
+    }
+
+    // bumping the generation is what turns old handles to this slot stale
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    store->slot_generation[slot] =
+        (store->slot_generation[slot] + 1) & ENTITY_GENERATION_MASK;
+    store->slot_index[slot] = store->free_slot;
+    store->free_slot = (int)slot;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef __ENTITY_H__
+#define __ENTITY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// everything that lives on the map is an entity in an EntityStore. each
+// component has its own array (structure of arrays), and live entities are
+// always packed at the front of them, so systems are plain loops from 0 to
+// count that only touch the components they need.
+//
+// because removing an entity moves the last one into its place, array indices
+// aren't stable. the rest of the game holds on to an Entity handle instead:
+// a slot number plus a generation that changes every time the slot is reused,
+// so a handle to something that was removed just stops resolving (until the
+// generation wraps around, after a slot has been reused 1024 times)
+
+typedef uint32_t Entity;
+
+#define ENTITY_NONE 0xFFFFFFFFu
+#define ENTITY_SLOT_BITS 22
+#define ENTITY_SLOT_MASK ((1u << ENTITY_SLOT_BITS) - 1)
+#define ENTITY_GENERATION_MASK (0xFFFFFFFFu >> ENTITY_SLOT_BITS)
+#define MAX_ENTITIES (1 << ENTITY_SLOT_BITS)
+
+// how fast an ordinary entity acts, see turn.h
+#define ENTITY_NORMAL_SPEED 100
+
+enum entityFlags {
+    ENTITY_HERO = 1  // moves on its own instead of waiting for input
+};
+
+typedef struct EntityStore {
+    int count;
+    int capacity;
+
+    // components, indexed 0 .. count - 1. x and y are in level pixels
+    int *x;
+    int *y;
+    int *sprite_ID;
+    uint32_t *flags;
+    int *speed;      // ENTITY_NORMAL_SPEED unless changed after adding
+    Entity *handle;  // the handle of the entity at each index
+
+    // one per slot ever handed out. a live slot holds the index of its
+    // entity, a free one the next free slot (or -1)
+    int *slot_index;
+    uint32_t *slot_generation;
+    int slot_count;
+    int slot_capacity;
+    int free_slot;
+} EntityStore;
+
+EntityStore* initEntityStore(int);
+void destroyEntityStore(EntityStore *);
+Entity addEntity(EntityStore *, int, int, int, uint32_t);
+bool removeEntity(EntityStore *, Entity);
+
+// the index of entity's components, or -1 if it has been removed
+static inline int entityIndex(const EntityStore *store, Entity entity) {
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    if (entity == ENTITY_NONE || slot >= (uint32_t)store->slot_count
+        || store->slot_generation[slot] != entity >> ENTITY_SLOT_BITS) {
+        return -1;
+    }
+    return store->slot_index[slot];
+}
+
+#endif /* __ENTITY_H__ */
@@ -0,0 +1,451 @@
+#include "fov.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// how far past its viewers a streamed world's window reaches, so a few steps
+// don't rebuild it
+#define FOV_WINDOW_MARGIN 32
+
+OpacityMap* initOpacityMap(void) {
+    OpacityMap *opacity = (OpacityMap *)calloc(1, sizeof(OpacityMap));
+    if (opacity == NULL) {
+        printf("Could not allocate opacity map!\n");
+    }
+    return opacity;
+}
+
+void destroyOpacityMap(OpacityMap *opacity) {
+    if (opacity == NULL) {
+        return;
+    }
+    free(opacity->bits);
+    free(opacity);
+}
+
+// packs which of the width x height tiles at x, y block sight, replacing
+// whatever was there before. anything off a flat map does
+int buildOpacityMap(OpacityMap *opacity, GameMap *game_map, int x, int y,
+                    int width, int height) {
+    width = width > 0 ? width : 0;
+    height = height > 0 ? height : 0;
+    int stride = (width + 63) / 64;
+    size_t words = (size_t)stride * height;
+    if (words > opacity->capacity) {
+        uint64_t *bits =
+            (uint64_t *)realloc(opacity->bits, sizeof(uint64_t) * words);
+        if (bits == NULL) {
+            printf("Could not allocate opacity for %dx%d tiles!\n",
+                   width, height);
+            opacity->valid = false;
+            return -1;
+        }
+        opacity->bits = bits;
+        opacity->capacity = words;
+    }
+    opacity->x = x;
+    opacity->y = y;
+    opacity->width = width;
+    opacity->height = height;
+    opacity->stride = stride;
+
+    for (int row = 0; row < height; row++) {
+        uint64_t *out = opacity->bits + (size_t)row * stride;
+        int map_y = y + row;
+        bool flat = game_map->chunks == NULL;
+        bool on_map = !flat || (map_y >= 0 && map_y < game_map->height);
+        for (int word = 0; word < stride; word++) {
+            int first = x + word * 64;
+            int count = width - word * 64 < 64 ? width - word * 64 : 64;
+            uint64_t floors = 0;
+            if (flat && on_map && first >= 0
+                && first + count <= game_map->width) {
+                // the common case, straight out of the row 8 cells at a time
+                MapCell *cells = mapRow(game_map, map_y) + first;
+                int bit = 0;
+                for (; bit + 8 <= count; bit += 8) {
+                    floors |= (uint64_t)mapFloorBits8(cells + bit) << bit;
+                }
+                for (; bit < count; bit++) {
+                    floors |= (uint64_t)((cells[bit] & MAP_TILE_MASK)
+                                         == MAP_FLOOR) << bit;
+                }
+            }
+            else if (on_map) {
+                for (int bit = 0; bit < count; bit++) {
+                    int map_x = first + bit;
+                    if (flat && (map_x < 0 || map_x >= game_map->width)) {
+                        continue;
+                    }
+                    floors |= (uint64_t)(mapTileAt(game_map, map_x, map_y)
+                                         == MAP_FLOOR) << bit;
+                }
+            }
+            out[word] = ~floors;
+        }
+    }
+
+    opacity->build++;
+    opacity->valid = true;
+    return 0;
+}
+
+// makes sure the tiles from first_x, first_y to last_x, last_y (exclusive)
+// are covered, building the map again if they aren't
+int ensureOpacityMap(OpacityMap *opacity, GameMap *game_map, int first_x,
+                     int first_y, int last_x, int last_y) {
+    if (opacity->valid && first_x >= opacity->x && first_y >= opacity->y
+        && last_x <= opacity->x + opacity->width
+        && last_y <= opacity->y + opacity->height) {
+        return 0;
+    }
+    if (game_map->chunks == NULL) {
+        return buildOpacityMap(opacity, game_map, 0, 0, game_map->width,
+                               game_map->height);
+    }
+    return buildOpacityMap(opacity, game_map, first_x - FOV_WINDOW_MARGIN,
+                           first_y - FOV_WINDOW_MARGIN,
+                           last_x - first_x + FOV_WINDOW_MARGIN * 2,
+                           last_y - first_y + FOV_WINDOW_MARGIN * 2);
+}
+
+// for when the tile at x, y changes. cached results that can see it are
+// recomputed the next time they are asked for
+void setOpacity(OpacityMap *opacity, int x, int y, bool opaque) {
+    if (x < opacity->x || y < opacity->y || x >= opacity->x + opacity->width
+        || y >= opacity->y + opacity->height
+        || opaqueAt(opacity, x, y) == opaque) {
+        return;
+    }
+    int local_x = x - opacity->x;
+    uint64_t *word = &opacity->bits[(size_t)(y - opacity->y) * opacity->stride
+                                    + local_x / 64];
+    *word ^= (uint64_t)1 << (local_x % 64);
+
+    FovChange *change = &opacity->changes[opacity->version % FOV_CHANGE_LOG];
+    change->x = x;
+    change->y = y;
+    opacity->version++;
+}
+
+static inline void markVisible(FovResult *result, int x, int y) {
+    x -= result->x - result->radius;
+    y -= result->y - result->radius;
+    result->bits[(size_t)y * result->stride + x / 64] |= (uint64_t)1 << (x % 64);
+}
+
+// lights one octant from row on, between the start and end slopes. xx, xy,
+// yx and yy turn the octant's (column, row) into map offsets, so one routine
+// serves all 8
+static void castLight(FovResult *result, const OpacityMap *opacity, int row,
+                      double start, double end, int xx, int xy, int yx,
+                      int yy) {
+    if (start < end) {
+        return;
+    }
+    int radius = result->radius;
+    int radius_squared = radius * radius + radius;  // rounder circles
+    double next_start = start;
+
+    for (int j = row; j <= radius; j++) {
+        bool blocked = false;
+        for (int dx = -j, dy = -j; dx <= 0; dx++) {
+            double left_slope = (dx - 0.5) / (dy + 0.5);
+            double right_slope = (dx + 0.5) / (dy - 0.5);
+            if (start < right_slope) {
+                continue;
+            }
+            if (end > left_slope) {
+                break;
+            }
+
+            int x = result->x + dx * xx + dy * xy;
+            int y = result->y + dx * yx + dy * yy;
+            if (dx * dx + dy * dy <= radius_squared) {
+                markVisible(result, x, y);
+            }
+
+            bool opaque = opaqueAt(opacity, x, y);
+            if (blocked) {
+                if (opaque) {
+                    next_start = right_slope;
+                    continue;
+                }
+                blocked = false;
+                start = next_start;
+            }
+            else if (opaque && j < radius) {
+                // a wall starts a shadow. whatever is left of it is scanned
+                // on its own
+                blocked = true;
+                castLight(result, opacity, j + 1, start, left_slope, xx, xy,
+                          yx, yy);
+                next_start = right_slope;
+            }
+        }
+        if (blocked) {
+            break;
+        }
+    }
+}
+
+// works out what a viewer at x, y sees within radius tiles, into result
+int fovCompute(FovResult *result, const OpacityMap *opacity, int x, int y,
+               int radius) {
+    static const int octants[8][4] = {
+        { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+        {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1}
+    };
+
+    radius = radius > 0 ? radius : 0;
+    int side = radius * 2 + 1;
+    int stride = (side + 63) / 64;
+    size_t words = (size_t)stride * side;
+    if (words > result->capacity) {
+        uint64_t *bits =
+            (uint64_t *)realloc(result->bits, sizeof(uint64_t) * words);
+        if (bits == NULL) {
+            printf("Could not allocate a radius %d field of view!\n", radius);
+            result->valid = false;
+            return -1;
+        }
+        result->bits = bits;
+        result->capacity = words;
+    }
+    memset(result->bits, 0, sizeof(uint64_t) * words);
+
+    result->x = x;
+    result->y = y;
+    result->radius = radius;
+    result->stride = stride;
+    result->build = opacity->build;
+    result->version = opacity->version;
+
+    markVisible(result, x, y);
+    for (int i = 0; i < 8; i++) {
+        castLight(result, opacity, 1, 1.0, 0.0, octants[i][0], octants[i][1],
+                  octants[i][2], octants[i][3]);
+    }
+    result->valid = true;
+    return 0;
+}
+
+// makes destination a copy of source
+bool fovCopy(FovResult *destination, const FovResult *source) {
+    size_t words = source->valid
+        ? (size_t)source->stride * (source->radius * 2 + 1) : 0;
+    if (words > destination->capacity) {
+        uint64_t *bits =
+            (uint64_t *)realloc(destination->bits, sizeof(uint64_t) * words);
+        if (bits == NULL) {
+            destination->valid = false;
+            return false;
+        }
+        destination->bits = bits;
+        destination->capacity = words;
+    }
+    uint64_t *bits = destination->bits;
+    size_t capacity = destination->capacity;
+    *destination = *source;
+    destination->bits = bits;
+    destination->capacity = capacity;
+    if (words > 0) {
+        memcpy(destination->bits, source->bits, sizeof(uint64_t) * words);
+    }
+    return true;
+}
+
+void fovFree(FovResult *result) {
+    free(result->bits);
+    result->bits = NULL;
+    result->capacity = 0;
+    result->valid = false;
+}
+
+// whether result still says what a viewer at x, y would see. if it does it
+// is as good as one computed now, and only has to be checked against changes
+// from here on, which keeps viewers nothing happens near from falling off the
+// end of the change log
+static bool fovCurrent(FovResult *result, const OpacityMap *opacity,
+                       int x, int y, int radius) {
+    if (!result->valid || result->x != x || result->y != y
+        || result->radius != radius || result->build != opacity->build) {
+        return false;
+    }
+    if (opacity->version - result->version > FOV_CHANGE_LOG) {
+        return false;
+    }
+    // only changes within the radius matter
+    for (uint64_t i = result->version; i < opacity->version; i++) {
+        const FovChange *change = &opacity->changes[i % FOV_CHANGE_LOG];
+        if (abs(change->x - x) <= radius && abs(change->y - y) <= radius) {
+            return false;
+        }
+    }
+    result->version = opacity->version;
+    return true;
+}
+
+FovCache* initFovCache(void) {
+    FovCache *cache = (FovCache *)calloc(1, sizeof(FovCache));
+    if (cache == NULL) {
+        printf("Could not allocate field of view cache!\n");
+    }
+    return cache;
+}
+
+void destroyFovCache(FovCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    for (int i = 0; i < cache->capacity; i++) {
+        fovFree(&cache->results[i]);
+    }
+    free(cache->owner);
+    free(cache->results);
+    free(cache);
+}
+
+// the cached result for entity's slot, made room for if need be. one that
+// belonged to an earlier entity in the same slot is thrown out
+static FovResult* cachedResult(FovCache *cache, Entity entity) {
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    if (entity == ENTITY_NONE) {
+        return NULL;
+    }
+    if (slot >= (uint32_t)cache->capacity) {
+        int capacity = cache->capacity > 0 ? cache->capacity * 2 : 64;
+        while ((uint32_t)capacity <= slot) {
+            capacity *= 2;
+        }
+        Entity *owner =
+            (Entity *)realloc(cache->owner, sizeof(Entity) * capacity);
+        if (owner != NULL) {
+            cache->owner = owner;
+        }
+        FovResult *results = (FovResult *)
+            realloc(cache->results, sizeof(FovResult) * capacity);
+        if (results != NULL) {
+            cache->results = results;
+        }
+        if (owner == NULL || results == NULL) {
+            printf("Could not grow field of view cache to %d entities!\n",
+                   capacity);
+            return NULL;
+        }
+        for (int i = cache->capacity; i < capacity; i++) {
+            cache->owner[i] = ENTITY_NONE;
+            memset(&cache->results[i], 0, sizeof(FovResult));
+        }
+        cache->capacity = capacity;
+    }
+
+    if (cache->owner[slot] != entity) {
+        cache->owner[slot] = entity;
+        cache->results[slot].valid = false;
+    }
+    return &cache->results[slot];
+}
+
+// what entity sees from x, y. cached until it moves or something in view
+// changes. NULL if there wasn't memory for it
+FovResult* fovFor(FovCache *cache, const OpacityMap *opacity, Entity entity,
+                  int x, int y, int radius) {
+    FovResult *result = cachedResult(cache, entity);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (!fovCurrent(result, opacity, x, y, radius)
+        && fovCompute(result, opacity, x, y, radius) != 0) {
+        return NULL;
+    }
+    return result;
+}
+
+typedef struct FovJob {
+    const OpacityMap *opacity;
+    FovResult *results;  // the cache's
+    int *slot;           // of each result to compute
+    const int *x;
+    const int *y;
+    int *index;  // into x and y, for each result
+    int first;
+    int last;
+    int radius;
+    int failed;
+} FovJob;
+
+static void* fovWorker(void *data) {
+    FovJob *job = (FovJob *)data;
+    for (int i = job->first; i < job->last; i++) {
+        int viewer = job->index[i];
+        if (fovCompute(&job->results[job->slot[i]], job->opacity, job->x[viewer],
+                       job->y[viewer], job->radius) != 0) {
+            job->failed++;
+        }
+    }
+    return NULL;
+}
+
+// brings the cached field of view of count entities at the given positions up
+// to date, splitting the ones that need it between threads. the cache itself
+// is only touched from here, so workers never race on it. returns how many
+// were computed, or -1 if any couldn't be
+int fovComputeBatch(FovCache *cache, const OpacityMap *opacity,
+                    const Entity *entities, const int *x, const int *y,
+                    int count, int radius, int threads) {
+    int *stale = (int *)malloc(sizeof(int) * count);
+    int *index = (int *)malloc(sizeof(int) * count);
+    if ((stale == NULL || index == NULL) && count > 0) {
+        printf("Could not allocate field of view batch!\n");
+        free(stale);
+        free(index);
+        return -1;
+    }
+
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+        FovResult *result = cachedResult(cache, entities[i]);
+        if (result != NULL && !fovCurrent(result, opacity, x[i], y[i], radius)) {
+            // a slot, since the cache may still grow under a pointer
+            stale[pending] = (int)(entities[i] & ENTITY_SLOT_MASK);
+            index[pending] = i;
+            pending++;
+        }
+    }
+
+    int workers = threads < 1 ? 1 : threads;
+    workers = workers > pending ? (pending > 0 ? pending : 1) : workers;
+    FovJob jobs[workers];
+    pthread_t thread_list[workers];
+    bool started[workers];
+    for (int i = 0; i < workers; i++) {
+        jobs[i] = (FovJob){ .opacity = opacity, .results = cache->results,
+                            .slot = stale, .x = x,
+                            .y = y, .index = index, .radius = radius,
+                            .first = (int)((int64_t)pending * i / workers),
+                            .last = (int)((int64_t)pending * (i + 1) / workers),
+                            .failed = 0 };
+        started[i] = i > 0 && pthread_create(&thread_list[i], NULL, fovWorker,
+                                             &jobs[i]) == 0;
+    }
+
+    // the calling thread takes the first share, and those of any threads
+    // that wouldn't start
+    int failed = 0;
+    for (int i = 0; i < workers; i++) {
+        if (!started[i]) {
+            fovWorker(&jobs[i]);
+        }
+    }
+    for (int i = 0; i < workers; i++) {
+        if (started[i]) {
+            pthread_join(thread_list[i], NULL);
+        }
+        failed += jobs[i].failed;
+    }
+    free(stale);
+    free(index);
+    return failed > 0 ? -1 : pending;
+}
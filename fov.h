@@ -0,0 +1,123 @@
+#ifndef __FOV_H__
+#define __FOV_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+#include "entity.h"
+
+// who can see what. sight is blocked by anything that isn't floor, which an
+// OpacityMap keeps one bit per tile so the shadowcaster never touches the map
+// itself. like TileVariants it covers a window of the map: all of a flat map,
+// the part around the viewers of a streamed world
+//
+// field of view is recursive shadowcasting: each of the 8 octants is scanned
+// row by row outwards from the viewer, and a wall splits the scan into the
+// slopes on either side of its shadow. every tile is looked at about once, so
+// a radius r field of view costs O(r^2) whatever the map size
+//
+// results are cached per entity, and only computed again once the entity has
+// moved or a tile within its radius changed opacity
+
+// opacity changes remembered for cache checks. a result that hasn't been
+// asked for in this many changes is recomputed regardless
+#define FOV_CHANGE_LOG 256
+
+typedef struct FovChange {
+    int x;
+    int y;
+} FovChange;
+
+typedef struct OpacityMap {
+    // the window of the map covered, in tiles. everything outside it blocks
+    // sight
+    int x;
+    int y;
+    int width;
+    int height;
+    bool valid;
+
+    int stride;       // words per row
+    uint64_t *bits;   // 1 = blocks sight
+    size_t capacity;  // in words
+
+    // every build and every change make cached results older
+    uint64_t build;
+    uint64_t version;
+    FovChange changes[FOV_CHANGE_LOG];  // change n is changes[n % LOG]
+} OpacityMap;
+
+typedef struct FovResult {
+    bool valid;
+    int x;       // the viewer, in tiles
+    int y;
+    int radius;
+    uint64_t build;    // of the opacity map it was computed with
+    uint64_t version;
+
+    // a (2 * radius + 1) square centered on the viewer, one bit per tile
+    int stride;  // words per row
+    uint64_t *bits;
+    size_t capacity;
+} FovResult;
+
+typedef struct FovCache {
+    int capacity;        // per entity handle slot
+    Entity *owner;       // who each result belongs to, ENTITY_NONE if nobody
+    FovResult *results;
+} FovCache;
+
+OpacityMap* initOpacityMap(void);
+void destroyOpacityMap(OpacityMap *);
+int buildOpacityMap(OpacityMap *, GameMap *, int, int, int, int);
+int ensureOpacityMap(OpacityMap *, GameMap *, int, int, int, int);
+void setOpacity(OpacityMap *, int, int, bool);
+
+int fovCompute(FovResult *, const OpacityMap *, int, int, int);
+bool fovCopy(FovResult *, const FovResult *);
+void fovFree(FovResult *);
+
+FovCache* initFovCache(void);
+void destroyFovCache(FovCache *);
+FovResult* fovFor(FovCache *, const OpacityMap *, Entity, int, int, int);
+int fovComputeBatch(FovCache *, const OpacityMap *, const Entity *,
+                    const int *, const int *, int, int, int);
+
+static inline bool opaqueAt(const OpacityMap *opacity, int x, int y) {
+    x -= opacity->x;
+    y -= opacity->y;
+    if (x < 0 || y < 0 || x >= opacity->width || y >= opacity->height) {
+        return true;
+    }
+    return (opacity->bits[(size_t)y * opacity->stride + x / 64]
+            >> (x % 64)) & 1;
+}
+
+// whether the viewer of result sees the tile at x, y
+static inline bool fovVisible(const FovResult *result, int x, int y) {
+    x -= result->x - result->radius;
+    y -= result->y - result->radius;
+    int side = result->radius * 2 + 1;
+    if (!result->valid || x < 0 || y < 0 || x >= side || y >= side) {
+        return false;
+    }
+    return (result->bits[(size_t)y * result->stride + x / 64] >> (x % 64)) & 1;
+}
+
+// narrows the range of tiles from first_x, first_y to last_x, last_y
+// (exclusive) down to the part result could possibly see
+static inline void fovClip(const FovResult *result, int *first_x,
+                           int *first_y, int *last_x, int *last_y) {
+    int left = result->x - result->radius;
+    int top = result->y - result->radius;
+    int right = result->x + result->radius + 1;
+    int bottom = result->y + result->radius + 1;
+    *first_x = *first_x > left ? *first_x : left;
+    *first_y = *first_y > top ? *first_y : top;
+    *last_x = *last_x < right ? *last_x : right;
+    *last_y = *last_y < bottom ? *last_y : bottom;
+    *last_x = *last_x < *first_x ? *first_x : *last_x;
+    *last_y = *last_y < *first_y ? *first_y : *last_y;
+}
+
+#endif /* __FOV_H__ */
@@ -1,134 +1,372 @@
 #include "map.h"
+#include "cave.h"
+#include "chunk.h"
+#include "region.h"
+#include "profile.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-// creates a new map of random size initialized to all 1s
+// saved maps start with this header, followed by data_size bytes of tiles in
+// the given encoding. the header is 64 bytes so that raw tiles land on a cache
+// line in the mapped file, same as they would in initMap. fields are stored in
+// the machine's own byte order
+#define MAP_FILE_VERSION 1
+
+typedef struct MapFileHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint64_t seed;
+    uint32_t encoding;
+    uint32_t reserved;
+    uint64_t data_size;
+    uint64_t checksum;  // of the tile data, as stored
+    uint8_t padding[16];
+} MapFileHeader;
+
+static const char MAP_FILE_MAGIC[4] = { 'Y', 'Z', 'M', 'P' };
+
+// creates a new map of the given size initialized to all walls
+// the struct and its tiles share a single allocation, so destroyMap is one free
 GameMap* initMap(int x_in_tiles, int y_in_tiles) {
-    GameMap *game_map = (GameMap *)malloc(sizeof(GameMap));
+    size_t cells = (size_t)x_in_tiles * y_in_tiles;
+    GameMap *game_map =
+        (GameMap *)malloc(sizeof(GameMap) + MAP_ALIGNMENT - 1 + cells);
+    if (game_map == NULL) {
+        printf("Could not allocate %dx%d map!\n", x_in_tiles, y_in_tiles);
+        return NULL;
+    }
+
     game_map->width = x_in_tiles;
     game_map->height = y_in_tiles;
+    game_map->chunks = NULL;
+    game_map->file_data = NULL;
+    game_map->file_size = 0;
 
-    // allocating all the space for our map
-    game_map->map_array = (int**) malloc(sizeof(int*) * game_map->width);
-    for (int i = 0; i < game_map->width; i++) {
-        (game_map->map_array)[i] = (int *)malloc(sizeof(int) * game_map->height);
-    }
+    // the tiles live right after the struct, rounded up to the next cache line
+    uintptr_t tiles = (uintptr_t)(game_map + 1);
+    tiles = (tiles + MAP_ALIGNMENT - 1) & ~(uintptr_t)(MAP_ALIGNMENT - 1);
+    game_map->tiles = (MapCell *)tiles;
 
-    // init everything to '1'
-    for (int i = 0; i < game_map->width; i++) {
-        for (int j = 0; j < game_map->height; j++) {
-            (game_map->map_array)[i][j] = 1;
-        }
-    }
+    memset(game_map->tiles, MAP_WALL, cells);
 
     return game_map;
 }
 
 // convenience function, inits a map between 50x50 and 100x100 tiles
-GameMap* initRandomSizedMap() {
-    int width = randomRange(50, 100);
-    int height = randomRange(50, 100);
+// the size is rolled from the seed, so a seed always gives the same size map
+GameMap* initRandomSizedMap(const MapGenOptions *options) {
+    if (options->chunked) {
+        return initChunkedMap(options);
+    }
+
+    int width = options->width > 0 ? options->width
+                : mapNoiseRange(mapNoise(options->seed, -1, -1), 50, 100);
+    int height = options->height > 0 ? options->height
+                 : mapNoiseRange(mapNoise(options->seed, -2, -1), 50, 100);
     return(initMap(width, height));
 }
 
 // TODO: Generate more than one kind of terrain
-// FIXME: cave terrain generation has a strange bottom-right cutoff issue. I assume this is because we are evaluating the map and editing values in the same step.
-// Maybe double-buffer it? (analyze map, writing changes to buffer, replace map with buffer, repeat)
 // "simple" cave generation based on a naive implementation of the following:
 // https://www.roguebasin.com/index.php?title=Cellular_Automata_Method_for_Generating_Random_Cave-Like_Levels
-void generateCaveTerrain(GameMap *game_map) {
-
-    enum {
-        FLOOR,
-        WALL
-    };
-
-    // first, randomize map area
-    // TODO: made this map area smaller by 1 because my ass is lazy..
-    // ..I mean to avoid out-of-bounds errors during generation
-    for (int i = 1; i < game_map->width - 1; i++) {
-        for (int j = 1; j < game_map->height - 1; j++) {
-            int roll = randomRange(0, 100);
-            if (roll < CAVE_WALL_PROBABILITY) {
-                (game_map->map_array)[i][j] = 1;
-            }
-            else {
-                (game_map->map_array)[i][j] = 0;
-            }
-        }
+// The cave generator randomizes the map area, then walks through the map
+// several times. For each location on the map, it counts the walls among the
+// 8 adjacent squares. flimsy walls with fewer than 4 wall neighbours collapse
+// into floor, and floors encroached by more than 4 walls fill in.
+// see caveGenerate in cave.c for how this is spread across threads
+// the automaton leaves pockets of floor cut off from each other, which
+// repairRegions then joins up or fills in
+// chunked maps generate each chunk the first time it is needed instead
+void generateCaveTerrain(GameMap *game_map, const MapGenOptions *options) {
+    if (game_map->chunks != NULL) {
+        return;
     }
-
-    // The cave generator works by walking through the map several times.
-    // For each location on the map, it analyzes the 8 adjacent squares.
-    // if those squares contain a wall, we add 1 to our count
-    for (int step = 0; step < CAVE_GENERATOR_ITERATIONS; step++) {
-        for (int i = 1; i < game_map->width - 1; i++) {
-            for (int j = 1; j < game_map->height - 1; j++) {
-                int wall_count = 0;
-                for (int k = 0; k < 3; k++) {
-                    for (int l = 0; l < 3; l++) {
-                        if ((game_map->map_array)[i + k - 1][j + l - 1] == WALL
-                            && !(k == 1 && l == 1))
-                        {
-                            wall_count++;
-                        }
-                    }
-                }
-
-                // if our tile is a flimsy unsupported wall has less than four walls around it, we collapse it into a floor tile
-                // if instead our tile is a floor encroached by more than 4 walls, we fill this tile with a wall
-                if ((game_map->map_array)[i][j] == WALL && wall_count < 4){
-                    (game_map->map_array)[i][j] = FLOOR;
-                }
-                if ((game_map->map_array)[i][j] == FLOOR && wall_count > 4) {
-                    (game_map->map_array)[i][j] = WALL;
-                }
-            }
+    PROFILE_BEGIN(map_generation);
+    caveGenerate(game_map, options->seed, options->threads);
+    if (options->connectivity != MAP_CONNECT_NONE) {
+        PROFILE_BEGIN(repair_regions);
+        MapRegions *regions = initMapRegions();
+        if (regions != NULL) {
+            repairRegions(regions, game_map, options->connectivity,
+                          options->threads);
+            destroyMapRegions(regions);
         }
+        PROFILE_END(repair_regions);
     }
-
+    PROFILE_END(map_generation);
     return;
 }
 
-int replaceMap(GameMap **game_map) {
+int replaceMap(GameMap **game_map, const MapGenOptions *options) {
 
     //free up the old map
     destroyMap(*game_map);
-    *game_map = initRandomSizedMap();
-    generateCaveTerrain(*game_map);
+    *game_map = initRandomSizedMap(options);
+    generateCaveTerrain(*game_map, options);
     return EXIT_SUCCESS;
 }
 
 void destroyMap(GameMap *game_map) {
 
-    //free up the old map_array
-    if (game_map->map_array != NULL) {
-        for (int i = 0; i < game_map->width; i++) {
-            free((game_map->map_array)[i]);
-            (game_map->map_array)[i] = NULL;
-        }
-        free(game_map->map_array);
-        game_map->map_array = NULL;
+    // writes back any chunks that were changed
+    if (game_map->chunks != NULL) {
+        destroyChunkedMap(game_map->chunks);
     }
 
-    //and finally clear the struct
+    // otherwise the tiles share the struct's allocation, so this frees
+    // everything
+    if (game_map->file_data != NULL) {
+        unmapFile(game_map->file_data, game_map->file_size);
+    }
     free(game_map);
-    game_map = NULL;
 }
 
-// completely stolen from https://stackoverflow.com/a/18386648, ty vitim.us!
-// https://stackoverflow.com/users/938822/vitim-us
-int randomRange(int min, int max) {
-    return min + rand() / (RAND_MAX / (max - min + 1) + 1);
+// FNV-1a, a word at a time
+static uint64_t mapChecksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001B3ull;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// packs cells into (run length, cell) pairs. returns the packed size, out
+// needs room for 2 bytes per cell in the worst case
+static size_t encodeRuns(const MapCell *cells, size_t count, uint8_t *out) {
+    size_t size = 0;
+    size_t i = 0;
+    while (i < count) {
+        MapCell cell = cells[i];
+        size_t run = 1;
+        while (i + run < count && run < 255 && cells[i + run] == cell) {
+            run++;
+        }
+        out[size++] = (uint8_t)run;
+        out[size++] = cell;
+        i += run;
+    }
+    return size;
+}
+
+// the other way round. fails unless the runs fill cells exactly
+static bool decodeRuns(const uint8_t *data, size_t size, MapCell *cells,
+                       size_t count) {
+    size_t filled = 0;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        size_t run = data[i];
+        if (run == 0 || filled + run > count) {
+            return false;
+        }
+        memset(cells + filled, data[i + 1], run);
+        filled += run;
+    }
+    return filled == count && size % 2 == 0;
+}
+
+// writes game_map and the seed it came from to path. returns 0 on success
+int saveMap(GameMap *game_map, uint64_t seed, const char *path, int encoding) {
+    if (game_map->chunks != NULL) {
+        printf("Streamed worlds can't be saved as a single map!\n");
+        return -1;
+    }
+
+    size_t cells = (size_t)game_map->width * game_map->height;
+    const uint8_t *data = game_map->tiles;
+    size_t data_size = cells;
+    uint8_t *packed = NULL;
+
+    if (encoding == MAP_ENCODING_RLE) {
+        packed = (uint8_t *)malloc(cells * 2);
+        if (packed == NULL) {
+            printf("Could not allocate space to pack map!\n");
+            return -1;
+        }
+        data_size = encodeRuns(game_map->tiles, cells, packed);
+        data = packed;
+    }
+    else {
+        encoding = MAP_ENCODING_RAW;
+    }
+
+    MapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = MAP_FILE_VERSION;
+    header.width = game_map->width;
+    header.height = game_map->height;
+    header.seed = seed;
+    header.encoding = (uint32_t)encoding;
+    header.data_size = data_size;
+    header.checksum = mapChecksum(data, data_size);
+
+    int result = -1;
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Could not save map %s! %s\n", path, strerror(errno));
+    }
+    else {
+        if (fwrite(&header, sizeof(header), 1, file) == 1
+            && (data_size == 0 || fwrite(data, data_size, 1, file) == 1)) {
+            result = 0;
+        }
+        if (fclose(file) != 0) {
+            result = -1;
+        }
+        if (result != 0) {
+            printf("Could not save map %s! %s\n", path, strerror(errno));
+        }
+    }
+
+    free(packed);
+    return result;
+}
+
+// maps the whole file at path into memory, privately: writes to the mapping
+// never reach the file. NULL if it can't be opened or is empty
+void* mapFile(const char *path, size_t *size) {
+#ifdef _WIN32
+    // no mmap here, so just read it in
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *data = length > 0 ? malloc((size_t)length) : NULL;
+    if (data != NULL && fread(data, (size_t)length, 1, file) != 1) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = (size_t)length;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)info.st_size;
+    return data;
+#endif
+}
+
+void unmapFile(void *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// loads a map written by saveMap, or returns NULL if it can't. raw maps are
+// not copied: their tiles are used right where they sit in the mapped file, so
+// loading costs about as much as checking the checksum. seed, if given, gets
+// the seed the map was generated from
+GameMap* loadMap(const char *path, uint64_t *seed) {
+    size_t size = 0;
+    uint8_t *file_data = (uint8_t *)mapFile(path, &size);
+    if (file_data == NULL) {
+        printf("Could not open map %s! %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    const MapFileHeader *header = (const MapFileHeader *)file_data;
+    const uint8_t *data = file_data + sizeof(MapFileHeader);
+    if (size < sizeof(MapFileHeader)
+        || memcmp(header->magic, MAP_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        printf("%s is not a map file!\n", path);
+        unmapFile(file_data, size);
+        return NULL;
+    }
+
+    size_t cells = (size_t)header->width * header->height;
+    bool valid = header->version == MAP_FILE_VERSION
+                 && header->width > 0 && header->height > 0
+                 && header->data_size == size - sizeof(MapFileHeader)
+                 && (header->encoding == MAP_ENCODING_RLE
+                     || (header->encoding == MAP_ENCODING_RAW
+                         && header->data_size == cells));
+    if (!valid) {
+        printf("Map %s is damaged or from another version!\n", path);
+        unmapFile(file_data, size);
+        return NULL;
+    }
+    if (mapChecksum(data, header->data_size) != header->checksum) {
+        printf("Map %s failed its checksum!\n", path);
+        unmapFile(file_data, size);
+        return NULL;
+    }
+
+    if (seed != NULL) {
+        *seed = header->seed;
+    }
+
+    GameMap *game_map;
+    if (header->encoding == MAP_ENCODING_RAW) {
+        game_map = (GameMap *)malloc(sizeof(GameMap));
+        if (game_map == NULL) {
+            printf("Could not allocate map!\n");
+            unmapFile(file_data, size);
+            return NULL;
+        }
+        game_map->width = header->width;
+        game_map->height = header->height;
+        game_map->tiles = (MapCell *)data;
+        game_map->chunks = NULL;
+        game_map->file_data = file_data;
+        game_map->file_size = size;
+        return game_map;
+    }
+
+    game_map = initMap(header->width, header->height);
+    if (game_map != NULL
+        && !decodeRuns(data, header->data_size, game_map->tiles, cells)) {
+        printf("Map %s is damaged!\n", path);
+        destroyMap(game_map);
+        game_map = NULL;
+    }
+    unmapFile(file_data, size);
+    return game_map;
 }
 
 // strictly for debugging purposes
 void asciiOutputMap(GameMap *game_map) {
 
-    for (int i = 0; i < game_map->width; i++) {
-        for (int j = 0; j < game_map->height; j++) {
-            printf("%d", game_map->map_array[i][j]);
+    for (int y = 0; y < game_map->height; y++) {
+        for (int x = 0; x < game_map->width; x++) {
+            printf("%d", mapTileAt(game_map, x, y));
         }
         printf("\n");
     }
@@ -1,6 +1,12 @@
 #ifndef __MAP_H__
 #define __MAP_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "rng.h"
+
 extern const int INITIAL_SCREEN_WIDTH;
 extern const int INITIAL_SCREEN_HEIGHT;
 extern const int TILE_SIZE;
@@ -8,19 +14,151 @@ extern const int TILE_SIZE;
 extern const int CAVE_WALL_PROBABILITY;
 extern const int CAVE_GENERATOR_ITERATIONS;
 
+// tiles are stored one byte per cell. the low bits hold the tile ID and the
+// high bits are free for per-cell flags
+typedef uint8_t MapCell;
+
+#define MAP_TILE_MASK 0x0F
+#define MAP_FLAG_MASK 0xF0
+
+// the tile buffer starts on a cache line boundary
+#define MAP_ALIGNMENT 64
+
+enum mapTile {
+    MAP_FLOOR,
+    MAP_WALL
+};
+
+struct ChunkedMap;
+
 // map height and width are in tiles. aka 1 = TILE_SIZE pixels
+// tiles is row-major: the cell at (x, y) lives at tiles[y * width + x]
+// a chunked map has no tiles array at all. its tiles live in chunks that are
+// generated, cached and evicted on demand (see chunk.c), so anything that may
+// see one has to go through mapTileAt and mapSetTileAt
+// a map loaded by loadMap may have its tiles right inside the mapped file
+// instead, in which case file_data is that mapping
 typedef struct GameMap {
     int width;
     int height;
-    int **map_array;
+    MapCell *tiles;
+    struct ChunkedMap *chunks;
+    void *file_data;
+    size_t file_size;
 } GameMap;
 
+// everything needed to reproduce a generated map. the same seed always gives
+// the same map, no matter how many threads generated it
+// chunked asks for a streamed world instead of a single 50-100 tile cave;
+// memory_budget (bytes) and chunk_directory only apply to those
+// connectivity is what is done about floor cut off from the rest of a cave
+// width and height fix the size of a cave, 0 leaves it to the seed
+typedef struct MapGenOptions {
+    uint64_t seed;
+    int threads;
+    int width;
+    int height;
+    int connectivity;
+    bool chunked;
+    size_t memory_budget;
+    const char *chunk_directory;
+} MapGenOptions;
+
+// see repairRegions in region.c
+enum mapConnectivity {
+    MAP_CONNECT_TUNNEL,
+    MAP_CONNECT_CULL,
+    MAP_CONNECT_NONE
+};
+
+// how saveMap stores the tiles. raw tiles are used in place straight out of
+// the file, run-length encoded ones are smaller but have to be unpacked
+enum mapEncoding {
+    MAP_ENCODING_RAW,
+    MAP_ENCODING_RLE
+};
+
 GameMap* initMap(int, int);
-GameMap* initRandomSizedMap();
-void generateCaveTerrain(GameMap *);
-int replaceMap(GameMap **);
+GameMap* initRandomSizedMap(const MapGenOptions *);
+void generateCaveTerrain(GameMap *, const MapGenOptions *);
+int replaceMap(GameMap **, const MapGenOptions *);
 void destroyMap(GameMap *);
-int randomRange(int, int);
+int saveMap(GameMap *, uint64_t, const char *, int);
+GameMap* loadMap(const char *, uint64_t *);
 void asciiOutputMap(GameMap *);
+void* mapFile(const char *, size_t *);
+void unmapFile(void *, size_t);
+
+// returns a pointer to the first cell of row y
+static inline MapCell* mapRow(const GameMap *game_map, int y) {
+    return game_map->tiles + (size_t)y * game_map->width;
+}
+
+// returns the tile ID at (x, y), without flags
+static inline int mapGet(const GameMap *game_map, int x, int y) {
+    return mapRow(game_map, y)[x] & MAP_TILE_MASK;
+}
+
+// sets the tile ID at (x, y), leaving its flags untouched
+static inline void mapSet(GameMap *game_map, int x, int y, int tile) {
+    MapCell *cell = &mapRow(game_map, y)[x];
+    *cell = (*cell & MAP_FLAG_MASK) | (tile & MAP_TILE_MASK);
+}
+
+static inline int mapGetFlags(const GameMap *game_map, int x, int y) {
+    return mapRow(game_map, y)[x] & MAP_FLAG_MASK;
+}
+
+static inline void mapSetFlags(GameMap *game_map, int x, int y, int flags) {
+    MapCell *cell = &mapRow(game_map, y)[x];
+    *cell = (*cell & MAP_TILE_MASK) | (flags & MAP_FLAG_MASK);
+}
+
+// one bit per cell for whether each of the 8 cells from cells on is floor
+// (tile ID 0), without a branch or a loop: the top bit of every byte says
+// whether its tile ID is non-zero, and the multiply gathers those 8 bits into
+// the top byte
+static inline uint8_t mapFloorBits8(const MapCell *cells) {
+    uint64_t bytes;
+    memcpy(&bytes, cells, sizeof(bytes));
+    uint64_t tiles = bytes & 0x0F0F0F0F0F0F0F0Full;
+    uint64_t walls = (tiles + 0x7F7F7F7F7F7F7F7Full) & 0x8080808080808080ull;
+    uint64_t floors = ~walls & 0x8080808080808080ull;
+    return (uint8_t)(((floors >> 7) * 0x0102040810204080ull) >> 56);
+}
+
+int chunkedMapGet(struct ChunkedMap *, int, int);
+void chunkedMapSet(struct ChunkedMap *, int, int, int);
+
+// chunk-aware versions of mapGet and mapSet. these work on any map, and cost a
+// single branch over the flat ones when the map isn't chunked
+static inline int mapTileAt(const GameMap *game_map, int x, int y) {
+    if (game_map->chunks != NULL) {
+        return chunkedMapGet(game_map->chunks, x, y);
+    }
+    return mapGet(game_map, x, y);
+}
+
+static inline void mapSetTileAt(GameMap *game_map, int x, int y, int tile) {
+    if (game_map->chunks != NULL) {
+        chunkedMapSet(game_map->chunks, x, y, tile);
+        return;
+    }
+    mapSet(game_map, x, y, tile);
+}
+
+// counter-based noise: a SplitMix64 hash of (seed, x, y). every tile gets its
+// own independent random value without any shared generator state, so tiles
+// can be rolled in any order and on any thread
+static inline uint64_t mapNoise(uint64_t seed, int x, int y) {
+    return rngMix64(seed
+                    + 0x9E3779B97F4A7C15ull
+                    * ((((uint64_t)(uint32_t)y) << 32 | (uint32_t)x) + 1));
+}
+
+// maps a noise value onto [min, max]
+static inline int mapNoiseRange(uint64_t noise, int min, int max) {
+    return min + (int)(((noise >> 32) * (uint64_t)(max - min + 1)) >> 32);
+}
 
 #endif /* __MAP_H__ */
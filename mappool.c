@@ -0,0 +1,219 @@
+#include "mappool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool initQueue(MapQueue *queue, int capacity) {
+    queue->slots = (PooledMap *)malloc(sizeof(PooledMap) * capacity);
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return queue->slots != NULL;
+}
+
+// producer side. the slot is filled before the new tail is published, so the
+// consumer never sees a half written map
+static bool queuePush(MapQueue *queue, const PooledMap *map) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head == (size_t)queue->capacity) {
+        return false;
+    }
+    queue->slots[tail % queue->capacity] = *map;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// consumer side. the slot is read before the new head hands it back to the
+// producer
+static bool queuePop(MapQueue *queue, PooledMap *map) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *map = queue->slots[head % queue->capacity];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+static bool queueFull(MapQueue *queue) {
+    return atomic_load_explicit(&queue->tail, memory_order_acquire)
+           - atomic_load_explicit(&queue->head, memory_order_acquire)
+           == (size_t)queue->capacity;
+}
+
+static bool queueEmpty(MapQueue *queue) {
+    return atomic_load_explicit(&queue->tail, memory_order_acquire)
+           == atomic_load_explicit(&queue->head, memory_order_acquire);
+}
+
+void freePooledMap(PooledMap *map) {
+    if (map->game_map != NULL) {
+        destroyMap(map->game_map);
+    }
+    destroyMapRegions(map->regions);
+    destroyTileVariants(map->variants);
+    map->game_map = NULL;
+    map->regions = NULL;
+    map->variants = NULL;
+}
+
+// everything the game would otherwise work out when it switches maps
+static bool prepareMap(MapPool *pool, PooledMap *map) {
+    MapGenOptions options = pool->options;
+    options.seed = rngNext(&pool->rng);
+    map->seed = options.seed;
+    map->game_map = initRandomSizedMap(&options);
+    map->regions = initMapRegions();
+    map->variants = initTileVariants();
+    if (map->game_map == NULL || map->regions == NULL
+        || map->variants == NULL) {
+        freePooledMap(map);
+        return false;
+    }
+    generateCaveTerrain(map->game_map, &options);
+    labelRegions(map->regions, map->game_map, options.threads);
+    computeTileVariants(map->variants, map->game_map, 0, 0,
+                        map->game_map->width, map->game_map->height);
+    return true;
+}
+
+static void wakeWorker(MapPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* mapPoolWorker(void *data) {
+    MapPool *pool = (MapPool *)data;
+    for (;;) {
+        PooledMap map;
+        while (queuePop(&pool->retired, &map)) {
+            freePooledMap(&map);
+        }
+
+        // the game takes the lock to wake us after changing either queue,
+        // so checking them under it can't miss that
+        pthread_mutex_lock(&pool->lock);
+        while (!atomic_load(&pool->stop) && queueFull(&pool->ready)
+               && queueEmpty(&pool->retired)) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (atomic_load(&pool->stop)) {
+            break;
+        }
+        if (queueFull(&pool->ready)) {
+            continue;  // only woken to free old maps
+        }
+
+        if (!prepareMap(pool, &map)) {
+            printf("Could not generate a map in the background!\n");
+            atomic_store(&pool->stop, true);
+        }
+        else {
+            queuePush(&pool->ready, &map);
+        }
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->added);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+// starts a worker keeping size maps made with options ready, seeded from
+// map_rng onwards. generation runs on the one worker thread, leaving the
+// rest of the machine to the game. NULL if the pool can't be had, in which
+// case maps are best made the old way
+MapPool* initMapPool(const MapGenOptions *options, const Rng *map_rng,
+                     int size) {
+    if (options->chunked || size < 1) {
+        return NULL;  // a streamed world is never replaced wholesale
+    }
+    MapPool *pool = (MapPool *)calloc(1, sizeof(MapPool));
+    if (pool == NULL) {
+        printf("Could not allocate map pool!\n");
+        return NULL;
+    }
+    pool->options = *options;
+    pool->options.threads = 1;
+    pool->rng = *map_rng;
+    atomic_init(&pool->stop, false);
+    if (!initQueue(&pool->ready, size) || !initQueue(&pool->retired, size)) {
+        printf("Could not allocate map pool of %d maps!\n", size);
+        free(pool->ready.slots);
+        free(pool->retired.slots);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->added, NULL);
+
+    if (pthread_create(&pool->thread, NULL, mapPoolWorker, pool) != 0) {
+        printf("Could not start the map pool thread\n");
+        destroyMapPool(pool);
+        return NULL;
+    }
+    pool->running = true;
+    return pool;
+}
+
+void destroyMapPool(MapPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    if (pool->running) {
+        pthread_mutex_lock(&pool->lock);
+        atomic_store(&pool->stop, true);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+        pthread_join(pool->thread, NULL);
+    }
+
+    PooledMap map;
+    while (queuePop(&pool->ready, &map)) {
+        freePooledMap(&map);
+    }
+    while (queuePop(&pool->retired, &map)) {
+        freePooledMap(&map);
+    }
+    free(pool->ready.slots);
+    free(pool->retired.slots);
+    pthread_cond_destroy(&pool->added);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+// takes the next map into map, and has the worker start on a replacement.
+// with wait, blocks until there is one instead of giving up. false if there
+// is none to be had
+bool takePooledMap(MapPool *pool, PooledMap *map, bool wait) {
+    if (!queuePop(&pool->ready, map)) {
+        if (!wait) {
+            return false;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!queuePop(&pool->ready, map)) {
+            if (atomic_load(&pool->stop)) {
+                pthread_mutex_unlock(&pool->lock);
+                return false;
+            }
+            pthread_cond_wait(&pool->added, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    wakeWorker(pool);
+    return true;
+}
+
+// hands a map the game is done with to the worker to free, or frees it here
+// if the worker is behind
+void retirePooledMap(MapPool *pool, PooledMap *map) {
+    if (!queuePush(&pool->retired, map)) {
+        freePooledMap(map);
+        return;
+    }
+    wakeWorker(pool);
+}
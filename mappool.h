@@ -0,0 +1,59 @@
+#ifndef __MAPPOOL_H__
+#define __MAPPOOL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+#include "rng.h"
+#include "region.h"
+#include "autotile.h"
+
+// new maps made ahead of time. a worker thread keeps a few generated,
+// labelled and autotiled maps ready, so asking for the next map is a swap
+// instead of a frame spent generating
+//
+// maps travel from the worker to the game through a single producer, single
+// consumer ring with no locks on it, and the game's old maps travel back the
+// same way for the worker to free. the lock only puts the worker to sleep
+// when there is nothing to do
+//
+// the worker takes seeds from its own copy of the map stream in order, so
+// the game sees the same maps in the same order it would have generated
+
+typedef struct PooledMap {
+    GameMap *game_map;
+    uint64_t seed;
+    MapRegions *regions;     // labelled
+    TileVariants *variants;  // computed for the whole map
+} PooledMap;
+
+typedef struct MapQueue {
+    PooledMap *slots;
+    int capacity;
+    _Atomic size_t head;  // next to take, only moved by the consumer
+    _Atomic size_t tail;  // next to fill, only moved by the producer
+} MapQueue;
+
+typedef struct MapPool {
+    MapGenOptions options;
+    Rng rng;           // the map stream, the worker's from here on
+    MapQueue ready;    // worker to game
+    MapQueue retired;  // game to worker
+
+    pthread_t thread;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;   // the worker has something to do
+    pthread_cond_t added;  // a map is ready
+    atomic_bool stop;
+} MapPool;
+
+MapPool* initMapPool(const MapGenOptions *, const Rng *, int);
+void destroyMapPool(MapPool *);
+bool takePooledMap(MapPool *, PooledMap *, bool);
+void retirePooledMap(MapPool *, PooledMap *);
+void freePooledMap(PooledMap *);
+
+#endif /* __MAPPOOL_H__ */
@@ -0,0 +1,638 @@
+#include "path.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int neighbour_x[8] = { 0, 1, 0, -1, 1, 1, -1, -1 };
+static const int neighbour_y[8] = { -1, 0, 1, 0, -1, 1, 1, -1 };
+
+static inline int sign(int value) {
+    return (value > 0) - (value < 0);
+}
+
+// the cost of the cheapest path between two tiles if nothing was in the way.
+// never more than the real one, which is what keeps A* exact
+static inline uint32_t octile(int dx, int dy) {
+    dx = abs(dx);
+    dy = abs(dy);
+    int diagonal = dx < dy ? dx : dy;
+    return (uint32_t)(PATH_COST_STRAIGHT * (dx + dy)
+                      + (PATH_COST_DIAGONAL - 2 * PATH_COST_STRAIGHT)
+                        * diagonal);
+}
+
+PathFinder* initPathFinder(void) {
+    PathFinder *finder = (PathFinder *)calloc(1, sizeof(PathFinder));
+    if (finder == NULL) {
+        printf("Could not allocate path finder!\n");
+    }
+    return finder;
+}
+
+void destroyPathFinder(PathFinder *finder) {
+    if (finder == NULL) {
+        return;
+    }
+    free(finder->stamp);
+    free(finder->cost);
+    free(finder->score);
+    free(finder->parent);
+    free(finder->heap_slot);
+    free(finder->heap);
+    free(finder);
+}
+
+// sizes the arena for the opacity map's window. only allocates when the
+// window has grown past anything seen before
+static bool reserveFinder(PathFinder *finder, const OpacityMap *opacity) {
+    if (finder->x == opacity->x && finder->y == opacity->y
+        && finder->width == opacity->width
+        && finder->height == opacity->height && finder->stamp != NULL) {
+        return true;
+    }
+
+    size_t cells = (size_t)opacity->width * opacity->height;
+    if (cells > finder->capacity) {
+        uint32_t *stamp =
+            (uint32_t *)realloc(finder->stamp, sizeof(uint32_t) * cells);
+        if (stamp != NULL) {
+            finder->stamp = stamp;
+        }
+        uint32_t *cost =
+            (uint32_t *)realloc(finder->cost, sizeof(uint32_t) * cells);
+        if (cost != NULL) {
+            finder->cost = cost;
+        }
+        uint32_t *score =
+            (uint32_t *)realloc(finder->score, sizeof(uint32_t) * cells);
+        if (score != NULL) {
+            finder->score = score;
+        }
+        int32_t *parent =
+            (int32_t *)realloc(finder->parent, sizeof(int32_t) * cells);
+        if (parent != NULL) {
+            finder->parent = parent;
+        }
+        int32_t *heap_slot =
+            (int32_t *)realloc(finder->heap_slot, sizeof(int32_t) * cells);
+        if (heap_slot != NULL) {
+            finder->heap_slot = heap_slot;
+        }
+        int32_t *heap =
+            (int32_t *)realloc(finder->heap, sizeof(int32_t) * cells);
+        if (heap != NULL) {
+            finder->heap = heap;
+        }
+        if (stamp == NULL || cost == NULL || score == NULL || parent == NULL
+            || heap_slot == NULL || heap == NULL) {
+            printf("Could not allocate path finder for %dx%d tiles!\n",
+                   opacity->width, opacity->height);
+            return false;
+        }
+        finder->capacity = cells;
+    }
+
+    finder->x = opacity->x;
+    finder->y = opacity->y;
+    finder->width = opacity->width;
+    finder->height = opacity->height;
+    memset(finder->stamp, 0, sizeof(uint32_t) * cells);
+    finder->query = 0;
+    return true;
+}
+
+// the open set. a 4-ary heap is shallower than a binary one, and the four
+// children of a node sit next to each other in memory
+static inline bool before(const PathFinder *finder, int32_t a, int32_t b) {
+    // on equal scores, the one further along is likely closer to the goal
+    return finder->score[a] < finder->score[b]
+           || (finder->score[a] == finder->score[b]
+               && finder->cost[a] > finder->cost[b]);
+}
+
+static void heapUp(PathFinder *finder, int slot) {
+    int32_t node = finder->heap[slot];
+    while (slot > 0) {
+        int parent = (slot - 1) / 4;
+        if (!before(finder, node, finder->heap[parent])) {
+            break;
+        }
+        finder->heap[slot] = finder->heap[parent];
+        finder->heap_slot[finder->heap[slot]] = slot;
+        slot = parent;
+    }
+    finder->heap[slot] = node;
+    finder->heap_slot[node] = slot;
+}
+
+static void heapDown(PathFinder *finder, int slot) {
+    int32_t node = finder->heap[slot];
+    for (;;) {
+        int first = slot * 4 + 1;
+        if (first >= finder->heap_count) {
+            break;
+        }
+        int last = first + 4 < finder->heap_count ? first + 4
+                                                  : finder->heap_count;
+        int best = first;
+        for (int child = first + 1; child < last; child++) {
+            if (before(finder, finder->heap[child], finder->heap[best])) {
+                best = child;
+            }
+        }
+        if (!before(finder, finder->heap[best], node)) {
+            break;
+        }
+        finder->heap[slot] = finder->heap[best];
+        finder->heap_slot[finder->heap[slot]] = slot;
+        slot = best;
+    }
+    finder->heap[slot] = node;
+    finder->heap_slot[node] = slot;
+}
+
+static int32_t heapPop(PathFinder *finder) {
+    int32_t node = finder->heap[0];
+    finder->heap_count--;
+    if (finder->heap_count > 0) {
+        finder->heap[0] = finder->heap[finder->heap_count];
+        heapDown(finder, 0);
+    }
+    finder->heap_slot[node] = -1;  // closed
+    return node;
+}
+
+// reaches node at cost from parent. opens it the first time it is seen, and
+// moves it up the heap if this way there is cheaper than the last
+static void reach(PathFinder *finder, int32_t node, uint32_t cost,
+                  int32_t parent, int goal_x, int goal_y) {
+    if (finder->stamp[node] != finder->query) {
+        int x = node % finder->width;
+        int y = node / finder->width;
+        finder->stamp[node] = finder->query;
+        finder->cost[node] = cost;
+        finder->score[node] = cost + octile(goal_x - x, goal_y - y);
+        finder->parent[node] = parent;
+        finder->heap[finder->heap_count] = node;
+        heapUp(finder, finder->heap_count++);
+    }
+    else if (finder->heap_slot[node] >= 0 && cost < finder->cost[node]) {
+        finder->score[node] -= finder->cost[node] - cost;
+        finder->cost[node] = cost;
+        finder->parent[node] = parent;
+        heapUp(finder, finder->heap_slot[node]);
+    }
+}
+
+// coordinates here are local to the window, where opaqueAt wants map ones
+static inline bool blocked(const OpacityMap *opacity, int x, int y) {
+    return opaqueAt(opacity, x + opacity->x, y + opacity->y);
+}
+
+// heads from x, y in direction dx, dy until it finds a tile worth stopping
+// at: the goal, or one with a neighbour only reachable through it (a forced
+// neighbour). going diagonally also stops where a straight scan off to
+// either side would. returns the tile, or -1 on running into a wall
+static int32_t jump(const OpacityMap *opacity, int width, int x, int y,
+                    int dx, int dy, int goal_x, int goal_y) {
+    for (;;) {
+        x += dx;
+        y += dy;
+        if (blocked(opacity, x, y)) {
+            return -1;
+        }
+        if (x == goal_x && y == goal_y) {
+            return (int32_t)(y * width + x);
+        }
+
+        if (dx != 0 && dy != 0) {
+            if ((blocked(opacity, x - dx, y)
+                 && !blocked(opacity, x - dx, y + dy))
+                || (blocked(opacity, x, y - dy)
+                    && !blocked(opacity, x + dx, y - dy))) {
+                return (int32_t)(y * width + x);
+            }
+            if (jump(opacity, width, x, y, dx, 0, goal_x, goal_y) >= 0
+                || jump(opacity, width, x, y, 0, dy, goal_x, goal_y) >= 0) {
+                return (int32_t)(y * width + x);
+            }
+        }
+        else if (dx != 0) {
+            if ((blocked(opacity, x, y + 1) && !blocked(opacity, x + dx, y + 1))
+                || (blocked(opacity, x, y - 1)
+                    && !blocked(opacity, x + dx, y - 1))) {
+                return (int32_t)(y * width + x);
+            }
+        }
+        else {
+            if ((blocked(opacity, x + 1, y) && !blocked(opacity, x + 1, y + dy))
+                || (blocked(opacity, x - 1, y)
+                    && !blocked(opacity, x - 1, y + dy))) {
+                return (int32_t)(y * width + x);
+            }
+        }
+    }
+}
+
+// the jump point successors of node: the directions a path through it could
+// carry on in (all 8 from the start), each followed as far as jump goes
+static void jumpSuccessors(PathFinder *finder, const OpacityMap *opacity,
+                           int32_t node, int goal_x, int goal_y) {
+    int width = finder->width;
+    int x = node % width;
+    int y = node / width;
+    int directions[8][2];
+    int count = 0;
+
+    int32_t parent = finder->parent[node];
+    if (parent < 0) {
+        for (int i = 0; i < 8; i++) {
+            directions[count][0] = neighbour_x[i];
+            directions[count][1] = neighbour_y[i];
+            count++;
+        }
+    }
+    else {
+        int dx = sign(x - parent % width);
+        int dy = sign(y - parent / width);
+        if (dx != 0 && dy != 0) {
+            directions[count][0] = 0;
+            directions[count++][1] = dy;
+            directions[count][0] = dx;
+            directions[count++][1] = 0;
+            directions[count][0] = dx;
+            directions[count++][1] = dy;
+            if (blocked(opacity, x - dx, y)) {
+                directions[count][0] = -dx;
+                directions[count++][1] = dy;
+            }
+            if (blocked(opacity, x, y - dy)) {
+                directions[count][0] = dx;
+                directions[count++][1] = -dy;
+            }
+        }
+        else if (dx != 0) {
+            directions[count][0] = dx;
+            directions[count++][1] = 0;
+            if (blocked(opacity, x, y + 1)) {
+                directions[count][0] = dx;
+                directions[count++][1] = 1;
+            }
+            if (blocked(opacity, x, y - 1)) {
+                directions[count][0] = dx;
+                directions[count++][1] = -1;
+            }
+        }
+        else {
+            directions[count][0] = 0;
+            directions[count++][1] = dy;
+            if (blocked(opacity, x + 1, y)) {
+                directions[count][0] = 1;
+                directions[count++][1] = dy;
+            }
+            if (blocked(opacity, x - 1, y)) {
+                directions[count][0] = -1;
+                directions[count++][1] = dy;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        int32_t next = jump(opacity, width, x, y, directions[i][0],
+                            directions[i][1], goal_x, goal_y);
+        if (next >= 0) {
+            reach(finder, next, finder->cost[node]
+                  + octile(next % width - x, next / width - y),
+                  node, goal_x, goal_y);
+        }
+    }
+}
+
+// finds the shortest path from start_x, start_y to goal_x, goal_y with
+// algorithm (enum pathAlgorithm). writes up to max of its steps to path,
+// not counting the start, and returns how many steps there are in all, or
+// -1 if the goal can't be reached
+int findPath(PathFinder *finder, const OpacityMap *opacity, int algorithm,
+             int start_x, int start_y, int goal_x, int goal_y,
+             PathPoint *path, int max) {
+    if (!opacity->valid || !reserveFinder(finder, opacity)) {
+        return -1;
+    }
+    int width = finder->width;
+    start_x -= finder->x;
+    start_y -= finder->y;
+    goal_x -= finder->x;
+    goal_y -= finder->y;
+    if (start_x < 0 || start_y < 0 || start_x >= width
+        || start_y >= finder->height || blocked(opacity, goal_x, goal_y)) {
+        return -1;
+    }
+    if (start_x == goal_x && start_y == goal_y) {
+        return 0;
+    }
+
+    // a new stamp opens a fresh query without clearing anything, until it
+    // wraps around
+    if (++finder->query == 0) {
+        memset(finder->stamp, 0,
+               sizeof(uint32_t) * (size_t)width * finder->height);
+        finder->query = 1;
+    }
+    finder->heap_count = 0;
+
+    int32_t goal = (int32_t)(goal_y * width + goal_x);
+    reach(finder, (int32_t)(start_y * width + start_x), 0, -1, goal_x, goal_y);
+    bool found = false;
+    while (finder->heap_count > 0) {
+        int32_t node = heapPop(finder);
+        if (node == goal) {
+            found = true;
+            break;
+        }
+        if (algorithm == PATH_JPS) {
+            jumpSuccessors(finder, opacity, node, goal_x, goal_y);
+            continue;
+        }
+
+        int x = node % width;
+        int y = node / width;
+        for (int i = 0; i < 8; i++) {
+            int next_x = x + neighbour_x[i];
+            int next_y = y + neighbour_y[i];
+            if (blocked(opacity, next_x, next_y)) {
+                continue;
+            }
+            reach(finder, (int32_t)(next_y * width + next_x),
+                  finder->cost[node] + (i < 4 ? PATH_COST_STRAIGHT
+                                              : PATH_COST_DIAGONAL),
+                  node, goal_x, goal_y);
+        }
+    }
+    if (!found) {
+        return -1;
+    }
+
+    // every link back towards the start is a straight or diagonal line, one
+    // step long for A*, as far as the jump went for JPS
+    int length = 0;
+    for (int32_t node = goal; finder->parent[node] >= 0;
+         node = finder->parent[node]) {
+        int32_t parent = finder->parent[node];
+        int dx = abs(node % width - parent % width);
+        int dy = abs(node / width - parent / width);
+        length += dx > dy ? dx : dy;
+    }
+
+    int step = length;
+    for (int32_t node = goal; finder->parent[node] >= 0;
+         node = finder->parent[node]) {
+        int32_t parent = finder->parent[node];
+        int x = node % width;
+        int y = node / width;
+        int dx = sign(parent % width - x);
+        int dy = sign(parent / width - y);
+        while (x != parent % width || y != parent / width) {
+            if (step - 1 < max) {
+                path[step - 1].x = x + finder->x;
+                path[step - 1].y = y + finder->y;
+            }
+            step--;
+            x += dx;
+            y += dy;
+        }
+    }
+    return length;
+}
+
+FlowMap* initFlowMap(void) {
+    FlowMap *flow = (FlowMap *)calloc(1, sizeof(FlowMap));
+    if (flow == NULL) {
+        printf("Could not allocate flow map!\n");
+    }
+    return flow;
+}
+
+void destroyFlowMap(FlowMap *flow) {
+    if (flow == NULL) {
+        return;
+    }
+    free(flow->distance);
+    free(flow->queue);
+    free(flow);
+}
+
+// starts a new flow map over the opacity map's window, with no sources yet
+int clearFlowMap(FlowMap *flow, const OpacityMap *opacity) {
+    size_t cells = (size_t)opacity->width * opacity->height;
+    if (cells > flow->capacity) {
+        uint32_t *distance =
+            (uint32_t *)realloc(flow->distance, sizeof(uint32_t) * cells);
+        if (distance != NULL) {
+            flow->distance = distance;
+        }
+        int32_t *queue =
+            (int32_t *)realloc(flow->queue, sizeof(int32_t) * cells);
+        if (queue != NULL) {
+            flow->queue = queue;
+        }
+        if (distance == NULL || queue == NULL) {
+            printf("Could not allocate flow map for %dx%d tiles!\n",
+                   opacity->width, opacity->height);
+            flow->width = 0;
+            flow->queue_count = 0;
+            flow->height = 0;
+            return -1;
+        }
+        flow->capacity = cells;
+    }
+    else if (flow->x == opacity->x && flow->y == opacity->y
+             && flow->width == opacity->width
+             && flow->height == opacity->height) {
+        // the queue holds every tile the last search reached, so putting
+        // just those back costs what the search did, not the whole window
+        for (int i = 0; i < flow->queue_count; i++) {
+            flow->distance[flow->queue[i]] = FLOW_UNREACHABLE;
+        }
+        flow->queue_count = 0;
+        return 0;
+    }
+    flow->x = opacity->x;
+    flow->y = opacity->y;
+    flow->width = opacity->width;
+    flow->height = opacity->height;
+    flow->queue_count = 0;
+    memset(flow->distance, 0xFF, sizeof(uint32_t) * cells);
+    return 0;
+}
+
+// marks the tile at x, y as somewhere to flow towards
+void addFlowSource(FlowMap *flow, int x, int y) {
+    x -= flow->x;
+    y -= flow->y;
+    if (x < 0 || y < 0 || x >= flow->width || y >= flow->height) {
+        return;
+    }
+    size_t node = (size_t)y * flow->width + x;
+    if (flow->distance[node] != 0) {
+        flow->distance[node] = 0;
+        flow->queue[flow->queue_count++] = (int32_t)node;
+    }
+}
+
+// spreads out from every source at once, one step at a time, so each tile
+// ends up with the distance to whichever source is closest. every tile is
+// queued at most once. stops max_distance steps out, when that isn't 0
+void computeFlowMap(FlowMap *flow, const OpacityMap *opacity,
+                    uint32_t max_distance) {
+    int width = flow->width;
+    for (int head = 0; head < flow->queue_count; head++) {
+        int32_t node = flow->queue[head];
+        uint32_t distance = flow->distance[node] + 1;
+        if (max_distance > 0 && distance > max_distance) {
+            continue;
+        }
+        int x = node % width;
+        int y = node / width;
+        for (int i = 0; i < 8; i++) {
+            int next_x = x + neighbour_x[i];
+            int next_y = y + neighbour_y[i];
+            if (blocked(opacity, next_x, next_y)) {
+                continue;
+            }
+            int32_t next = (int32_t)(next_y * width + next_x);
+            if (flow->distance[next] == FLOW_UNREACHABLE) {
+                flow->distance[next] = distance;
+                flow->queue[flow->queue_count++] = next;
+            }
+        }
+    }
+}
+
+// the neighbour of x, y one step closer to a source, straight steps first
+// on ties. false when there is none: x, y is a source, or nothing is
+// reachable from it
+bool flowStep(const FlowMap *flow, const OpacityMap *opacity, int x, int y,
+              int *next_x, int *next_y) {
+    uint32_t best = flowDistance(flow, x, y);
+    bool found = false;
+    for (int i = 0; i < 8; i++) {
+        uint32_t neighbour = flowDistance(flow, x + neighbour_x[i],
+                                          y + neighbour_y[i]);
+        if (neighbour < best
+            && !opaqueAt(opacity, x + neighbour_x[i], y + neighbour_y[i])) {
+            best = neighbour;
+            *next_x = x + neighbour_x[i];
+            *next_y = y + neighbour_y[i];
+            found = true;
+        }
+    }
+    return found;
+}
+
+PathCache* initPathCache(void) {
+    PathCache *cache = (PathCache *)calloc(1, sizeof(PathCache));
+    if (cache == NULL) {
+        printf("Could not allocate path cache!\n");
+    }
+    return cache;
+}
+
+void destroyPathCache(PathCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    for (int i = 0; i < cache->capacity; i++) {
+        free(cache->paths[i].points);
+    }
+    free(cache->paths);
+    free(cache);
+}
+
+// whether the cached path still gets entity from x, y to the goal. moving
+// one step along it is fine
+static bool pathCurrent(CachedPath *path, const OpacityMap *opacity,
+                        Entity entity, int x, int y, int goal_x, int goal_y) {
+    if (!path->valid || path->owner != entity || path->goal_x != goal_x
+        || path->goal_y != goal_y || path->build != opacity->build
+        || path->version != opacity->version) {
+        return false;
+    }
+    if (path->points[path->at].x == x && path->points[path->at].y == y) {
+        return true;
+    }
+    if (path->at + 1 < path->length && path->points[path->at + 1].x == x
+        && path->points[path->at + 1].y == y) {
+        path->at++;
+        return true;
+    }
+    return false;
+}
+
+// the rest of entity's path from x, y to goal_x, goal_y, with its length in
+// length. found again only if the entity strayed from it, the goal moved or
+// the map changed since. NULL if there is no way there
+const PathPoint* pathFor(PathCache *cache, PathFinder *finder,
+                         const OpacityMap *opacity, int algorithm,
+                         Entity entity, int x, int y, int goal_x, int goal_y,
+                         int *length) {
+    *length = 0;
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    if (entity == ENTITY_NONE) {
+        return NULL;
+    }
+    if (slot >= (uint32_t)cache->capacity) {
+        int capacity = cache->capacity > 0 ? cache->capacity * 2 : 64;
+        while ((uint32_t)capacity <= slot) {
+            capacity *= 2;
+        }
+        CachedPath *paths = (CachedPath *)
+            realloc(cache->paths, sizeof(CachedPath) * capacity);
+        if (paths == NULL) {
+            printf("Could not grow path cache to %d entities!\n", capacity);
+            return NULL;
+        }
+        memset(paths + cache->capacity, 0,
+               sizeof(CachedPath) * (capacity - cache->capacity));
+        cache->paths = paths;
+        cache->capacity = capacity;
+    }
+
+    CachedPath *path = &cache->paths[slot];
+    if (!pathCurrent(path, opacity, entity, x, y, goal_x, goal_y)) {
+        path->valid = false;
+        int steps = path->capacity > 0
+            ? findPath(finder, opacity, algorithm, x, y, goal_x, goal_y,
+                       path->points + 1, path->capacity - 1)
+            : findPath(finder, opacity, algorithm, x, y, goal_x, goal_y,
+                       NULL, 0);
+        if (steps < 0) {
+            return NULL;
+        }
+        if (steps + 1 > path->capacity) {
+            // too long for what was there. make room and ask again
+            PathPoint *points = (PathPoint *)
+                realloc(path->points, sizeof(PathPoint) * (steps + 1));
+            if (points == NULL) {
+                printf("Could not allocate a %d step path!\n", steps);
+                return NULL;
+            }
+            path->points = points;
+            path->capacity = steps + 1;
+            findPath(finder, opacity, algorithm, x, y, goal_x, goal_y,
+                     path->points + 1, steps);
+        }
+        path->points[0].x = x;
+        path->points[0].y = y;
+        path->length = steps + 1;
+        path->at = 0;
+        path->owner = entity;
+        path->goal_x = goal_x;
+        path->goal_y = goal_y;
+        path->build = opacity->build;
+        path->version = opacity->version;
+        path->valid = true;
+    }
+
+    *length = path->length - path->at - 1;
+    return path->points + path->at + 1;
+}
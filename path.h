@@ -0,0 +1,116 @@
+#ifndef __PATH_H__
+#define __PATH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "entity.h"
+#include "fov.h"
+
+// getting from one tile to another over the 8-connected grid. anything that
+// blocks sight blocks movement too, so paths are found on the same
+// OpacityMap the field of view uses, and only inside its window
+//
+// PATH_ASTAR and PATH_JPS find the same length shortest paths, with
+// straight steps costing PATH_COST_STRAIGHT and diagonal ones
+// PATH_COST_DIAGONAL. JPS (jump point search) skips over the runs of open
+// tiles that make A* on a grid push so many equivalent nodes. both work out
+// of a PathFinder's arena, sized once for the window, and never allocate
+// during a query
+//
+// a FlowMap is a breadth first search out from any number of sources at
+// once: every tile ends up knowing how many steps it is from the nearest
+// one, so any number of followers path towards them by stepping downhill
+
+enum pathAlgorithm {
+    PATH_ASTAR,
+    PATH_JPS
+};
+
+#define PATH_COST_STRAIGHT 10
+#define PATH_COST_DIAGONAL 14
+#define FLOW_UNREACHABLE 0xFFFFFFFFu
+
+typedef struct PathPoint {
+    int x;
+    int y;
+} PathPoint;
+
+typedef struct PathFinder {
+    // the window of the opacity map the arena was sized for
+    int x;
+    int y;
+    int width;
+    int height;
+    size_t capacity;
+
+    // per tile of the window. a tile belongs to the current query only when
+    // its stamp matches, so nothing needs clearing between queries
+    uint32_t *stamp;
+    uint32_t *cost;     // from the start
+    uint32_t *score;    // cost plus the estimate to the goal
+    int32_t *parent;    // tile index, -1 for the start
+    int32_t *heap_slot; // where the tile sits in the heap, -1 once closed
+    uint32_t query;
+
+    // the open set, a 4-ary heap of tile indices ordered by score
+    int32_t *heap;
+    int heap_count;
+} PathFinder;
+
+typedef struct FlowMap {
+    int x;
+    int y;
+    int width;
+    int height;
+    size_t capacity;
+    uint32_t *distance;  // steps to the nearest source, FLOW_UNREACHABLE
+    int32_t *queue;      // breadth first search scratch
+    int queue_count;
+} FlowMap;
+
+typedef struct CachedPath {
+    Entity owner;
+    int goal_x;
+    int goal_y;
+    uint64_t build;    // of the opacity map the path was found on
+    uint64_t version;
+    PathPoint *points; // points[0] is where it started
+    int length;
+    int capacity;
+    int at;            // index of the point the entity is at
+    bool valid;
+} CachedPath;
+
+typedef struct PathCache {
+    CachedPath *paths;  // per entity handle slot
+    int capacity;
+} PathCache;
+
+PathFinder* initPathFinder(void);
+void destroyPathFinder(PathFinder *);
+int findPath(PathFinder *, const OpacityMap *, int, int, int, int, int,
+             PathPoint *, int);
+
+FlowMap* initFlowMap(void);
+void destroyFlowMap(FlowMap *);
+int clearFlowMap(FlowMap *, const OpacityMap *);
+void addFlowSource(FlowMap *, int, int);
+void computeFlowMap(FlowMap *, const OpacityMap *, uint32_t);
+bool flowStep(const FlowMap *, const OpacityMap *, int, int, int *, int *);
+
+PathCache* initPathCache(void);
+void destroyPathCache(PathCache *);
+const PathPoint* pathFor(PathCache *, PathFinder *, const OpacityMap *, int,
+                         Entity, int, int, int, int, int *);
+
+// steps from the nearest source to the tile at x, y
+static inline uint32_t flowDistance(const FlowMap *flow, int x, int y) {
+    x -= flow->x;
+    y -= flow->y;
+    if (x < 0 || y < 0 || x >= flow->width || y >= flow->height) {
+        return FLOW_UNREACHABLE;
+    }
+    return flow->distance[(size_t)y * flow->width + x];
+}
+
+#endif /* __PATH_H__ */
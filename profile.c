@@ -0,0 +1,327 @@
+#include "profile.h"
+
+#ifdef YARZ_PROFILE
+
+#include "SDL2/SDL.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ProfileEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+} ProfileEvent;
+
+typedef struct ProfileRing {
+    ProfileEvent events[PROFILE_RING_SIZE];
+    _Atomic uint64_t head;  // events ever recorded, only moved by the owner
+    _Atomic uint64_t counters[PROFILE_COUNTERS];
+    atomic_bool claimed;    // a live thread records here
+} ProfileRing;
+
+// a zone's time on the main thread, for the HUD
+typedef struct ProfileZone {
+    const char *name;
+    double last;     // seconds, in the last frame
+    double average;  // seconds, smoothed over the last few frames
+} ProfileZone;
+
+// static, so that claiming a ring never allocates (which would count itself
+// as an allocation). a thread's ring goes back to the pool when it exits, so
+// the short lived generation threads don't run out the rings
+static ProfileRing rings[PROFILE_MAX_THREADS];
+static _Thread_local ProfileRing *thread_ring;
+static _Thread_local bool thread_unrecorded;  // found every ring taken
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static uint64_t profile_base;  // traces start from here
+
+// only ever touched by the main thread, from profileFrame and the HUD
+static struct {
+    double seconds[PROFILE_HISTORY];
+    uint64_t counters[PROFILE_HISTORY][PROFILE_COUNTERS];
+    int next;
+    int count;
+    uint64_t totals[PROFILE_COUNTERS];  // every ring's counters, last frame
+    ProfileZone zones[PROFILE_MAX_ZONES];
+    int zone_count;
+    bool hud;
+} history;
+
+uint64_t profileNow(void) {
+    return SDL_GetPerformanceCounter();
+}
+
+static void releaseRing(void *ring) {
+    atomic_store(&((ProfileRing *)ring)->claimed, false);
+}
+
+static void createRingKey(void) {
+    pthread_key_create(&ring_key, releaseRing);
+    profile_base = profileNow();
+}
+
+// the calling thread's ring, claimed the first time it records anything.
+// NULL if there were none left
+static ProfileRing* threadRing(void) {
+    if (thread_ring != NULL || thread_unrecorded) {
+        return thread_ring;
+    }
+    pthread_once(&ring_once, createRingKey);
+    for (int i = 0; i < PROFILE_MAX_THREADS; i++) {
+        bool unclaimed = false;
+        if (atomic_compare_exchange_strong(&rings[i].claimed, &unclaimed,
+                                           true)) {
+            thread_ring = &rings[i];
+            pthread_setspecific(ring_key, thread_ring);
+            return thread_ring;
+        }
+    }
+    thread_unrecorded = true;
+    return NULL;
+}
+
+// the event is written before the new head is published, so a reader never
+// counts one that is half written
+void profileRecord(const char *name, uint64_t start, uint64_t end) {
+    ProfileRing *ring = threadRing();
+    if (ring == NULL) {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ProfileEvent *event = &ring->events[head & (PROFILE_RING_SIZE - 1)];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// only the owner writes its counters, so there's no need for an atomic add
+void profileCount(int counter, uint64_t count) {
+    ProfileRing *ring = threadRing();
+    if (ring == NULL) {
+        return;
+    }
+    uint64_t value = atomic_load_explicit(&ring->counters[counter],
+                                          memory_order_relaxed);
+    atomic_store_explicit(&ring->counters[counter], value + count,
+                          memory_order_relaxed);
+}
+
+// copies whatever ring still holds into events, oldest first, and returns
+// how many. the owner keeps recording while we copy, so anything it may have
+// lapped in the meantime is dropped
+static int copyRing(ProfileRing *ring, ProfileEvent *events) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t first = head > PROFILE_RING_SIZE ? head - PROFILE_RING_SIZE : 0;
+    for (uint64_t i = first; i < head; i++) {
+        events[i - first] = ring->events[i & (PROFILE_RING_SIZE - 1)];
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    // the event being written now goes over the one PROFILE_RING_SIZE back
+    uint64_t after = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t safe = after + 1 > PROFILE_RING_SIZE
+                    ? after + 1 - PROFILE_RING_SIZE : 0;
+    if (safe <= first) {
+        return (int)(head - first);
+    }
+    if (safe >= head) {
+        return 0;
+    }
+    memmove(events, events + (safe - first),
+            sizeof(ProfileEvent) * (head - safe));
+    return (int)(head - safe);
+}
+
+static ProfileZone* findZone(const char *name) {
+    for (int i = 0; i < history.zone_count; i++) {
+        if (history.zones[i].name == name
+            || strcmp(history.zones[i].name, name) == 0) {
+            return &history.zones[i];
+        }
+    }
+    if (history.zone_count == PROFILE_MAX_ZONES) {
+        return NULL;
+    }
+    ProfileZone *zone = &history.zones[history.zone_count++];
+    zone->name = name;
+    zone->last = 0;
+    zone->average = 0;
+    return zone;
+}
+
+// ends the frame that started at start (a zone of its own) and files it
+// away for the HUD. must be called on the main thread
+void profileFrame(const char *name, uint64_t start) {
+    uint64_t end = profileNow();
+    profileRecord(name, start, end);
+    double frequency = (double)SDL_GetPerformanceFrequency();
+
+    int slot = history.next;
+    history.seconds[slot] = (end - start) / frequency;
+    for (int counter = 0; counter < PROFILE_COUNTERS; counter++) {
+        uint64_t total = 0;
+        for (int i = 0; i < PROFILE_MAX_THREADS; i++) {
+            total += atomic_load_explicit(&rings[i].counters[counter],
+                                          memory_order_relaxed);
+        }
+        history.counters[slot][counter] = total - history.totals[counter];
+        history.totals[counter] = total;
+    }
+    history.next = (slot + 1) % PROFILE_HISTORY;
+    if (history.count < PROFILE_HISTORY) {
+        history.count++;
+    }
+
+    // this thread's own ring, so nothing is written behind our back. zones
+    // that ended during the frame count towards it
+    for (int i = 0; i < history.zone_count; i++) {
+        history.zones[i].last = 0;
+    }
+    ProfileRing *ring = threadRing();
+    uint64_t head = ring != NULL ? atomic_load(&ring->head) : 0;
+    uint64_t oldest = head > PROFILE_RING_SIZE ? head - PROFILE_RING_SIZE : 0;
+    for (uint64_t i = head; i > oldest; i--) {
+        ProfileEvent *event = &ring->events[(i - 1) & (PROFILE_RING_SIZE - 1)];
+        if (event->end < start) {
+            break;
+        }
+        if (event->name == name) {
+            continue;  // the frame itself
+        }
+        ProfileZone *zone = findZone(event->name);
+        if (zone != NULL) {
+            zone->last += (event->end - event->start) / frequency;
+        }
+    }
+    for (int i = 0; i < history.zone_count; i++) {
+        history.zones[i].average =
+            history.zones[i].average * 0.9 + history.zones[i].last * 0.1;
+    }
+}
+
+void toggleProfileHud(void) {
+    history.hud = !history.hud;
+}
+
+bool profileHudShown(void) {
+    return history.hud;
+}
+
+// fills in the HUD for the frames so far: text with the last frame's counts
+// and the main thread's zones, and a bar per frame (up to max) across graph,
+// oldest on the left, full height being two 60 Hz frames. budget becomes a
+// line across the graph at one 60 Hz frame. returns how many bars
+int profileHud(char *text, size_t size, SDL_Rect *bars, int max,
+               SDL_Rect *budget, const SDL_Rect *graph) {
+    const double full = 2.0 / 60.0;
+    int count = history.count < max ? history.count : max;
+    int bar_width = graph->w / PROFILE_HISTORY > 1
+                    ? graph->w / PROFILE_HISTORY : 1;
+    double worst = 0;
+    for (int i = 0; i < count; i++) {
+        int slot = (history.next - count + i + PROFILE_HISTORY)
+                   % PROFILE_HISTORY;
+        double seconds = history.seconds[slot];
+        if (seconds > worst) {
+            worst = seconds;
+        }
+        int height = seconds >= full ? graph->h
+                     : (int)(seconds / full * graph->h + 0.5);
+        bars[i] = (SDL_Rect){
+            .x = graph->x + graph->w - (count - i) * bar_width,
+            .y = graph->y + graph->h - height,
+            .w = bar_width, .h = height };
+    }
+    *budget = (SDL_Rect){ .x = graph->x, .y = graph->y + graph->h / 2,
+                          .w = graph->w, .h = 1 };
+
+    int last = (history.next - 1 + PROFILE_HISTORY) % PROFILE_HISTORY;
+    int length = snprintf(text, size,
+        "frame %6.2f ms (worst %.2f)\n"
+        "blits %6llu allocs %llu\n",
+        history.count > 0 ? history.seconds[last] * 1000.0 : 0.0,
+        worst * 1000.0,
+        history.count > 0
+        ? (unsigned long long)history.counters[last][PROFILE_BLITS] : 0ull,
+        history.count > 0
+        ? (unsigned long long)history.counters[last][PROFILE_ALLOCATIONS]
+        : 0ull);
+    for (int i = 0; i < history.zone_count && length >= 0
+                    && (size_t)length < size; i++) {
+        length += snprintf(text + length, size - length, "%-14s %6.2f ms\n",
+                           history.zones[i].name,
+                           history.zones[i].average * 1000.0);
+    }
+    return count;
+}
+
+// writes everything still in the rings to path as a Chrome trace, for
+// chrome://tracing or Perfetto. each ring is a thread. returns 0 on success
+int writeProfileTrace(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        printf("Could not write profile trace %s!\n", path);
+        return -1;
+    }
+    ProfileEvent *events =
+        (ProfileEvent *)malloc(sizeof(ProfileEvent) * PROFILE_RING_SIZE);
+    if (events == NULL) {
+        printf("Could not allocate space for the profile trace!\n");
+        fclose(out);
+        return -1;
+    }
+
+    double to_us = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+    int written = 0;
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (int thread = 0; thread < PROFILE_MAX_THREADS; thread++) {
+        int count = copyRing(&rings[thread], events);
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                    "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    written > 0 ? "," : "", events[i].name, thread,
+                    (double)(int64_t)(events[i].start - profile_base) * to_us,
+                    (double)(events[i].end - events[i].start) * to_us);
+            written++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    free(events);
+
+    if (fclose(out) != 0) {
+        printf("Could not write profile trace %s!\n", path);
+        return -1;
+    }
+    printf("Wrote %d profiled events to %s\n", written, path);
+    return 0;
+}
+
+#ifdef YARZ_PROFILE_ALLOCATIONS
+// linked with --wrap=malloc and friends (see the Makefile), every allocation
+// the game makes comes through here first. SDL's own don't
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void *, size_t);
+
+void* __wrap_malloc(size_t size) {
+    profileCount(PROFILE_ALLOCATIONS, 1);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    profileCount(PROFILE_ALLOCATIONS, 1);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void *data, size_t size) {
+    profileCount(PROFILE_ALLOCATIONS, 1);
+    return __real_realloc(data, size);
+}
+#endif /* YARZ_PROFILE_ALLOCATIONS */
+
+#endif /* YARZ_PROFILE */
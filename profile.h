@@ -0,0 +1,75 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the built in profiler. it is only there in builds with YARZ_PROFILE
+// defined (see the Makefile). without it, every macro below is empty and
+// every function does nothing, so release builds carry none of it
+//
+// code marks the stretches it wants timed with PROFILE_BEGIN(zone) and
+// PROFILE_END(zone) in the same block, zone being a plain name, and counts
+// things with PROFILE_COUNT. each thread records into a ring of its own, so
+// recording takes no locks and never waits on another thread. readers (the
+// HUD and the trace dump, on the main thread) copy out of the rings and throw
+// away whatever was overwritten while they copied
+//
+// the game loop ends every frame with PROFILE_END_FRAME, which keeps the last
+// PROFILE_HISTORY frames for the HUD: how long each took, what was counted
+// during it and how long the main thread spent in each zone
+
+#define PROFILE_HISTORY 120
+#define PROFILE_RING_SIZE 4096  // events kept per thread, a power of two
+#define PROFILE_MAX_THREADS 64  // more than this at once go unrecorded
+#define PROFILE_MAX_ZONES 16    // the HUD shows this many at most
+
+enum profileCounter {
+    PROFILE_BLITS,
+    PROFILE_ALLOCATIONS,  // only counted when built with YARZ_PROFILE_ALLOCATIONS
+    PROFILE_COUNTERS
+};
+
+struct SDL_Rect;
+
+#ifdef YARZ_PROFILE
+
+#define PROFILE_BEGIN(zone) uint64_t profile_##zone = profileNow()
+#define PROFILE_END(zone) profileRecord(#zone, profile_##zone, profileNow())
+#define PROFILE_END_FRAME(zone) profileFrame(#zone, profile_##zone)
+#define PROFILE_COUNT(counter, n) profileCount(counter, n)
+
+uint64_t profileNow(void);
+void profileRecord(const char *, uint64_t, uint64_t);
+void profileCount(int, uint64_t);
+void profileFrame(const char *, uint64_t);
+void toggleProfileHud(void);
+bool profileHudShown(void);
+int profileHud(char *, size_t, struct SDL_Rect *, int, struct SDL_Rect *,
+               const struct SDL_Rect *);
+int writeProfileTrace(const char *);
+
+#else
+
+#define PROFILE_BEGIN(zone)
+#define PROFILE_END(zone)
+#define PROFILE_END_FRAME(zone)
+#define PROFILE_COUNT(counter, n)
+
+static inline void toggleProfileHud(void) {}
+static inline bool profileHudShown(void) { return false; }
+static inline int profileHud(char *text, size_t size, struct SDL_Rect *bars,
+                             int max, struct SDL_Rect *budget,
+                             const struct SDL_Rect *area) {
+    (void)text; (void)size; (void)bars; (void)max; (void)budget; (void)area;
+    return 0;
+}
+static inline int writeProfileTrace(const char *path) {
+    (void)path;
+    return -1;
+}
+
+#endif /* YARZ_PROFILE */
+
+#endif /* __PROFILE_H__ */
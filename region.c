@@ -0,0 +1,576 @@
+#include "region.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// no point in bands thinner than this many rows
+#define REGION_MIN_BAND 64
+
+// how many random tiles of a region's bounding box regionRandomTile tries
+// before walking the region's runs instead
+#define REGION_RANDOM_TRIES 32
+
+static inline int lowestBit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline int countBits(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    int count = 0;
+    for (; word != 0; word &= word - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+MapRegions* initMapRegions(void) {
+    MapRegions *regions = (MapRegions *)calloc(1, sizeof(MapRegions));
+    if (regions == NULL) {
+        printf("Could not allocate map regions!\n");
+        return NULL;
+    }
+    regions->largest = -1;
+    return regions;
+}
+
+void destroyMapRegions(MapRegions *regions) {
+    if (regions == NULL) {
+        return;
+    }
+    free(regions->row_first);
+    free(regions->run_x);
+    free(regions->run_length);
+    free(regions->run_region);
+    free(regions->region_size);
+    free(regions->region_run);
+    free(regions->region_left);
+    free(regions->region_top);
+    free(regions->region_right);
+    free(regions->region_bottom);
+    free(regions);
+}
+
+// reallocs *array to hold count items of size bytes. leaves it alone if that
+// fails
+static bool growArray(void **array, size_t size, int count) {
+    void *grown = realloc(*array, size * (size_t)count);
+    if (grown == NULL) {
+        return false;
+    }
+    *array = grown;
+    return true;
+}
+
+// the root of run's group. parents always have lower indices than their
+// children, which the second labelling pass depends on
+static int32_t findRoot(int32_t *parent, int32_t run) {
+    while (parent[run] != run) {
+        parent[run] = parent[parent[run]];
+        run = parent[run];
+    }
+    return run;
+}
+
+static void unite(int32_t *parent, int32_t a, int32_t b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    }
+    else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// packs the floor tiles of row y into bits, one per tile. bits past the
+// width stay clear
+static void packRow(const GameMap *game_map, int y, uint64_t *bits,
+                    int words) {
+    const MapCell *cells = mapRow(game_map, y);
+    int width = game_map->width;
+    memset(bits, 0, sizeof(uint64_t) * words);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        bits[x / 64] |= (uint64_t)mapFloorBits8(cells + x) << (x % 64);
+    }
+    for (; x < width; x++) {
+        bits[x / 64] |=
+            (uint64_t)((cells[x] & MAP_TILE_MASK) == MAP_FLOOR) << (x % 64);
+    }
+}
+
+// a run starts on floor with wall (or the edge) to its left and ends on
+// floor with wall to its right, so both are a shift and an and-not a word
+static inline uint64_t runStarts(const uint64_t *bits, int word) {
+    uint64_t left = word > 0 ? bits[word - 1] >> 63 : 0;
+    return bits[word] & ~(bits[word] << 1 | left);
+}
+
+static inline uint64_t runEnds(const uint64_t *bits, int word, int words) {
+    uint64_t right = word + 1 < words ? bits[word + 1] << 63 : 0;
+    return bits[word] & ~(bits[word] >> 1 | right);
+}
+
+// joins the runs of two neighbouring rows wherever they touch
+static void joinRows(MapRegions *regions, int above, int below) {
+    int32_t k = regions->row_first[above];
+    int32_t above_last = regions->row_first[above + 1];
+    for (int32_t run = regions->row_first[below];
+         run < regions->row_first[below + 1]; run++) {
+        int start = regions->run_x[run];
+        int end = start + regions->run_length[run];
+        while (k < above_last
+               && regions->run_x[k] + regions->run_length[k] < start) {
+            k++;
+        }
+        for (int32_t other = k;
+             other < above_last && regions->run_x[other] <= end; other++) {
+            unite(regions->run_region, other, run);
+        }
+    }
+}
+
+typedef struct RegionBand {
+    MapRegions *regions;
+    const GameMap *game_map;
+    int first;  // rows
+    int last;
+    bool count;  // counting runs, or cutting them
+    uint64_t *bits;
+    int words;
+} RegionBand;
+
+// counts the runs of each row of a band into row_first[y + 1], so the
+// prefix sum over them gives every row its place before any runs are cut
+static void countBand(RegionBand *band) {
+    for (int y = band->first; y < band->last; y++) {
+        packRow(band->game_map, y, band->bits, band->words);
+        int count = 0;
+        for (int word = 0; word < band->words; word++) {
+            count += countBits(runStarts(band->bits, word));
+        }
+        band->regions->row_first[y + 1] = count;
+    }
+}
+
+// the first labelling pass over a band: cuts its rows into runs and joins
+// each with the runs above it that it touches. the band's first row is left
+// for the seams
+static void cutBand(RegionBand *band) {
+    MapRegions *regions = band->regions;
+    int32_t *parent = regions->run_region;
+    int32_t above = 0;
+    int32_t above_last = 0;
+    for (int y = band->first; y < band->last; y++) {
+        packRow(band->game_map, y, band->bits, band->words);
+        int32_t run = regions->row_first[y];
+        int word = -1;
+        uint64_t starts = 0;
+        int end_word = -1;
+        uint64_t ends = 0;
+        for (;;) {
+            while (starts == 0 && ++word < band->words) {
+                starts = runStarts(band->bits, word);
+            }
+            if (starts == 0) {
+                break;
+            }
+            while (ends == 0 && ++end_word < band->words) {
+                ends = runEnds(band->bits, end_word, band->words);
+            }
+            int start = word * 64 + lowestBit(starts);
+            int end = end_word * 64 + lowestBit(ends) + 1;
+            starts &= starts - 1;
+            ends &= ends - 1;
+            regions->run_x[run] = start;
+            regions->run_length[run] = end - start;
+
+            // the new run is a group of its own until it touches one above.
+            // after that, only a second group it touches needs joining
+            int32_t root = run;
+            parent[run] = run;
+            while (above < above_last
+                   && regions->run_x[above] + regions->run_length[above]
+                      < start) {
+                above++;
+            }
+            for (int32_t k = above;
+                 k < above_last && regions->run_x[k] <= end; k++) {
+                int32_t other = findRoot(parent, k);
+                if (other < root) {
+                    parent[root] = other;
+                    root = other;
+                }
+                else if (other > root) {
+                    parent[other] = root;
+                }
+            }
+            run++;
+        }
+        above = regions->row_first[y];
+        above_last = regions->row_first[y + 1];
+    }
+}
+
+static void* regionBandWorker(void *data) {
+    RegionBand *band = (RegionBand *)data;
+    if (band->count) {
+        countBand(band);
+    }
+    else {
+        cutBand(band);
+    }
+    return NULL;
+}
+
+// runs every band, the calling thread taking the first and any whose thread
+// wouldn't start
+static void runBands(RegionBand *bands, int count, bool counting) {
+    pthread_t thread_list[count];
+    bool started[count];
+    for (int i = 0; i < count; i++) {
+        bands[i].count = counting;
+        started[i] = i > 0 && pthread_create(&thread_list[i], NULL,
+                                             regionBandWorker,
+                                             &bands[i]) == 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!started[i]) {
+            regionBandWorker(&bands[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (started[i]) {
+            pthread_join(thread_list[i], NULL);
+        }
+    }
+}
+
+// labels every floor tile of game_map with its region, using up to threads
+// threads. returns how many regions there are, or -1 if game_map can't be
+// labelled
+int labelRegions(MapRegions *regions, const GameMap *game_map, int threads) {
+    regions->valid = false;
+    regions->largest = -1;
+    regions->region_count = 0;
+    if (game_map->chunks != NULL) {
+        return -1;
+    }
+    int width = game_map->width;
+    int height = game_map->height;
+    int words = (width + 63) / 64;
+    if (height + 1 > regions->row_capacity) {
+        if (!growArray((void **)&regions->row_first, sizeof(int32_t),
+                       height + 1)) {
+            printf("Could not allocate map regions for %d rows!\n", height);
+            return -1;
+        }
+        regions->row_capacity = height + 1;
+    }
+    regions->width = width;
+    regions->height = height;
+
+    int band_count = threads < 1 ? 1 : threads;
+    if (band_count > height / REGION_MIN_BAND) {
+        band_count = height / REGION_MIN_BAND > 0 ? height / REGION_MIN_BAND
+                                                  : 1;
+    }
+    uint64_t *bits =
+        (uint64_t *)malloc(sizeof(uint64_t) * (size_t)words * band_count);
+    if (bits == NULL && words > 0) {
+        printf("Could not allocate map regions for %d columns!\n", width);
+        return -1;
+    }
+    RegionBand bands[band_count];
+    for (int i = 0; i < band_count; i++) {
+        bands[i] = (RegionBand){ .regions = regions, .game_map = game_map,
+                                 .first = (int)((int64_t)height * i
+                                                / band_count),
+                                 .last = (int)((int64_t)height * (i + 1)
+                                               / band_count),
+                                 .bits = bits + (size_t)words * i,
+                                 .words = words };
+    }
+
+    runBands(bands, band_count, true);
+    regions->row_first[0] = 0;
+    for (int y = 0; y < height; y++) {
+        regions->row_first[y + 1] += regions->row_first[y];
+    }
+    int runs = regions->row_first[height];
+    if (runs > regions->run_capacity) {
+        if (!growArray((void **)&regions->run_x, sizeof(int32_t), runs)
+            || !growArray((void **)&regions->run_length, sizeof(int32_t), runs)
+            || !growArray((void **)&regions->run_region, sizeof(int32_t),
+                          runs)) {
+            printf("Could not allocate map regions for %d runs!\n", runs);
+            free(bits);
+            return -1;
+        }
+        regions->run_capacity = runs;
+    }
+    regions->run_count = runs;
+    runBands(bands, band_count, false);
+    free(bits);
+    for (int i = 1; i < band_count; i++) {
+        joinRows(regions, bands[i].first - 1, bands[i].first);
+    }
+
+    // second pass: roots come before the rest of their group, so by the time
+    // a run is reached its parent already holds the group's region ID
+    int count = 0;
+    int32_t *label = regions->run_region;
+    for (int32_t run = 0; run < runs; run++) {
+        label[run] = label[run] == run ? count++ : label[label[run]];
+    }
+
+    if (count > regions->region_capacity) {
+        if (!growArray((void **)&regions->region_size, sizeof(int32_t), count)
+            || !growArray((void **)&regions->region_run, sizeof(int32_t),
+                          count)
+            || !growArray((void **)&regions->region_left, sizeof(int32_t),
+                          count)
+            || !growArray((void **)&regions->region_top, sizeof(int32_t),
+                          count)
+            || !growArray((void **)&regions->region_right, sizeof(int32_t),
+                          count)
+            || !growArray((void **)&regions->region_bottom, sizeof(int32_t),
+                          count)) {
+            printf("Could not allocate %d map regions!\n", count);
+            return -1;
+        }
+        regions->region_capacity = count;
+    }
+
+    // a region's first run is its root, and also where its box starts
+    int next = 0;
+    for (int y = 0; y < height; y++) {
+        for (int32_t run = regions->row_first[y];
+             run < regions->row_first[y + 1]; run++) {
+            int region = label[run];
+            int left = regions->run_x[run];
+            int right = left + regions->run_length[run] - 1;
+            if (region == next) {
+                regions->region_size[region] = 0;
+                regions->region_run[region] = run;
+                regions->region_left[region] = left;
+                regions->region_top[region] = y;
+                regions->region_right[region] = right;
+                next++;
+            }
+            regions->region_size[region] += regions->run_length[run];
+            regions->region_bottom[region] = y;
+            if (left < regions->region_left[region]) {
+                regions->region_left[region] = left;
+            }
+            if (right > regions->region_right[region]) {
+                regions->region_right[region] = right;
+            }
+        }
+    }
+    for (int region = 0; region < count; region++) {
+        if (regions->largest < 0 || regions->region_size[region]
+                                    > regions->region_size[regions->largest]) {
+            regions->largest = region;
+        }
+    }
+
+    regions->region_count = count;
+    regions->valid = true;
+    return count;
+}
+
+// the run of row y that holds x, or -1 if x, y isn't floor
+static int32_t runAt(const MapRegions *regions, int x, int y) {
+    int32_t low = regions->row_first[y];
+    int32_t high = regions->row_first[y + 1] - 1;
+    while (low < high) {
+        int32_t middle = (low + high + 1) / 2;
+        if (regions->run_x[middle] <= x) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    if (low > high || x < regions->run_x[low]
+        || x >= regions->run_x[low] + regions->run_length[low]) {
+        return -1;
+    }
+    return low;
+}
+
+// the region of the tile at x, y, or -1 for anything that isn't floor
+int regionAt(const MapRegions *regions, int x, int y) {
+    if (!regions->valid || x < 0 || y < 0 || x >= regions->width
+        || y >= regions->height) {
+        return -1;
+    }
+    int32_t run = runAt(regions, x, y);
+    return run >= 0 ? regions->run_region[run] : -1;
+}
+
+// picks a tile of region at random. false if the region doesn't exist
+bool regionRandomTile(const MapRegions *regions, int region, Rng *rng,
+                      int *x, int *y) {
+    if (!regions->valid || region < 0 || region >= regions->region_count) {
+        return false;
+    }
+    // caves mostly fill their boxes well enough that a few guesses do
+    for (int tries = 0; tries < REGION_RANDOM_TRIES; tries++) {
+        int tile_x = rngRange(rng, regions->region_left[region],
+                              regions->region_right[region]);
+        int tile_y = rngRange(rng, regions->region_top[region],
+                              regions->region_bottom[region]);
+        if (regionAt(regions, tile_x, tile_y) == region) {
+            *x = tile_x;
+            *y = tile_y;
+            return true;
+        }
+    }
+
+    // a thin diagonal sliver might not. count that many tiles in instead
+    int32_t tile = (int32_t)rngRange(rng, 0, regions->region_size[region] - 1);
+    for (int row = regions->region_top[region];
+         row <= regions->region_bottom[region]; row++) {
+        for (int32_t run = row == regions->region_top[region]
+                           ? regions->region_run[region]
+                           : regions->row_first[row];
+             run < regions->row_first[row + 1]; run++) {
+            if (regions->run_region[run] != region) {
+                continue;
+            }
+            if (tile < regions->run_length[run]) {
+                *x = regions->run_x[run] + tile;
+                *y = row;
+                return true;
+            }
+            tile -= regions->run_length[run];
+        }
+    }
+    return false;
+}
+
+typedef struct RegionSeed {
+    uint64_t key;
+    int x;
+    int y;
+} RegionSeed;
+
+// interleaves the bits of x and y, so that sorting by it keeps tiles that
+// are close together close together
+static uint64_t mortonKey(uint32_t x, uint32_t y) {
+    uint64_t key = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        key |= (uint64_t)((x >> bit) & 1) << (bit * 2);
+        key |= (uint64_t)((y >> bit) & 1) << (bit * 2 + 1);
+    }
+    return key;
+}
+
+static int compareSeeds(const void *a, const void *b) {
+    uint64_t key_a = ((const RegionSeed *)a)->key;
+    uint64_t key_b = ((const RegionSeed *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+// digs from x, y to to_x, to_y, diagonally while both are off and straight
+// after. a diagonal step takes a side step with it, so the corridor never
+// has to squeeze between two corners
+static void tunnel(GameMap *game_map, int x, int y, int to_x, int to_y) {
+    while (x != to_x || y != to_y) {
+        int dx = (to_x > x) - (to_x < x);
+        int dy = (to_y > y) - (to_y < y);
+        if (dx != 0 && dy != 0) {
+            mapSet(game_map, x + dx, y, MAP_FLOOR);
+        }
+        x += dx;
+        y += dy;
+        mapSet(game_map, x, y, MAP_FLOOR);
+    }
+}
+
+// makes every floor tile of game_map reachable from every other, how given
+// by connectivity (enum mapConnectivity). MAP_CONNECT_CULL fills in all but
+// the largest region. MAP_CONNECT_TUNNEL fills in the specks smaller than
+// REGION_MIN_SIZE and digs the rest together, each to the next one along a
+// Z-order curve so tunnels stay short. regions needs labelling again after.
+// returns how many regions were filled or joined, or -1 on failure
+int repairRegions(MapRegions *regions, GameMap *game_map, int connectivity,
+                  int threads) {
+    if (connectivity == MAP_CONNECT_NONE) {
+        return 0;
+    }
+    int count = labelRegions(regions, game_map, threads);
+    if (count <= 1) {
+        return count < 0 ? -1 : 0;
+    }
+
+    RegionSeed *seeds = NULL;
+    if (connectivity == MAP_CONNECT_TUNNEL) {
+        seeds = (RegionSeed *)malloc(sizeof(RegionSeed) * count);
+        if (seeds == NULL) {
+            printf("Could not allocate tunnels for %d regions!\n", count);
+            return -1;
+        }
+    }
+
+    // region_size doubles as the fill-in mark: 0 for regions to fill
+    int changed = 0;
+    int kept = 0;
+    for (int region = 0; region < count; region++) {
+        if (region != regions->largest
+            && (seeds == NULL
+                || regions->region_size[region] < REGION_MIN_SIZE)) {
+            regions->region_size[region] = 0;
+            changed++;
+        }
+        else if (seeds != NULL) {
+            // the middle of the region's topmost run
+            int32_t run = regions->region_run[region];
+            RegionSeed *seed = &seeds[kept++];
+            seed->x = regions->run_x[run] + regions->run_length[run] / 2;
+            seed->y = regions->region_top[region];
+            seed->key = mortonKey((uint32_t)seed->x, (uint32_t)seed->y);
+        }
+    }
+    for (int y = 0; changed > 0 && y < regions->height; y++) {
+        MapCell *cells = mapRow(game_map, y);
+        for (int32_t run = regions->row_first[y];
+             run < regions->row_first[y + 1]; run++) {
+            if (regions->region_size[regions->run_region[run]] == 0) {
+                for (int x = regions->run_x[run];
+                     x < regions->run_x[run] + regions->run_length[run]; x++) {
+                    cells[x] = (MapCell)((cells[x] & MAP_FLAG_MASK)
+                                         | MAP_WALL);
+                }
+            }
+        }
+    }
+
+    if (seeds != NULL) {
+        qsort(seeds, kept, sizeof(RegionSeed), compareSeeds);
+        for (int i = 1; i < kept; i++) {
+            tunnel(game_map, seeds[i - 1].x, seeds[i - 1].y, seeds[i].x,
+                   seeds[i].y);
+            changed++;
+        }
+        free(seeds);
+    }
+
+    regions->valid = false;
+    return changed;
+}
@@ -0,0 +1,58 @@
+#ifndef __REGION_H__
+#define __REGION_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+#include "rng.h"
+
+// which floor tiles can reach which. a region is a group of floor tiles
+// connected the way entities move, diagonals included
+//
+// labelling works on runs of floor rather than tiles: each row is packed into
+// bits and cut into runs, every run is joined (union-find) with the runs of
+// the row above that it touches, and a second pass over the runs gives each
+// group its region ID. that is linear in the number of runs, and a cave has
+// far fewer runs than tiles. like the automaton, the first pass splits the
+// rows into bands, one per thread, and the seams between bands are joined
+// after
+//
+// only flat maps can be labelled. a streamed world has no edge to stop at
+
+// smaller regions than this are filled in rather than tunnelled to
+#define REGION_MIN_SIZE 8
+
+typedef struct MapRegions {
+    int width;
+    int height;
+    bool valid;
+
+    // floor runs in row order. row y has runs row_first[y] up to
+    // row_first[y + 1]
+    int32_t *row_first;
+    int row_capacity;
+    int32_t *run_x;
+    int32_t *run_length;
+    int32_t *run_region;  // parent run while labelling, region ID after
+    int run_count;
+    int run_capacity;
+
+    int region_count;
+    int32_t *region_size;  // in tiles
+    int32_t *region_run;   // the region's first run
+    int32_t *region_left;  // bounding box, inclusive
+    int32_t *region_top;
+    int32_t *region_right;
+    int32_t *region_bottom;
+    int region_capacity;
+    int largest;  // -1 if there is no floor at all
+} MapRegions;
+
+MapRegions* initMapRegions(void);
+void destroyMapRegions(MapRegions *);
+int labelRegions(MapRegions *, const GameMap *, int);
+int regionAt(const MapRegions *, int, int);
+bool regionRandomTile(const MapRegions *, int, Rng *, int *, int *);
+int repairRegions(MapRegions *, GameMap *, int, int);
+
+#endif /* __REGION_H__ */
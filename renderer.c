@@ -0,0 +1,340 @@
+#include "SDL2/SDL.h"
+#include "SDL2/SDL_ttf.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include "renderer.h"
+#include "yarz.h"
+#include "map.h"
+#include "profile.h"
+
+TileBatch* initTileBatch(int capacity) {
+    TileBatch *batch = (TileBatch *) malloc(sizeof(TileBatch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->texture = NULL;
+    batch->texture_width = 1;
+    batch->texture_height = 1;
+    batch->vertices = NULL;
+    batch->indices = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+
+    // the index pattern never changes, so it is written once per growth
+    // rather than every frame
+    batch->vertices = (SDL_Vertex *) malloc(sizeof(SDL_Vertex) * 4 * capacity);
+    batch->indices = (int *) malloc(sizeof(int) * 6 * capacity);
+    if (batch->vertices == NULL || batch->indices == NULL) {
+        destroyTileBatch(batch);
+        return NULL;
+    }
+    batch->capacity = capacity;
+
+    for (int i = 0; i < capacity; i++) {
+        batch->indices[i * 6 + 0] = i * 4 + 0;
+        batch->indices[i * 6 + 1] = i * 4 + 1;
+        batch->indices[i * 6 + 2] = i * 4 + 2;
+        batch->indices[i * 6 + 3] = i * 4 + 2;
+        batch->indices[i * 6 + 4] = i * 4 + 3;
+        batch->indices[i * 6 + 5] = i * 4 + 0;
+    }
+
+    return batch;
+}
+
+// doubles the batch. this only happens until the batch has seen its largest
+// frame, after that drawing never allocates
+static bool growTileBatch(TileBatch *batch) {
+    int capacity = batch->capacity * 2 > 64 ? batch->capacity * 2 : 64;
+    SDL_Vertex *vertices = (SDL_Vertex *)
+        realloc(batch->vertices, sizeof(SDL_Vertex) * 4 * capacity);
+    if (vertices == NULL) {
+        return false;
+    }
+    batch->vertices = vertices;
+
+    int *indices = (int *) realloc(batch->indices, sizeof(int) * 6 * capacity);
+    if (indices == NULL) {
+        return false;
+    }
+    batch->indices = indices;
+
+    for (int i = batch->capacity; i < capacity; i++) {
+        batch->indices[i * 6 + 0] = i * 4 + 0;
+        batch->indices[i * 6 + 1] = i * 4 + 1;
+        batch->indices[i * 6 + 2] = i * 4 + 2;
+        batch->indices[i * 6 + 3] = i * 4 + 2;
+        batch->indices[i * 6 + 4] = i * 4 + 3;
+        batch->indices[i * 6 + 5] = i * 4 + 0;
+    }
+    batch->capacity = capacity;
+    return true;
+}
+
+// every quad queued after this is drawn from texture
+void beginTileBatch(TileBatch *batch, SDL_Texture *texture) {
+    int width, height;
+    SDL_QueryTexture(texture, NULL, NULL, &width, &height);
+    batch->texture = texture;
+    batch->texture_width = (float)width;
+    batch->texture_height = (float)height;
+    batch->count = 0;
+}
+
+// queues the TILE_SIZE square at (offset, sprite) of the batch's sheet, same
+// as placeTile, to be drawn at x, y scaled to w by h screen pixels
+void batchTile(TileBatch *batch, int sprite, int offset,
+               float x, float y, float w, float h) {
+    SDL_Rect source = {.x = offset * TILE_SIZE, .y = sprite * TILE_SIZE,
+                       .w = TILE_SIZE, .h = TILE_SIZE};
+    batchQuad(batch, &source, x, y, w, h);
+}
+
+// queues any rectangle of the batch's texture, to be drawn at x, y scaled to
+// w by h screen pixels
+void batchQuad(TileBatch *batch, const SDL_Rect *source,
+               float x, float y, float w, float h) {
+    if (batch->count == batch->capacity && !growTileBatch(batch)) {
+        return;
+    }
+
+    float u0 = source->x / batch->texture_width;
+    float v0 = source->y / batch->texture_height;
+    float u1 = (source->x + source->w) / batch->texture_width;
+    float v1 = (source->y + source->h) / batch->texture_height;
+
+    SDL_Color white = {.r = 255, .g = 255, .b = 255, .a = 255};
+    SDL_Vertex *quad = &batch->vertices[batch->count * 4];
+    quad[0] = (SDL_Vertex){ {x, y}, white, {u0, v0} };
+    quad[1] = (SDL_Vertex){ {x + w, y}, white, {u1, v0} };
+    quad[2] = (SDL_Vertex){ {x + w, y + h}, white, {u1, v1} };
+    quad[3] = (SDL_Vertex){ {x, y + h}, white, {u0, v1} };
+    batch->count++;
+}
+
+void flushTileBatch(SDL_Renderer *renderer, TileBatch *batch) {
+    if (batch->count > 0) {
+        SDL_RenderGeometry(renderer, batch->texture,
+                           batch->vertices, batch->count * 4,
+                           batch->indices, batch->count * 6);
+        PROFILE_COUNT(PROFILE_BLITS, batch->count);
+    }
+    batch->count = 0;
+}
+
+void destroyTileBatch(TileBatch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    free(batch->vertices);
+    free(batch->indices);
+    free(batch);
+}
+
+// RENDERER_BACKEND takes whatever SDL thinks is best, which ends up being the
+// software renderer anyway when there is no GPU (or with the dummy video
+// driver). SOFTWARE_RENDERER_BACKEND asks for the software renderer outright
+int initRendererBackend(RenderTarget *render_target) {
+    Uint32 flags = 0;
+    if (render_target->backend == SOFTWARE_RENDERER_BACKEND) {
+        flags = SDL_RENDERER_SOFTWARE;
+    }
+    if (render_target->vsync) {
+        flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+
+    render_target->renderer =
+        SDL_CreateRenderer(render_target->window, -1, flags);
+    if (render_target->renderer == NULL) {
+        printf("Could not create renderer! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+
+    // not every renderer can do vsync. without it, the game loop's frame cap
+    // does the pacing instead
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(render_target->renderer, &info) == 0) {
+        printf("Using the %s renderer\n", info.name);
+        render_target->vsync = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
+    }
+    else {
+        render_target->vsync = false;
+    }
+
+    render_target->tile_batch = initTileBatch(1024);
+    if (render_target->tile_batch == NULL) {
+        printf("Could not allocate tile batch!\n");
+        SDL_DestroyRenderer(render_target->renderer);
+        render_target->renderer = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// turns the sheets of the sprite atlas and the glyph cache into textures.
+// their colour key becomes alpha on the way, so transparency works the same
+// as in the surface path
+int uploadTextures(RenderTarget *render_target, Resources *resources) {
+    SDL_Renderer *renderer = render_target->renderer;
+    resources->sprites_texture =
+        SDL_CreateTextureFromSurface(renderer, resources->sprites);
+    resources->terrain_texture =
+        SDL_CreateTextureFromSurface(renderer, resources->terrain);
+    resources->icons_texture =
+        SDL_CreateTextureFromSurface(renderer, resources->icons);
+    resources->glyphs_texture =
+        SDL_CreateTextureFromSurface(renderer, resources->glyphs->sheet);
+
+    if (resources->sprites_texture == NULL
+        || resources->terrain_texture == NULL
+        || resources->icons_texture == NULL
+        || resources->glyphs_texture == NULL) {
+        printf("Could not upload sprite maps! SDL_Error: %s\n",
+               SDL_GetError());
+        return -1;
+    }
+
+    return 0;
+}
+
+// text with its top left at x, y, all of it one batch from the glyph texture
+void renderText(RenderTarget *render_target, Resources *resources,
+                const char *text, int x, int y) {
+    TileBatch *batch = render_target->tile_batch;
+    TextCursor cursor;
+    GlyphQuad quad;
+    beginTileBatch(batch, resources->glyphs_texture);
+    startText(&cursor, text, x, y);
+    while (nextGlyph(resources->glyphs, &cursor, &quad)) {
+        batchQuad(batch, &quad.source, quad.destination.x, quad.destination.y,
+                  quad.destination.w, quad.destination.h);
+    }
+    flushTileBatch(render_target->renderer, batch);
+}
+
+void renderAccelerated(RenderTarget *render_target, Camera *camera,
+                       Resources *resources, GameMap *game_map,
+                       GameState *game_state) {
+    SDL_Renderer *renderer = render_target->renderer;
+    TileBatch *batch = render_target->tile_batch;
+
+    // the renderer keeps up with window size changes on its own
+    render_target->resizing = false;
+
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+
+    // same projection as the surface path: the camera rectangle of the level
+    // is stretched to fill the window, and only what falls inside it is drawn
+    SDL_Rect view = cameraView(render_target, camera);
+    if (view.w > 0 && view.h > 0) {
+        float scale_x = (float)render_target->screen_width / view.w;
+        float scale_y = (float)render_target->screen_height / view.h;
+        float tile_w = TILE_SIZE * scale_x;
+        float tile_h = TILE_SIZE * scale_y;
+
+        int first_x, first_y, last_x, last_y;
+        visibleTiles(game_map, &view, &first_x, &first_y, &last_x, &last_y);
+        FovResult *fov = &resources->shown_fov;
+        updateViewFov(resources, game_map, game_state, NULL);
+        if (fov->valid) {
+            fovClip(fov, &first_x, &first_y, &last_x, &last_y);
+        }
+        // only what is in sight needs variants
+        TileVariants *tile_variants = resources->tile_variants;
+        if (ensureTileVariants(tile_variants, game_map, first_x, first_y,
+                               last_x, last_y) != 0) {
+            last_x = first_x;
+        }
+
+        PROFILE_BEGIN(render_terrain);
+        beginTileBatch(batch, resources->terrain_texture);
+        for (int y = first_y; y < last_y; y++) {
+            for (int x = first_x; x < last_x; x++) {
+                if (!tileShown(fov, x, y)) {
+                    continue;
+                }
+                TileVariant variant = tileVariantAt(tile_variants, x, y);
+                float left = (x * TILE_SIZE - view.x) * scale_x;
+                float top = (y * TILE_SIZE - view.y) * scale_y;
+                batchTile(batch, terrainSprite(tileVariantTile(variant)), 0,
+                          left, top, tile_w, tile_h);
+                int edges = tileVariantEdges(variant);
+                for (int edge = 0; edges != 0; edge++, edges >>= 1) {
+                    if (edges & 1) {
+                        batchTile(batch, WALLS, edge, left, top, tile_w,
+                                  tile_h);
+                    }
+                }
+            }
+        }
+        flushTileBatch(renderer, batch);
+        PROFILE_END(render_terrain);
+
+        if (game_state->last_input != NONE && game_state->end_turn == false) {
+            int icon_x, icon_y;
+            int direction = directionIcon(game_state, resources->entities,
+                                          &icon_x, &icon_y);
+            if (direction != EMPTY && inView(&view, icon_x, icon_y)) {
+                beginTileBatch(batch, resources->icons_texture);
+                batchTile(batch, 0, direction, (icon_x - view.x) * scale_x,
+                          (icon_y - view.y) * scale_y, tile_w, tile_h);
+                flushTileBatch(renderer, batch);
+            }
+        }
+
+        EntityStore *entities = resources->entities;
+        int visible = visibleEntities(resources, &view);
+        beginTileBatch(batch, resources->sprites_texture);
+        for (int i = 0; i < visible; i++) {
+            int index = entityIndex(entities, resources->visible[i]);
+            int x = entities->x[index];
+            int y = entities->y[index];
+            if (!tileShown(fov, x / TILE_SIZE, y / TILE_SIZE)) {
+                continue;
+            }
+            batchTile(batch, entities->sprite_ID[index], 0,
+                      (x - view.x) * scale_x, (y - view.y) * scale_y,
+                      tile_w, tile_h);
+        }
+        flushTileBatch(renderer, batch);
+    }
+
+    if (render_target->debug_info_changed) {
+        updateDebugInfo(resources->glyphs, render_target, game_map,
+                        camera->scale);
+        render_target->debug_info_changed = false;
+    }
+
+    renderText(render_target, resources, render_target->debug_text, 0, 0);
+
+    ProfileHudLayout hud;
+    if (layoutProfileHud(render_target, resources->glyphs, &hud)) {
+        SDL_SetRenderDrawColor(renderer, 16, 16, 16, 255);
+        SDL_RenderFillRect(renderer, &hud.panel);
+        SDL_SetRenderDrawColor(renderer, 18, 180, 18, 255);
+        SDL_RenderFillRects(renderer, hud.bars, hud.bar_count);
+        SDL_SetRenderDrawColor(renderer, 227, 18, 18, 255);
+        SDL_RenderFillRect(renderer, &hud.budget);
+        renderText(render_target, resources, hud.text, hud.text_x,
+                   hud.text_y);
+    }
+
+    PROFILE_BEGIN(present);
+    SDL_RenderPresent(renderer);
+    PROFILE_END(present);
+}
+
+void destroyRendererBackend(RenderTarget *render_target, Resources *resources) {
+    if (render_target->renderer == NULL) {
+        return;
+    }
+    SDL_DestroyTexture(resources->sprites_texture);
+    SDL_DestroyTexture(resources->terrain_texture);
+    SDL_DestroyTexture(resources->icons_texture);
+    SDL_DestroyTexture(resources->glyphs_texture);
+    destroyTileBatch(render_target->tile_batch);
+    SDL_DestroyRenderer(render_target->renderer);
+    render_target->renderer = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include "SDL2/SDL.h"
+#include "yarz.h"
+
+// the SDL_Renderer backend. instead of blitting surfaces on the CPU, the
+// sprite sheets are uploaded once as textures and every frame is drawn as a
+// handful of SDL_RenderGeometry calls, one per sheet
+
+// a growable list of textured quads drawn from a single texture
+typedef struct TileBatch {
+    SDL_Texture *texture;
+    float texture_width;
+    float texture_height;
+    SDL_Vertex *vertices;
+    int *indices;
+    int count;      // quads queued since the last flush
+    int capacity;   // quads that fit before we have to grow
+} TileBatch;
+
+TileBatch* initTileBatch(int);
+void beginTileBatch(TileBatch *, SDL_Texture *);
+void batchTile(TileBatch *, int, int, float, float, float, float);
+void batchQuad(TileBatch *, const SDL_Rect *, float, float, float, float);
+void flushTileBatch(SDL_Renderer *, TileBatch *);
+void destroyTileBatch(TileBatch *);
+
+int initRendererBackend(RenderTarget *);
+int uploadTextures(RenderTarget *, Resources *);
+void renderText(RenderTarget *, Resources *, const char *, int, int);
+void renderAccelerated(RenderTarget *, Camera *, Resources *, GameMap *,
+                       GameState *);
+void destroyRendererBackend(RenderTarget *, Resources *);
+
+#endif /* __RENDERER_H__ */
@@ -0,0 +1,84 @@
+#include "rng.h"
+#include <string.h>
+
+// expands a single 64-bit seed into the full state with SplitMix64, which is
+// how the xoshiro authors recommend seeding. it never yields the all-zero
+// state xoshiro can't escape from
+void rngSeed(Rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        seed += 0x9E3779B97F4A7C15ull;
+        rng->s[i] = rngMix64(seed);
+    }
+}
+
+// returns a value in [0, bound) with no modulo bias, using Lemire's
+// multiply-and-reject method: https://arxiv.org/abs/1805.10941
+// the division only happens in the rare case a draw lands near the edge
+uint32_t rngBounded(Rng *rng, uint32_t bound) {
+    uint64_t product = (rngNext(rng) >> 32) * (uint64_t)bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (rngNext(rng) >> 32) * (uint64_t)bound;
+            low = (uint32_t)product;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
+
+// returns a value in [min, max], inclusive on both ends
+int rngRange(Rng *rng, int min, int max) {
+    uint32_t span = (uint32_t)max - (uint32_t)min + 1;
+    if (span == 0) {
+        // min and max cover every int
+        return (int)(uint32_t)(rngNext(rng) >> 32);
+    }
+    return (int)((uint32_t)min + rngBounded(rng, span));
+}
+
+void rngFillBytes(Rng *rng, void *buffer, size_t length) {
+    uint8_t *bytes = (uint8_t *)buffer;
+    while (length >= sizeof(uint64_t)) {
+        uint64_t value = rngNext(rng);
+        memcpy(bytes, &value, sizeof(uint64_t));
+        bytes += sizeof(uint64_t);
+        length -= sizeof(uint64_t);
+    }
+    if (length > 0) {
+        uint64_t value = rngNext(rng);
+        memcpy(bytes, &value, length);
+    }
+}
+
+// fills buffer with count values in [min, max]
+void rngFillRange(Rng *rng, int *buffer, size_t count, int min, int max) {
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = rngRange(rng, min, max);
+    }
+}
+
+// hands child the current stream and moves rng 2^128 draws ahead, so the two
+// can be used side by side without ever overlapping
+void rngSplit(Rng *rng, Rng *child) {
+    static const uint64_t JUMP[] = { 0x180EC6D33CFD0ABAull,
+                                     0xD5A61266F0C9392Cull,
+                                     0xA9582618E03FC9AAull,
+                                     0x39ABDC4529B1661Cull };
+
+    *child = *rng;
+
+    uint64_t s[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+        for (int bit = 0; bit < 64; bit++) {
+            if (JUMP[i] & ((uint64_t)1 << bit)) {
+                s[0] ^= rng->s[0];
+                s[1] ^= rng->s[1];
+                s[2] ^= rng->s[2];
+                s[3] ^= rng->s[3];
+            }
+            rngNext(rng);
+        }
+    }
+    memcpy(rng->s, s, sizeof(s));
+}
@@ -0,0 +1,50 @@
+#ifndef __RNG_H__
+#define __RNG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// xoshiro256** by David Blackman and Sebastiano Vigna, see
+// https://prng.di.unimi.it/
+// all state is in the struct, so every thread or subsystem keeps its own Rng
+// and nothing is shared behind a lock the way libc rand() is
+typedef struct Rng {
+    uint64_t s[4];
+} Rng;
+
+void rngSeed(Rng *, uint64_t);
+uint32_t rngBounded(Rng *, uint32_t);
+int rngRange(Rng *, int, int);
+void rngFillBytes(Rng *, void *, size_t);
+void rngFillRange(Rng *, int *, size_t, int, int);
+void rngSplit(Rng *, Rng *);
+
+// the SplitMix64 finalizer. scrambles a 64-bit value so that nearby inputs
+// give unrelated outputs; used for seeding and for counter-based noise
+static inline uint64_t rngMix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rngRotate(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// returns the next 64 random bits
+static inline uint64_t rngNext(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rngRotate(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rngRotate(s[3], 45);
+
+    return result;
+}
+
+#endif /* __RNG_H__ */
@@ -0,0 +1,379 @@
+#include "spatial.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// >> on a negative int rounds down on every compiler we care about, which is
+// what keeps the buckets left of and above the origin the same size
+static inline int bucketCoordinate(int tile) {
+    return tile >> SPATIAL_BUCKET_SHIFT;
+}
+
+static inline int bucketHash(SpatialIndex *index, int bucket_x, int bucket_y) {
+    uint32_t hash = (uint32_t)bucket_x * 0x9E3779B1u
+                    ^ (uint32_t)bucket_y * 0x85EBCA77u;
+    return (int)((hash ^ (hash >> 16)) & (uint32_t)(index->bucket_count - 1));
+}
+
+static inline bool onGrid(SpatialIndex *index, int x, int y) {
+    return index->tile_first != NULL && x >= 0 && y >= 0
+           && x < index->width && y < index->height;
+}
+
+static bool growSlots(SpatialIndex *index, int capacity) {
+    bool *indexed = (bool *)realloc(index->indexed, sizeof(bool) * capacity);
+    if (indexed != NULL) {
+        index->indexed = indexed;
+    }
+    int *tile_x = (int *)realloc(index->tile_x, sizeof(int) * capacity);
+    if (tile_x != NULL) {
+        index->tile_x = tile_x;
+    }
+    int *tile_y = (int *)realloc(index->tile_y, sizeof(int) * capacity);
+    if (tile_y != NULL) {
+        index->tile_y = tile_y;
+    }
+    Entity *tile_next =
+        (Entity *)realloc(index->tile_next, sizeof(Entity) * capacity);
+    if (tile_next != NULL) {
+        index->tile_next = tile_next;
+    }
+    Entity *tile_prev =
+        (Entity *)realloc(index->tile_prev, sizeof(Entity) * capacity);
+    if (tile_prev != NULL) {
+        index->tile_prev = tile_prev;
+    }
+    Entity *bucket_next =
+        (Entity *)realloc(index->bucket_next, sizeof(Entity) * capacity);
+    if (bucket_next != NULL) {
+        index->bucket_next = bucket_next;
+    }
+    Entity *bucket_prev =
+        (Entity *)realloc(index->bucket_prev, sizeof(Entity) * capacity);
+    if (bucket_prev != NULL) {
+        index->bucket_prev = bucket_prev;
+    }
+
+    if (indexed == NULL || tile_x == NULL || tile_y == NULL
+        || tile_next == NULL || tile_prev == NULL || bucket_next == NULL
+        || bucket_prev == NULL) {
+        printf("Could not grow spatial index to %d entities!\n", capacity);
+        return false;
+    }
+    for (int i = index->capacity; i < capacity; i++) {
+        index->indexed[i] = false;
+    }
+    index->capacity = capacity;
+    return true;
+}
+
+// width and height are the map's, in tiles. pass 0 for both to go without a
+// tile grid. capacity is a hint for how many entities there will be, which
+// sizes the bucket table
+SpatialIndex* initSpatialIndex(int width, int height, int capacity) {
+    SpatialIndex *index = (SpatialIndex *)calloc(1, sizeof(SpatialIndex));
+    if (index == NULL) {
+        printf("Could not allocate spatial index!\n");
+        return NULL;
+    }
+
+    if (width > 0 && height > 0) {
+        index->tile_first =
+            (Entity *)malloc(sizeof(Entity) * (size_t)width * height);
+        if (index->tile_first == NULL) {
+            printf("Could not allocate a %dx%d occupancy grid!\n",
+                   width, height);
+            destroySpatialIndex(index);
+            return NULL;
+        }
+        for (size_t i = 0; i < (size_t)width * height; i++) {
+            index->tile_first[i] = ENTITY_NONE;
+        }
+        index->width = width;
+        index->height = height;
+    }
+
+    // about two entities per chain once everyone is in
+    index->bucket_count = 1024;
+    while (index->bucket_count < capacity / 2
+           && index->bucket_count < (1 << 20)) {
+        index->bucket_count *= 2;
+    }
+    index->bucket_first =
+        (Entity *)malloc(sizeof(Entity) * index->bucket_count);
+    if (index->bucket_first == NULL) {
+        printf("Could not allocate spatial index buckets!\n");
+        destroySpatialIndex(index);
+        return NULL;
+    }
+    for (int i = 0; i < index->bucket_count; i++) {
+        index->bucket_first[i] = ENTITY_NONE;
+    }
+
+    if (!growSlots(index, capacity > 16 ? capacity : 16)) {
+        destroySpatialIndex(index);
+        return NULL;
+    }
+    return index;
+}
+
+void destroySpatialIndex(SpatialIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->tile_first);
+    free(index->bucket_first);
+    free(index->indexed);
+    free(index->tile_x);
+    free(index->tile_y);
+    free(index->tile_next);
+    free(index->tile_prev);
+    free(index->bucket_next);
+    free(index->bucket_prev);
+    free(index);
+}
+
+static void linkTile(SpatialIndex *index, Entity entity, uint32_t slot) {
+    int x = index->tile_x[slot];
+    int y = index->tile_y[slot];
+    if (!onGrid(index, x, y)) {
+        return;
+    }
+    Entity *first = &index->tile_first[(size_t)y * index->width + x];
+    index->tile_prev[slot] = ENTITY_NONE;
+    index->tile_next[slot] = *first;
+    if (*first != ENTITY_NONE) {
+        index->tile_prev[*first & ENTITY_SLOT_MASK] = entity;
+    }
+    *first = entity;
+}
+
+static void unlinkTile(SpatialIndex *index, uint32_t slot) {
+    int x = index->tile_x[slot];
+    int y = index->tile_y[slot];
+    if (!onGrid(index, x, y)) {
+        return;
+    }
+    Entity next = index->tile_next[slot];
+    Entity prev = index->tile_prev[slot];
+    if (prev != ENTITY_NONE) {
+        index->tile_next[prev & ENTITY_SLOT_MASK] = next;
+    }
+    else {
+        index->tile_first[(size_t)y * index->width + x] = next;
+    }
+    if (next != ENTITY_NONE) {
+        index->tile_prev[next & ENTITY_SLOT_MASK] = prev;
+    }
+}
+
+static void linkBucket(SpatialIndex *index, Entity entity, uint32_t slot) {
+    Entity *first = &index->bucket_first[bucketHash(
+        index, bucketCoordinate(index->tile_x[slot]),
+        bucketCoordinate(index->tile_y[slot]))];
+    index->bucket_prev[slot] = ENTITY_NONE;
+    index->bucket_next[slot] = *first;
+    if (*first != ENTITY_NONE) {
+        index->bucket_prev[*first & ENTITY_SLOT_MASK] = entity;
+    }
+    *first = entity;
+}
+
+static void unlinkBucket(SpatialIndex *index, uint32_t slot) {
+    Entity next = index->bucket_next[slot];
+    Entity prev = index->bucket_prev[slot];
+    if (prev != ENTITY_NONE) {
+        index->bucket_next[prev & ENTITY_SLOT_MASK] = next;
+    }
+    else {
+        index->bucket_first[bucketHash(
+            index, bucketCoordinate(index->tile_x[slot]),
+            bucketCoordinate(index->tile_y[slot]))] = next;
+    }
+    if (next != ENTITY_NONE) {
+        index->bucket_prev[next & ENTITY_SLOT_MASK] = prev;
+    }
+}
+
+// starts tracking entity at tile x, y. an entity that is already in is moved
+void spatialInsert(SpatialIndex *index, Entity entity, int x, int y) {
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    if (entity == ENTITY_NONE) {
+        return;
+    }
+    if (slot < (uint32_t)index->capacity && index->indexed[slot]) {
+        spatialMove(index, entity, x, y);
+        return;
+    }
+    if (slot >= (uint32_t)index->capacity) {
+        int capacity = index->capacity * 2;
+        while ((uint32_t)capacity <= slot) {
+            capacity *= 2;
+        }
+        if (!growSlots(index, capacity)) {
+            return;
+        }
+    }
+
+    index->indexed[slot] = true;
+    index->tile_x[slot] = x;
+    index->tile_y[slot] = y;
+    linkTile(index, entity, slot);
+    linkBucket(index, entity, slot);
+}
+
+// stops tracking entity. call it before removeEntity, so the slot is free for
+// whoever gets it next
+void spatialRemove(SpatialIndex *index, Entity entity) {
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    if (entity == ENTITY_NONE || slot >= (uint32_t)index->capacity
+        || !index->indexed[slot]) {
+        return;
+    }
+    unlinkTile(index, slot);
+    unlinkBucket(index, slot);
+    index->indexed[slot] = false;
+}
+
+// moves entity to tile x, y. O(1): it only changes bucket when it crosses
+// into another one
+void spatialMove(SpatialIndex *index, Entity entity, int x, int y) {
+    uint32_t slot = entity & ENTITY_SLOT_MASK;
+    if (entity == ENTITY_NONE || slot >= (uint32_t)index->capacity
+        || !index->indexed[slot]) {
+        spatialInsert(index, entity, x, y);
+        return;
+    }
+    int old_x = index->tile_x[slot];
+    int old_y = index->tile_y[slot];
+    if (old_x == x && old_y == y) {
+        return;
+    }
+
+    bool new_bucket = bucketCoordinate(old_x) != bucketCoordinate(x)
+                      || bucketCoordinate(old_y) != bucketCoordinate(y);
+    unlinkTile(index, slot);
+    if (new_bucket) {
+        unlinkBucket(index, slot);
+    }
+    index->tile_x[slot] = x;
+    index->tile_y[slot] = y;
+    linkTile(index, entity, slot);
+    if (new_bucket) {
+        linkBucket(index, entity, slot);
+    }
+}
+
+// whoever is at tile x, y. writes up to max of them to found and returns how
+// many there are in total
+int spatialQueryTile(SpatialIndex *index, int x, int y, Entity *found,
+                     int max) {
+    int count = 0;
+    if (onGrid(index, x, y)) {
+        Entity entity = index->tile_first[(size_t)y * index->width + x];
+        while (entity != ENTITY_NONE) {
+            if (count < max) {
+                found[count] = entity;
+            }
+            count++;
+            entity = index->tile_next[entity & ENTITY_SLOT_MASK];
+        }
+        return count;
+    }
+
+    // off the grid, or no grid at all: look through the tile's bucket
+    Entity entity = index->bucket_first[bucketHash(
+        index, bucketCoordinate(x), bucketCoordinate(y))];
+    while (entity != ENTITY_NONE) {
+        uint32_t slot = entity & ENTITY_SLOT_MASK;
+        if (index->tile_x[slot] == x && index->tile_y[slot] == y) {
+            if (count < max) {
+                found[count] = entity;
+            }
+            count++;
+        }
+        entity = index->bucket_next[slot];
+    }
+    return count;
+}
+
+bool spatialOccupied(SpatialIndex *index, int x, int y) {
+    return spatialQueryTile(index, x, y, NULL, 0) > 0;
+}
+
+// everyone at tiles x0, y0 to x1, y1 (inclusive). and, when radius is 0 or
+// more, within radius tiles of center_x, center_y as well
+static int queryRect(SpatialIndex *index, int x0, int y0, int x1, int y1,
+                     int center_x, int center_y, int radius, Entity *found,
+                     int max) {
+    if (x1 < x0 || y1 < y0) {
+        return 0;
+    }
+    int count = 0;
+    int64_t radius_squared = (int64_t)radius * radius;
+    int bucket_x0 = bucketCoordinate(x0);
+    int bucket_y0 = bucketCoordinate(y0);
+    int bucket_x1 = bucketCoordinate(x1);
+    int bucket_y1 = bucketCoordinate(y1);
+    int64_t buckets = ((int64_t)bucket_x1 - bucket_x0 + 1)
+                      * ((int64_t)bucket_y1 - bucket_y0 + 1);
+
+    // a rectangle that covers more buckets than the table has chains is
+    // cheaper to answer by walking every chain once
+    bool walk_table = buckets > index->bucket_count;
+    int chains = walk_table ? index->bucket_count : (int)buckets;
+    int width = bucket_x1 - bucket_x0 + 1;
+
+    for (int i = 0; i < chains; i++) {
+        int bucket_x = bucket_x0 + (walk_table ? 0 : i % width);
+        int bucket_y = bucket_y0 + (walk_table ? 0 : i / width);
+        Entity entity = index->bucket_first[walk_table
+            ? i : bucketHash(index, bucket_x, bucket_y)];
+
+        while (entity != ENTITY_NONE) {
+            Entity current = entity;
+            uint32_t slot = entity & ENTITY_SLOT_MASK;
+            int x = index->tile_x[slot];
+            int y = index->tile_y[slot];
+            entity = index->bucket_next[slot];
+
+            // other buckets can share the chain, and would be counted twice
+            if (!walk_table && (bucketCoordinate(x) != bucket_x
+                                || bucketCoordinate(y) != bucket_y)) {
+                continue;
+            }
+            if (x < x0 || x > x1 || y < y0 || y > y1) {
+                continue;
+            }
+            if (radius >= 0) {
+                int64_t dx = x - center_x;
+                int64_t dy = y - center_y;
+                if (dx * dx + dy * dy > radius_squared) {
+                    continue;
+                }
+            }
+            if (count < max) {
+                found[count] = current;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+// everyone in the rectangle of tiles from x0, y0 to x1, y1 (inclusive). writes
+// up to max of them to found and returns how many there are in total
+int spatialQueryRect(SpatialIndex *index, int x0, int y0, int x1, int y1,
+                     Entity *found, int max) {
+    return queryRect(index, x0, y0, x1, y1, 0, 0, -1, found, max);
+}
+
+// everyone within radius tiles of x, y (as the crow flies)
+int spatialQueryRadius(SpatialIndex *index, int x, int y, int radius,
+                       Entity *found, int max) {
+    if (radius < 0) {
+        return 0;
+    }
+    return queryRect(index, x - radius, y - radius, x + radius, y + radius,
+                     x, y, radius, found, max);
+}
@@ -0,0 +1,55 @@
+#ifndef __SPATIAL_H__
+#define __SPATIAL_H__
+
+#include <stdbool.h>
+#include "entity.h"
+
+// finds entities by where they are, without looking at all of them. two
+// structures, both intrusive linked lists threaded through per-entity arrays
+// so that moving an entity never allocates:
+//
+// a tile grid with the first occupant of every map tile, for "who is standing
+// here" in O(1). only for maps small enough to have one (not streamed worlds)
+//
+// a hash table of SPATIAL_BUCKET_SIZE square buckets of tiles, for "who is in
+// this rectangle / within this radius". a query only walks the buckets it
+// overlaps, so it costs about as much as what it finds. buckets are hashed by
+// their coordinates, so they work anywhere, including off the map
+//
+// positions here are in tiles, and the per-entity arrays are indexed by handle
+// slot, which unlike the entity index doesn't change when others are removed
+
+#define SPATIAL_BUCKET_SHIFT 3
+#define SPATIAL_BUCKET_SIZE (1 << SPATIAL_BUCKET_SHIFT)
+
+typedef struct SpatialIndex {
+    // the tile grid, width * height heads. NULL when there isn't one
+    int width;
+    int height;
+    Entity *tile_first;
+
+    int bucket_count;  // always a power of 2
+    Entity *bucket_first;
+
+    // per handle slot
+    int capacity;
+    bool *indexed;
+    int *tile_x;
+    int *tile_y;
+    Entity *tile_next;
+    Entity *tile_prev;
+    Entity *bucket_next;
+    Entity *bucket_prev;
+} SpatialIndex;
+
+SpatialIndex* initSpatialIndex(int, int, int);
+void destroySpatialIndex(SpatialIndex *);
+void spatialInsert(SpatialIndex *, Entity, int, int);
+void spatialRemove(SpatialIndex *, Entity);
+void spatialMove(SpatialIndex *, Entity, int, int);
+bool spatialOccupied(SpatialIndex *, int, int);
+int spatialQueryTile(SpatialIndex *, int, int, Entity *, int);
+int spatialQueryRect(SpatialIndex *, int, int, int, int, Entity *, int);
+int spatialQueryRadius(SpatialIndex *, int, int, int, Entity *, int);
+
+#endif /* __SPATIAL_H__ */
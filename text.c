@@ -0,0 +1,159 @@
+#include "text.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static int glyphIndex(char c) {
+    if (c < GLYPH_FIRST || c > GLYPH_LAST) {
+        c = '?';
+    }
+    return c - GLYPH_FIRST;
+}
+
+// rasterizes every glyph of font in colour into a sheet in format. the sheet
+// is keyed on the opposite colour, which no glyph pixel can be
+GlyphCache* initGlyphCache(TTF_Font *font, SDL_Color colour,
+                           SDL_PixelFormat *format) {
+    GlyphCache *cache = (GlyphCache *)calloc(1, sizeof(GlyphCache));
+    if (cache == NULL) {
+        printf("Could not allocate glyph cache!\n");
+        return NULL;
+    }
+    cache->line_skip = TTF_FontLineSkip(font);
+
+    SDL_Surface *rendered[GLYPH_COUNT] = { NULL };
+    int width = 0;
+    int height = 0;
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        Uint16 glyph = (Uint16)(GLYPH_FIRST + i);
+        int min_x, max_x, min_y, max_y;
+        if (TTF_GlyphMetrics(font, glyph, &min_x, &max_x, &min_y, &max_y,
+                             &cache->advance[i]) < 0) {
+            cache->advance[i] = 0;
+        }
+        // a space renders to nothing, but still takes up room
+        rendered[i] = glyph == ' ' ? NULL
+                      : TTF_RenderGlyph_Solid(font, glyph, colour);
+        if (rendered[i] != NULL) {
+            cache->glyphs[i] = (SDL_Rect){ .x = width, .y = 0,
+                                           .w = rendered[i]->w,
+                                           .h = rendered[i]->h };
+            width += rendered[i]->w;
+            if (rendered[i]->h > height) {
+                height = rendered[i]->h;
+            }
+        }
+    }
+
+    cache->sheet = SDL_CreateRGBSurfaceWithFormat(0, width > 0 ? width : 1,
+                                                  height > 0 ? height : 1,
+                                                  format->BitsPerPixel,
+                                                  format->format);
+    if (cache->sheet == NULL) {
+        printf("Could not allocate %dx%d glyph sheet! SDL_Error: %s\n",
+               width, height, SDL_GetError());
+    }
+    else {
+        Uint32 key = SDL_MapRGB(cache->sheet->format, 255 - colour.r,
+                                255 - colour.g, 255 - colour.b);
+        SDL_FillRect(cache->sheet, NULL, key);
+        // the rendered glyphs are keyed on their background too, so only
+        // the glyph itself lands on the sheet
+        for (int i = 0; i < GLYPH_COUNT; i++) {
+            if (rendered[i] != NULL) {
+                SDL_Rect destination = cache->glyphs[i];
+                SDL_BlitSurface(rendered[i], NULL, cache->sheet, &destination);
+            }
+        }
+        // not RLE encoded: the glyphs are a clipped blit each from one long
+        // strip, and RLE walks every row of those from the strip's left edge
+        SDL_SetColorKey(cache->sheet, SDL_TRUE, key);
+    }
+
+    for (int i = 0; i < GLYPH_COUNT; i++) {
+        SDL_FreeSurface(rendered[i]);
+    }
+    if (cache->sheet == NULL) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void destroyGlyphCache(GlyphCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    SDL_FreeSurface(cache->sheet);
+    free(cache);
+}
+
+// the size text takes up drawn: its widest line by its number of lines
+void measureText(const GlyphCache *cache, const char *text, int *width,
+                 int *height) {
+    int line = 0;
+    int lines = 1;
+    *width = 0;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            line = 0;
+            lines++;
+            continue;
+        }
+        int glyph = glyphIndex(*c);
+        int right = line + cache->glyphs[glyph].w;
+        line += cache->advance[glyph];
+        if (right > *width) {
+            *width = right;
+        }
+        if (line > *width) {
+            *width = line;
+        }
+    }
+    *height = (lines - 1) * cache->line_skip + cache->sheet->h;
+}
+
+// lays out text with its top left at x, y
+void startText(TextCursor *cursor, const char *text, int x, int y) {
+    cursor->next = text;
+    cursor->left = x;
+    cursor->x = x;
+    cursor->y = y;
+}
+
+// the next glyph to draw into quad, false at the end of the text. glyphs with
+// nothing to draw, like spaces, only move the cursor along
+bool nextGlyph(const GlyphCache *cache, TextCursor *cursor, GlyphQuad *quad) {
+    for (; *cursor->next != '\0'; cursor->next++) {
+        if (*cursor->next == '\n') {
+            cursor->x = cursor->left;
+            cursor->y += cache->line_skip;
+            continue;
+        }
+        int glyph = glyphIndex(*cursor->next);
+        const SDL_Rect *source = &cache->glyphs[glyph];
+        int x = cursor->x;
+        cursor->x += cache->advance[glyph];
+        if (source->w > 0) {
+            quad->source = *source;
+            quad->destination = (SDL_Rect){ .x = x, .y = cursor->y,
+                                            .w = source->w, .h = source->h };
+            cursor->next++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// draws text onto surface with its top left at x, y
+void drawText(const GlyphCache *cache, const char *text, int x, int y,
+              SDL_Surface *surface) {
+    TextCursor cursor;
+    GlyphQuad quad;
+    startText(&cursor, text, x, y);
+    while (nextGlyph(cache, &cursor, &quad)) {
+        SDL_BlitSurface(cache->sheet, &quad.source, surface,
+                        &quad.destination);
+        PROFILE_COUNT(PROFILE_BLITS, 1);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef __TEXT_H__
+#define __TEXT_H__
+
+#include "SDL2/SDL.h"
+#include "SDL2/SDL_ttf.h"
+#include <stdbool.h>
+
+// text drawn from a glyph cache. every printable ASCII glyph of a font is
+// rasterized once, at the size the font was opened with, into one colour
+// keyed sheet, along with how far each one moves the pen. after that, laying
+// out a string is a walk over that table and drawing it is a blit (or a
+// batched quad) per glyph from the sheet, so neither allocates nor touches
+// the font again
+//
+// lines are broken at '\n' only. anything outside printable ASCII is drawn as
+// '?'
+
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST '~'
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+
+typedef struct GlyphCache {
+    SDL_Surface *sheet;              // every glyph side by side, colour keyed
+    SDL_Rect glyphs[GLYPH_COUNT];    // where each glyph is on the sheet
+    int advance[GLYPH_COUNT];
+    int line_skip;
+} GlyphCache;
+
+// one glyph of laid out text: where it comes from on the sheet and where it
+// goes
+typedef struct GlyphQuad {
+    SDL_Rect source;
+    SDL_Rect destination;
+} GlyphQuad;
+
+// how far through laying out a string we are
+typedef struct TextCursor {
+    const char *next;
+    int left;  // where lines start
+    int x;
+    int y;
+} TextCursor;
+
+GlyphCache* initGlyphCache(TTF_Font *, SDL_Color, SDL_PixelFormat *);
+void destroyGlyphCache(GlyphCache *);
+void measureText(const GlyphCache *, const char *, int *, int *);
+void startText(TextCursor *, const char *, int, int);
+bool nextGlyph(const GlyphCache *, TextCursor *, GlyphQuad *);
+void drawText(const GlyphCache *, const char *, int, int, SDL_Surface *);
+
+#endif /* __TEXT_H__ */
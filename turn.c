@@ -0,0 +1,170 @@
+#include "turn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+TurnScheduler* initTurnScheduler(int mode) {
+    TurnScheduler *turns = (TurnScheduler *)calloc(1, sizeof(TurnScheduler));
+    if (turns == NULL) {
+        printf("Could not allocate turn scheduler!\n");
+        return NULL;
+    }
+    turns->mode = mode;
+    return turns;
+}
+
+void destroyTurnScheduler(TurnScheduler *turns) {
+    if (turns == NULL) {
+        return;
+    }
+    free(turns->order);
+    free(turns->heap);
+    free(turns);
+}
+
+// how long an entity waits between turns
+static uint64_t turnDelay(EntityStore *entities, int index) {
+    int speed = entities->speed[index] > 0 ? entities->speed[index] : 1;
+    return (uint64_t)TURN_ACTION_COST * ENTITY_NORMAL_SPEED / speed;
+}
+
+static bool earlier(const TurnEntry *a, const TurnEntry *b) {
+    return a->time < b->time
+           || (a->time == b->time && a->sequence < b->sequence);
+}
+
+static void siftUp(TurnEntry *heap, int i) {
+    TurnEntry entry = heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!earlier(&entry, &heap[parent])) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = entry;
+}
+
+static void siftDown(TurnEntry *heap, int count, int i) {
+    TurnEntry entry = heap[i];
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && earlier(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!earlier(&heap[child], &entry)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = entry;
+}
+
+static void pushTurn(TurnScheduler *turns, uint64_t time, Entity entity) {
+    if (turns->heap_count == turns->heap_capacity) {
+        int capacity = turns->heap_capacity > 0 ? turns->heap_capacity * 2 : 64;
+        TurnEntry *heap = (TurnEntry *)
+            realloc(turns->heap, sizeof(TurnEntry) * capacity);
+        if (heap == NULL) {
+            printf("Could not grow turn queue!\n");
+            return;
+        }
+        turns->heap = heap;
+        turns->heap_capacity = capacity;
+    }
+
+    TurnEntry *entry = &turns->heap[turns->heap_count];
+    entry->time = time;
+    entry->sequence = turns->sequence++;
+    entry->entity = entity;
+    siftUp(turns->heap, turns->heap_count);
+    turns->heap_count++;
+}
+
+// lets the scheduler know about a new entity. shuffled rounds pick it up at
+// the start of the next round by themselves. with energy, its first turn comes
+// somewhere within one delay from now, so a crowd spawned at once doesn't all
+// act in spawn order
+void scheduleEntity(TurnScheduler *turns, EntityStore *entities, Rng *rng,
+                    Entity entity) {
+    int index = entityIndex(entities, entity);
+    if (turns->mode != TURN_ENERGY || index < 0) {
+        return;
+    }
+    uint64_t delay = turnDelay(entities, index);
+    uint64_t stagger = delay > 0 ? rngBounded(rng, (uint32_t)delay) : 0;
+    pushTurn(turns, turns->now + stagger, entity);
+}
+
+// deals out a new round: every live entity once, Fisher-Yates shuffled
+static void shuffleRound(TurnScheduler *turns, EntityStore *entities,
+                         Rng *rng) {
+    turns->order_count = 0;
+    turns->next = 0;
+    if (entities->count > turns->order_capacity) {
+        Entity *order = (Entity *)
+            realloc(turns->order, sizeof(Entity) * entities->count);
+        if (order == NULL) {
+            printf("Could not grow turn order!\n");
+            return;
+        }
+        turns->order = order;
+        turns->order_capacity = entities->count;
+    }
+
+    int count = entities->count;
+    memcpy(turns->order, entities->handle, sizeof(Entity) * count);
+    for (int i = count - 1; i > 0; i--) {
+        int j = (int)rngBounded(rng, (uint32_t)i + 1);
+        Entity swap = turns->order[i];
+        turns->order[i] = turns->order[j];
+        turns->order[j] = swap;
+    }
+    turns->order_count = count;
+}
+
+// returns whoever acts next, or ENTITY_NONE when there is nobody left. with
+// energy, the entity is queued for its following turn right away
+Entity nextTurn(TurnScheduler *turns, EntityStore *entities, Rng *rng) {
+    if (turns->mode == TURN_ENERGY) {
+        while (turns->heap_count > 0) {
+            TurnEntry *top = &turns->heap[0];
+            int index = entityIndex(entities, top->entity);
+            if (index < 0) {
+                // removed since it was queued
+                turns->heap[0] = turns->heap[--turns->heap_count];
+                if (turns->heap_count > 0) {
+                    siftDown(turns->heap, turns->heap_count, 0);
+                }
+                continue;
+            }
+
+            // requeue in place, cheaper than a pop and a push
+            Entity entity = top->entity;
+            turns->now = top->time;
+            top->time = turns->now + turnDelay(entities, index);
+            top->sequence = turns->sequence++;
+            siftDown(turns->heap, turns->heap_count, 0);
+            return entity;
+        }
+        return ENTITY_NONE;
+    }
+
+    for (;;) {
+        if (turns->next >= turns->order_count) {
+            shuffleRound(turns, entities, rng);
+            if (turns->order_count == 0) {
+                return ENTITY_NONE;
+            }
+        }
+        Entity entity = turns->order[turns->next++];
+        if (entityIndex(entities, entity) >= 0) {
+            return entity;
+        }
+    }
+}
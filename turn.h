@@ -0,0 +1,58 @@
+#ifndef __TURN_H__
+#define __TURN_H__
+
+#include <stdint.h>
+#include "entity.h"
+#include "rng.h"
+
+// decides who acts next. there are two ways to go about it:
+//
+// TURN_SHUFFLED: everyone acts once per round, in an order shuffled afresh
+// every round (Fisher-Yates over the live entities, O(n) per round, O(1) per
+// turn)
+//
+// TURN_ENERGY: entities act on a shared clock. after acting, an entity waits
+// TURN_ACTION_COST * ENTITY_NORMAL_SPEED / speed ticks before its next turn,
+// so something twice as fast gets two turns for every one of a normal speed
+// entity. the waiting entities sit in a binary heap ordered by when they are
+// up next (O(log n) per turn)
+//
+// both hold handles, so entities removed in the meantime are skipped when
+// their turn comes up
+
+enum turnMode {
+    TURN_SHUFFLED,
+    TURN_ENERGY
+};
+
+#define TURN_ACTION_COST 1000
+
+typedef struct TurnEntry {
+    uint64_t time;      // on the scheduler's clock
+    uint64_t sequence;  // breaks ties in the order entries were queued
+    Entity entity;
+} TurnEntry;
+
+typedef struct TurnScheduler {
+    int mode;
+
+    // TURN_SHUFFLED
+    Entity *order;
+    int order_count;
+    int order_capacity;
+    int next;
+
+    // TURN_ENERGY
+    TurnEntry *heap;
+    int heap_count;
+    int heap_capacity;
+    uint64_t now;
+    uint64_t sequence;
+} TurnScheduler;
+
+TurnScheduler* initTurnScheduler(int);
+void destroyTurnScheduler(TurnScheduler *);
+void scheduleEntity(TurnScheduler *, EntityStore *, Rng *, Entity);
+Entity nextTurn(TurnScheduler *, EntityStore *, Rng *);
+
+#endif /* __TURN_H__ */
@@ -5,8 +5,14 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include "yarz.h"
 #include "map.h"
+#include "renderer.h"
+#include "chunk.h"
+#include "bench.h"
+#include "profile.h"
+#include "cave.h"
 
 const int INITIAL_SCREEN_WIDTH = 640;
 const int INITIAL_SCREEN_HEIGHT = 480;
@@ -19,78 +25,259 @@ const int CAVE_GENERATOR_ITERATIONS = 5;
 const int HERO = 0;
 const int LEGGY = 1;
 const int BOOTS = 2;
-const int FLOOR = 0;
-
-enum gameStatus {
-    EXITING,
-    INIT,
-    NEW_GAME,
-    PLAYER_TURN,
-    HERO_TURN,
-    GAME_OVER
-};
-
-enum inputs {
-    NONE,
-    UP_LEFT,
-    UP,
-    UP_RIGHT,
-    RIGHT,
-    DOWN_RIGHT,
-    DOWN,
-    DOWN_LEFT,
-    LEFT,
-    SKIP,
-    DEBUG_GENERATE_NEW_MAP
-};
-
-enum directions {
-    EMPTY,
-    NORTH_WEST,
-    NORTH,
-    NORTH_EAST,
-    EAST,
-    SOUTH_EAST,
-    SOUTH,
-    SOUTH_WEST,
-    WEST
-};
-
-// TODO: should seed RNG
+
+// how many maps are kept generated ahead of the new map key
+const int MAP_POOL_SIZE = 2;
+
+// how many steps away the hero notices critters
+const int HERO_HUNT_RANGE = 64;
 
 int main(int argc, char *args[])
 {
     // prepare resources that will live for the entirety of the runtime
-    // FIXME: total_entities should be dynamic based on how many possible entities there are
     GameState game_state =
         { .last_input = NONE, .end_turn = false, .status = INIT,
-          .current_player = 0, .current_turn = 0, .total_entities = 3 };
+          .current_player = 0, .current_actor = ENTITY_NONE,
+          .turn_mode = TURN_SHUFFLED, .extra_critters = 0,
+          .fov_radius = 8, .launched = SDL_GetPerformanceCounter(),
+          .asset_seconds = 0, .startup_seconds = 0 };
+
+    RenderTarget render_target = { .backend = SURFACE_BACKEND,
+                                   .renderer = NULL, .vsync = true };
+
+    game_state.seed = (uint64_t)time(NULL);
+    game_state.map_options.threads = SDL_GetCPUCount();
+    game_state.level_count = 0;
+    game_state.current_level = 0;
+    game_state.save_map_file = NULL;
+    game_state.save_map_encoding = MAP_ENCODING_RAW;
+    game_state.tick_rate = 10;
+    game_state.frame_cap = 60;
+    game_state.headless = false;
+    game_state.check_cave = false;
+    game_state.bench_frames = 0;
+    game_state.bench_json = NULL;
+    game_state.trace_file = NULL;
+    game_state.map_options.connectivity = MAP_CONNECT_TUNNEL;
+    game_state.map_options.chunked = false;
+    game_state.map_options.width = 0;
+    game_state.map_options.height = 0;
+    game_state.map_options.memory_budget = 64 * 1024 * 1024;
+    game_state.map_options.chunk_directory = "world";
+    parseArguments(argc, args, &game_state, &render_target);
+
+    // needs nothing from SDL, so it's done before any of it starts
+    if (game_state.check_cave) {
+        return caveCheck() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // benchmarks want every frame as fast as it will go
+    if (game_state.bench_frames > 0) {
+        render_target.vsync = false;
+    }
+
+    // everything random in a game derives from its one seed. maps get their
+    // own stream so that gameplay rolls don't change which maps come next
+    rngSeed(&game_state.rng, game_state.seed);
+    rngSplit(&game_state.rng, &game_state.map_rng);
+    game_state.map_options.seed = rngNext(&game_state.map_rng);
 
     Camera camera = { .x = 0, .y = 0, .scale = 0 };
-    GameMap *game_map = initRandomSizedMap();
-    RenderTarget render_target;
-    Resources resources;
-    SDL_Event e;
+    GameMap *game_map = NULL;
+    if (game_state.level_count > 0) {
+        game_map = loadMap(game_state.level_files[0],
+                           &game_state.map_options.seed);
+        if (game_map == NULL) {
+            printf("Generating a new map instead\n");
+            game_state.level_count = 0;
+        }
+    }
+    if (game_map == NULL) {
+        game_map = initRandomSizedMap(&game_state.map_options);
+    }
+    Resources resources = { .view = NULL, .dirty_tiles = NULL, .atlas = NULL,
+                            .sprite_tiles = NULL, .terrain_tiles = NULL,
+                            .icon_tiles = NULL, .glyphs = NULL,
+                            .tile_variants = NULL, .entities = NULL,
+                            .spatial = NULL,
+                            .visible = NULL, .visible_capacity = 0,
+                            .opacity = NULL, .fov = NULL,
+                            .shown_fov = { .valid = false },
+                            .hero_flow = NULL, .regions = NULL };
+    game_state.turns = NULL;
+    game_state.map_pool = NULL;
 
     init(&render_target, &resources, &game_state, game_map, &camera);
 
-    while (game_state.status != EXITING) {
-        processInputs(&e, &game_state, &render_target, &camera);
-        gameUpdate(&game_state, &resources, &game_map, &render_target);
-        render(&render_target, &camera, &resources, game_map, &game_state);
+    int exit_code = EXIT_SUCCESS;
+    if (game_state.bench_frames > 0 && game_state.status != EXITING) {
+        if (runBenchmark(&game_state, &render_target, &resources, &game_map,
+                         &camera) != 0) {
+            exit_code = EXIT_FAILURE;
+        }
+        game_state.status = EXITING;
     }
 
-    SDL_FreeSurface(render_target.debug_info);
-    SDL_FreeSurface(resources.sprites);
-    SDL_FreeSurface(resources.terrain);
-    SDL_FreeSurface(resources.icons);
-    SDL_FreeSurface(resources.level);
+    runGameLoop(&game_state, &render_target, &resources, &game_map, &camera);
+
+    if (game_state.trace_file != NULL) {
+        writeProfileTrace(game_state.trace_file);
+    }
+
+    destroyTileSheet(resources.sprite_tiles);
+    destroyTileSheet(resources.terrain_tiles);
+    destroyTileSheet(resources.icon_tiles);
+    destroySpriteAtlas(resources.atlas);
+    destroyGlyphCache(resources.glyphs);
+    SDL_FreeSurface(resources.view);
+    destroyDirtyTiles(resources.dirty_tiles);
+    destroyTileVariants(resources.tile_variants);
+    destroyEntityStore(resources.entities);
+    destroySpatialIndex(resources.spatial);
+    free(resources.visible);
+    destroyOpacityMap(resources.opacity);
+    destroyFovCache(resources.fov);
+    fovFree(&resources.shown_fov);
+    destroyFlowMap(resources.hero_flow);
+    destroyMapRegions(resources.regions);
+    destroyTurnScheduler(game_state.turns);
+    destroyMapPool(game_state.map_pool);
+    destroyRendererBackend(&render_target, &resources);
     cleanup(render_target.window); // screen_surface also gets freed here, see SDL_DestroyWindow
-    return EXIT_SUCCESS;
+    return exit_code;
+}
+
+// the simulation advances in fixed ticks of 1 / tick_rate seconds no matter
+// how fast frames are drawn, so the game plays the same on any machine.
+// frames are only drawn when something was invalidated, at most frame_cap a
+// second
+// (vsync does the limiting instead when we have it), and in between the loop
+// sleeps until the next event or tick is due
+void runGameLoop(GameState *game_state, RenderTarget *render_target,
+                 Resources *resources, GameMap **game_map, Camera *camera) {
+    // never try to catch up on more than this many ticks at once, or one slow
+    // frame (a new map, a dragged window) turns into a burst of fast turns
+    const int max_ticks_per_frame = 5;
+
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 tick_length = frequency / (game_state->tick_rate > 0
+                                      ? game_state->tick_rate : 1);
+    Uint64 frame_length = game_state->frame_cap > 0
+                          ? frequency / game_state->frame_cap : 0;
+    Uint64 previous = SDL_GetPerformanceCounter();
+    Uint64 accumulator = 0;
+    SDL_Event e;
+
+    while (game_state->status != EXITING) {
+        PROFILE_BEGIN(frame);
+        PROFILE_BEGIN(input);
+        processInputs(&e, game_state, render_target, camera);
+        PROFILE_END(input);
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        accumulator += now - previous;
+        previous = now;
+        if (accumulator > tick_length * max_ticks_per_frame) {
+            accumulator = tick_length * max_ticks_per_frame;
+        }
+        PROFILE_BEGIN(update);
+        while (accumulator >= tick_length
+               && game_state->status != EXITING) {
+            gameUpdate(game_state, resources, game_map, render_target);
+            accumulator -= tick_length;
+        }
+        PROFILE_END(update);
+
+        if (game_state->status == EXITING) {
+            break;
+        }
+
+        // the HUD has something new to show every frame
+        if (profileHudShown()) {
+            invalidate(render_target, INVALID_SCENE);
+        }
+
+        Uint64 frame_start = SDL_GetPerformanceCounter();
+        PROFILE_BEGIN(render);
+        bool drawn = render(render_target, camera, resources, *game_map,
+                            game_state);
+        PROFILE_END(render);
+        PROFILE_END_FRAME(frame);
+        if (drawn) {
+            noteFirstFrame(game_state);
+        }
+        if (drawn && frame_length > 0 && !render_target->vsync) {
+            Uint64 spent = SDL_GetPerformanceCounter() - frame_start;
+            if (spent < frame_length) {
+                SDL_Delay((Uint32)((frame_length - spent) * 1000 / frequency));
+            }
+        }
+
+        // nothing left to do until the next tick, unless an event turns up
+        // first. SDL_WaitEventTimeout with no event leaves it in the queue
+        // for processInputs
+        now = SDL_GetPerformanceCounter();
+        Uint64 elapsed = accumulator + (now - previous);
+        if (elapsed < tick_length) {
+            Uint64 wait = (tick_length - elapsed) * 1000 / frequency;
+            if (wait > 0) {
+                SDL_WaitEventTimeout(NULL, (int)wait);
+            }
+        }
+    }
+}
+
+// cold start to first frame: everything from main starting to the first frame
+// being presented, printed once
+void noteFirstFrame(GameState *game_state) {
+    if (game_state->startup_seconds > 0) {
+        return;
+    }
+    game_state->startup_seconds =
+        (double)(SDL_GetPerformanceCounter() - game_state->launched)
+        / SDL_GetPerformanceFrequency();
+    printf("First frame %.1f ms after launch, %.1f ms of it on sprites\n",
+           game_state->startup_seconds * 1000.0,
+           game_state->asset_seconds * 1000.0);
 }
 
-void render(RenderTarget *render_target, Camera *camera, Resources *resources,
+void invalidate(RenderTarget *render_target, int what) {
+    render_target->invalid |= what;
+}
+
+// draws a frame if anything was invalidated since the last one and returns
+// whether it did. when only sprites moved, the surface backend redraws and
+// presents just the tiles they left and the tiles they moved to
+bool render(RenderTarget *render_target, Camera *camera, Resources *resources,
             GameMap *game_map, GameState *game_state) {
+    if (render_target->invalid == INVALID_NONE
+        && render_target->debug_info_changed == false) {
+        return false;
+    }
+
+    // streamed worlds start generating the chunks around the camera in the
+    // background before they scroll into view
+    if (game_map->chunks != NULL) {
+        SDL_Rect view = cameraView(render_target, camera);
+        int first_x, first_y, last_x, last_y;
+        visibleTiles(game_map, &view, &first_x, &first_y, &last_x, &last_y);
+        chunkedMapPrefetch(game_map->chunks, first_x, first_y, last_x, last_y);
+    }
+
+    if (render_target->backend != SURFACE_BACKEND) {
+        renderAccelerated(render_target, camera, resources, game_map,
+                          game_state);
+        render_target->invalid = INVALID_NONE;
+        return true;
+    }
+
+    // a new debug overlay may be smaller than the old one, so it takes a full
+    // redraw to get rid of the old one
+    bool full = (render_target->invalid & INVALID_ALL)
+                || render_target->resizing
+                || render_target->debug_info_changed;
+    render_target->invalid = INVALID_NONE;
+
     // any time the window is resized we must discard the old surface we got for
     // the window and acquire a new one
     if (render_target->resizing == true) {
@@ -109,53 +296,417 @@ void render(RenderTarget *render_target, Camera *camera, Resources *resources,
         render_target->resizing = false;
     }
 
-    SDL_BlitSurface(render_target->backdrop, NULL,
-        render_target->screen_surface, NULL);
+    // only the tiles under the camera are ever drawn, into a view surface the
+    // size of the camera rectangle, so the cost of a frame depends on the
+    // window and zoom rather than on the size of the map
+    SDL_Rect view = cameraView(render_target, camera);
+    bool have_view = view.w > 0 && view.h > 0
+                     && prepareViewSurface(render_target, resources,
+                                           &view) == 0;
+    SDL_Rect projection = {.x = 0, .y = 0,
+                           .h = render_target->screen_height,
+                           .w = render_target->screen_width};
+    bool scaled = view.w != projection.w || view.h != projection.h;
+
+    // the tiles sprites were drawn on last frame are restored by renderView,
+    // so collect them before it runs, then the ones it draws on this time.
+    // prepareViewSurface may have found the baked terrain stale, in which
+    // case everything is drawn anyway
+    SDL_Rect damage[MAX_DAMAGE_RECTS];
+    int damaged = 0;
+    if (!full && have_view && resources->terrain_baked) {
+        damaged = dirtyTileRects(resources->dirty_tiles, &view, damage, 0);
+    }
+    else {
+        full = true;
+    }
+
+    if (have_view) {
+        renderView(resources, game_map, game_state, &view);
+    }
+    if (!full) {
+        damaged = damaged < 0 ? damaged
+                  : dirtyTileRects(resources->dirty_tiles, &view, damage,
+                                   damaged);
+        full = damaged < 0;
+    }
+
+    if (full) {
+        SDL_BlitSurface(render_target->backdrop, NULL,
+            render_target->screen_surface, NULL);
+        PROFILE_COUNT(PROFILE_BLITS, 1);
+
+        if (have_view) {
+            SDL_Rect destination = projection;
+            PROFILE_BEGIN(camera_blit);
+            if (!scaled) {
+                SDL_BlitSurface(resources->view, NULL,
+                                render_target->screen_surface, &destination);
+            }
+            else {
+                SDL_BlitScaled(resources->view, NULL,
+                               render_target->screen_surface, &destination);
+            }
+            PROFILE_END(camera_blit);
+            PROFILE_COUNT(PROFILE_BLITS, 1);
+        }
+
+        if (render_target->debug_info_changed) {
+            updateDebugInfo(resources->glyphs, render_target, game_map,
+                            camera->scale);
+            render_target->debug_info_changed = false;
+        }
+
+        drawText(resources->glyphs, render_target->debug_text, 0, 0,
+                 render_target->screen_surface);
+        renderProfileHud(render_target, resources->glyphs);
+
+        PROFILE_BEGIN(present);
+        SDL_UpdateWindowSurface(render_target->window);
+        PROFILE_END(present);
+        return true;
+    }
+
+    // damage is in view pixels, the window is in screen pixels. unscaled, the
+    // damaged bits of the view are copied over on their own. scaled, the whole
+    // view is stretched again since stretching parts of it doesn't line up
+    // exactly, but still only the damage gets presented
+    if (scaled) {
+        SDL_Rect destination = projection;
+        PROFILE_BEGIN(camera_blit);
+        SDL_BlitScaled(resources->view, NULL, render_target->screen_surface,
+                       &destination);
+        PROFILE_END(camera_blit);
+        PROFILE_COUNT(PROFILE_BLITS, 1);
+    }
+
+    // the overlay is colour keyed, so drawing it again over parts of the
+    // screen that didn't change leaves them as they were
+    bool overlay_damaged = scaled;
+    for (int i = 0; i < damaged; i++) {
+        SDL_Rect source = damage[i];
+        SDL_Rect *screen = &damage[i];
+        if (!scaled) {
+            SDL_Rect destination = source;
+            SDL_BlitSurface(resources->view, &source,
+                            render_target->screen_surface, &destination);
+            PROFILE_COUNT(PROFILE_BLITS, 1);
+        }
+        else {
+            int left = source.x * projection.w / view.w;
+            int top = source.y * projection.h / view.h;
+            int right = ((source.x + source.w) * projection.w + view.w - 1)
+                        / view.w;
+            int bottom = ((source.y + source.h) * projection.h + view.h - 1)
+                         / view.h;
+            screen->x = left;
+            screen->y = top;
+            screen->w = right - left;
+            screen->h = bottom - top;
+        }
+
+        if (SDL_HasIntersection(screen, render_target->debug_info_rect)) {
+            overlay_damaged = true;
+        }
+    }
+
+    if (overlay_damaged) {
+        drawText(resources->glyphs, render_target->debug_text, 0, 0,
+                 render_target->screen_surface);
+    }
+
+    // the HUD changes every frame, so it is always presented too
+    SDL_Rect hud = renderProfileHud(render_target, resources->glyphs);
+    if (hud.w > 0 && damaged < MAX_DAMAGE_RECTS) {
+        damage[damaged++] = hud;
+    }
+
+    if (damaged > 0) {
+        PROFILE_BEGIN(present);
+        SDL_UpdateWindowSurfaceRects(render_target->window, damage, damaged);
+        PROFILE_END(present);
+    }
+    return true;
+}
+
+// lays out the profiler's HUD in the top right corner of the window: a graph
+// of recent frame times with its text under it, on a panel. false when the
+// HUD is hidden (or compiled out)
+bool layoutProfileHud(RenderTarget *render_target, GlyphCache *glyphs,
+                      ProfileHudLayout *layout) {
+    if (!profileHudShown()) {
+        return false;
+    }
+    const int margin = 8;
+    const int padding = 4;
+    SDL_Rect graph = {.w = 2 * PROFILE_HISTORY, .h = 64};
+    graph.x = render_target->screen_width - graph.w - margin - padding;
+    graph.y = margin + padding;
+    layout->bar_count = profileHud(layout->text, sizeof(layout->text),
+                                   layout->bars, PROFILE_HISTORY,
+                                   &layout->budget, &graph);
+
+    int text_w, text_h;
+    measureText(glyphs, layout->text, &text_w, &text_h);
+    layout->text_x = graph.x;
+    layout->text_y = graph.y + graph.h + padding;
+    int width = text_w > graph.w ? text_w : graph.w;
+    layout->panel = (SDL_Rect){.x = graph.x - padding, .y = margin,
+                               .w = width + 2 * padding,
+                               .h = graph.h + text_h + 3 * padding};
+    return true;
+}
+
+// draws the profiler's HUD over the window surface, returning where, or an
+// empty rectangle when there is none
+SDL_Rect renderProfileHud(RenderTarget *render_target, GlyphCache *glyphs) {
+    ProfileHudLayout layout;
+    if (!layoutProfileHud(render_target, glyphs, &layout)) {
+        return (SDL_Rect){.x = 0, .y = 0, .w = 0, .h = 0};
+    }
+    SDL_Surface *screen = render_target->screen_surface;
+    SDL_FillRect(screen, &layout.panel, SDL_MapRGB(screen->format, 16, 16, 16));
+    SDL_FillRects(screen, layout.bars, layout.bar_count,
+                  SDL_MapRGB(screen->format, 18, 180, 18));
+    SDL_FillRect(screen, &layout.budget,
+                 SDL_MapRGB(screen->format, 227, 18, 18));
+    drawText(glyphs, layout.text, layout.text_x, layout.text_y, screen);
+
+    // the panel can run off a narrow window
+    SDL_Rect covered;
+    SDL_Rect window = {.x = 0, .y = 0, .w = render_target->screen_width,
+                       .h = render_target->screen_height};
+    if (!SDL_IntersectRect(&layout.panel, &window, &covered)) {
+        covered.w = 0;
+    }
+    return covered;
+}
+
+// makes sure resources->view matches the size of the camera rectangle. the
+// terrain baked into it is only valid for one camera position, so any change
+// means baking it again
+int prepareViewSurface(RenderTarget *render_target, Resources *resources,
+                       SDL_Rect *view) {
+    if (resources->view == NULL || resources->view->w != view->w
+        || resources->view->h != view->h) {
+        SDL_FreeSurface(resources->view);
+        resources->view =
+            SDL_CreateRGBSurfaceWithFormat(0, view->w, view->h,
+                render_target->screen_surface->format->BitsPerPixel,
+                render_target->screen_surface->format->format);
+        resources->terrain_baked = false;
+
+        if (resources->view == NULL) {
+            printf("Could not create view surface! SDL_Error: %s\n",
+                   SDL_GetError());
+            return -1;
+        }
+    }
+
+    if (resources->baked_view.x != view->x
+        || resources->baked_view.y != view->y) {
+        resources->terrain_baked = false;
+    }
+
+    return 0;
+}
 
-    renderTerrain(resources->terrain, game_map, resources->level);
+// draws the terrain, direction icon and critters under the camera into the
+// view surface
+void renderView(Resources *resources, GameMap *game_map, GameState *game_state,
+                SDL_Rect *view) {
+    // the terrain only changes when a new map is generated or the camera moves,
+    // so it is baked into the view surface once. after that we only repair the
+    // tiles that sprites and icons were drawn over during the previous frame,
+    // and those that came into or went out of sight
+    FovResult *fov = &resources->shown_fov;
+    updateViewFov(resources, game_map, game_state,
+                  resources->terrain_baked ? resources->dirty_tiles : NULL);
+
+    if (resources->terrain_baked == false) {
+        int first_x, first_y, last_x, last_y;
+        visibleTiles(game_map, view, &first_x, &first_y, &last_x, &last_y);
+
+        SDL_FillRect(resources->view, NULL, 0);
+        PROFILE_BEGIN(render_terrain);
+        renderTerrain(resources->terrain_tiles, game_map, resources->tile_variants,
+                      fov, view, resources->view);
+        PROFILE_END(render_terrain);
+        resetDirtyTiles(resources->dirty_tiles, first_x, first_y,
+                        last_x - first_x, last_y - first_y);
+        resources->baked_view = *view;
+        resources->terrain_baked = true;
+    }
+    else {
+        PROFILE_BEGIN(restore_terrain);
+        restoreDirtyTiles(resources->terrain_tiles, resources->tile_variants,
+                          fov, view, resources->view, resources->dirty_tiles);
+        PROFILE_END(restore_terrain);
+    }
 
     if (game_state->last_input != NONE && game_state->end_turn == false) {
-        renderDirectionIcon(resources->icons, resources->entity_list,
-                            resources->level, game_state);
+        renderDirectionIcon(resources->icon_tiles, resources->entities, view,
+                            resources->view, game_state,
+                            resources->dirty_tiles);
     }
 
-    place(resources->entity_list[0], resources->level);
-    place(resources->entity_list[1], resources->level);
-    place(resources->entity_list[2], resources->level);
+    EntityStore *entities = resources->entities;
+    int visible = visibleEntities(resources, view);
+    for (int i = 0; i < visible; i++) {
+        int index = entityIndex(entities, resources->visible[i]);
+        int x = entities->x[index];
+        int y = entities->y[index];
+        if (!tileShown(fov, x / TILE_SIZE, y / TILE_SIZE)) {
+            continue;
+        }
+        placeTile(resources->sprite_tiles, entities->sprite_ID[index], 0,
+                  x - view->x, y - view->y, resources->view);
+        markDirtyTile(resources->dirty_tiles, x, y);
+    }
+}
 
-    SDL_Rect cameraRect = {.x = camera->x, .y = camera->y};
-    cameraRect.h = render_target->screen_height
-                   + (camera->scale * (render_target->screen_height/100));
+// whether the tile at x, y is drawn with fov. everything is when there is no
+// field of view
+bool tileShown(FovResult *fov, int x, int y) {
+    return !fov->valid || fovVisible(fov, x, y);
+}
 
-    cameraRect.w = render_target->screen_width
-                   + (camera->scale * (render_target->screen_width/100));
+static void markFovDirty(DirtyTiles *dirty_tiles, FovResult *fov) {
+    if (!fov->valid) {
+        return;
+    }
+    for (int y = fov->y - fov->radius; y <= fov->y + fov->radius; y++) {
+        for (int x = fov->x - fov->radius; x <= fov->x + fov->radius; x++) {
+            markDirtyTile(dirty_tiles, x * TILE_SIZE, y * TILE_SIZE);
+        }
+    }
+}
 
-    SDL_Rect projection = {.x = 0, .y = 0, .h = render_target->screen_height,
-                                           .w = render_target->screen_width};
+// points resources->shown_fov at what the entity whose turn it is can see,
+// and returns whether that changed. with dirty_tiles, the tiles that may have
+// come into or gone out of sight are marked on it
+bool updateViewFov(Resources *resources, GameMap *game_map,
+                   GameState *game_state, DirtyTiles *dirty_tiles) {
+    FovResult *shown = &resources->shown_fov;
+    EntityStore *entities = resources->entities;
+    int index = game_state->current_player;
+    FovResult *fov = NULL;
+    if (game_state->fov_radius > 0 && index >= 0 && index < entities->count) {
+        int x = entities->x[index] / TILE_SIZE;
+        int y = entities->y[index] / TILE_SIZE;
+        int radius = game_state->fov_radius;
+        if (ensureOpacityMap(resources->opacity, game_map, x - radius,
+                             y - radius, x + radius + 1,
+                             y + radius + 1) == 0) {
+            fov = fovFor(resources->fov, resources->opacity,
+                         entities->handle[index], x, y, radius);
+        }
+    }
 
-    SDL_BlitScaled(resources->level, &cameraRect, render_target->screen_surface,
-                   &projection);
+    if (fov == NULL) {
+        // nobody to see through, so everything is drawn
+        if (!shown->valid) {
+            return false;
+        }
+        if (dirty_tiles != NULL) {
+            markFovDirty(dirty_tiles, shown);
+        }
+        shown->valid = false;
+        return true;
+    }
+    if (shown->valid && shown->x == fov->x && shown->y == fov->y
+        && shown->radius == fov->radius && shown->build == fov->build
+        && shown->version == fov->version) {
+        return false;
+    }
 
-    if (render_target->debug_info_changed) {
-        SDL_FreeSurface(render_target->debug_info);
-        render_target->debug_info = updateDebugInfo(resources->game_font,
-                                        render_target, game_map, camera->scale);
+    if (dirty_tiles != NULL) {
+        markFovDirty(dirty_tiles, shown);
+    }
+    fovCopy(shown, fov);
+    if (dirty_tiles != NULL) {
+        markFovDirty(dirty_tiles, shown);
+    }
+    return true;
+}
 
-        render_target->debug_info_rect->h = render_target->debug_info->h;
-        render_target->debug_info_rect->w = render_target->debug_info->w;
-        render_target->debug_info_changed = false;
+// collects the entities whose sprites overlap view into resources->visible
+// and returns how many there are. asks the spatial index, so a crowd off
+// screen costs nothing
+int visibleEntities(Resources *resources, SDL_Rect *view) {
+    // entities sit on whole tiles, so these are the tiles view touches
+    int first_x = view->x >= 0 ? view->x / TILE_SIZE
+                               : -((-view->x + TILE_SIZE - 1) / TILE_SIZE);
+    int first_y = view->y >= 0 ? view->y / TILE_SIZE
+                               : -((-view->y + TILE_SIZE - 1) / TILE_SIZE);
+    int last_x = (view->x + view->w + TILE_SIZE - 1) / TILE_SIZE;
+    int last_y = (view->y + view->h + TILE_SIZE - 1) / TILE_SIZE;
+
+    for (;;) {
+        int count = spatialQueryRect(resources->spatial, first_x, first_y,
+                                     last_x - 1, last_y - 1,
+                                     resources->visible,
+                                     resources->visible_capacity);
+        if (count <= resources->visible_capacity) {
+            return count;
+        }
+        // didn't fit, grow and ask again
+        Entity *visible = (Entity *)
+            realloc(resources->visible, sizeof(Entity) * count * 2);
+        if (visible == NULL) {
+            printf("Could not grow the visible entity list!\n");
+            return resources->visible_capacity;
+        }
+        resources->visible = visible;
+        resources->visible_capacity = count * 2;
     }
+}
+
+// the part of the level the camera sees, in level pixels. it gets stretched
+// to fill the window, so a larger scale value zooms out
+SDL_Rect cameraView(RenderTarget *render_target, Camera *camera) {
+    SDL_Rect view = {.x = camera->x, .y = camera->y};
+    view.h = render_target->screen_height
+             + (camera->scale * (render_target->screen_height/100));
 
-    SDL_BlitSurface(render_target->debug_info, render_target->debug_info_rect,
-        render_target->screen_surface, render_target->debug_info_rect);
+    view.w = render_target->screen_width
+             + (camera->scale * (render_target->screen_width/100));
 
-    SDL_UpdateWindowSurface(render_target->window);
+    return view;
 }
 
-SDL_Surface * updateDebugInfo(TTF_Font *font, RenderTarget *render_target,
-                              GameMap *game_map, int camera_scale) {
-    char debugCameraText[200];
-    snprintf(debugCameraText, 200,
+// works out the range of map tiles at least partly inside view. first_x and
+// first_y are inclusive, last_x and last_y exclusive. the range is empty when
+// the camera is looking entirely off the map
+void visibleTiles(GameMap *game_map, SDL_Rect *view, int *first_x, int *first_y,
+                  int *last_x, int *last_y) {
+    // round towards negative infinity so views left of or above the map work
+    *first_x = view->x >= 0 ? view->x / TILE_SIZE
+                            : -((-view->x + TILE_SIZE - 1) / TILE_SIZE);
+    *first_y = view->y >= 0 ? view->y / TILE_SIZE
+                            : -((-view->y + TILE_SIZE - 1) / TILE_SIZE);
+    *last_x = (view->x + view->w + TILE_SIZE - 1) / TILE_SIZE;
+    *last_y = (view->y + view->h + TILE_SIZE - 1) / TILE_SIZE;
+
+    *first_x = *first_x < 0 ? 0 : *first_x;
+    *first_y = *first_y < 0 ? 0 : *first_y;
+    *last_x = *last_x > game_map->width ? game_map->width : *last_x;
+    *last_y = *last_y > game_map->height ? game_map->height : *last_y;
+    *last_x = *last_x < *first_x ? *first_x : *last_x;
+    *last_y = *last_y < *first_y ? *first_y : *last_y;
+}
+
+// whether a TILE_SIZE sprite at x, y (in level pixels) overlaps view at all
+bool inView(SDL_Rect *view, int x, int y) {
+    return x + TILE_SIZE > view->x && x < view->x + view->w
+           && y + TILE_SIZE > view->y && y < view->y + view->h;
+}
+
+// rewrites the debug overlay's text and works out the rectangle it covers.
+// the text is drawn from the glyph cache, so this is all it takes
+void updateDebugInfo(GlyphCache *glyphs, RenderTarget *render_target,
+                     GameMap *game_map, int camera_scale) {
+    snprintf(render_target->debug_text, sizeof(render_target->debug_text),
         "   resolution: %dx%d\n"
         "  scale value: %d\n"
         " scaled width: %d\n"
@@ -172,64 +723,82 @@ SDL_Surface * updateDebugInfo(TTF_Font *font, RenderTarget *render_target,
         game_map->width, game_map->width * TILE_SIZE,
         game_map->height, game_map->height * TILE_SIZE);
 
-    SDL_Color yellow = {.r = 227, .g = 227, .b = 18};
-    return TTF_RenderUTF8_Solid_Wrapped(font, debugCameraText, yellow, 0);
+    measureText(glyphs, render_target->debug_text,
+                &render_target->debug_info_rect->w,
+                &render_target->debug_info_rect->h);
 }
 
 
-void renderDirectionIcon(SDL_Surface *icons, Critter *entity_list,
-    SDL_Surface *destination, GameState *game_state) {
+// works out which arrow to show for the current input and where it goes, in
+// level pixels. returns EMPTY when the input has no direction
+int directionIcon(GameState *game_state, EntityStore *entities, int *x,
+                  int *y) {
+    int direction = EMPTY;
+    *x = entities->x[game_state->current_player];
+    *y = entities->y[game_state->current_player];
 
     switch (game_state->last_input) {
         case DOWN_LEFT:
-        placeTile(icons, 0, SOUTH_WEST,
-            entity_list[game_state->current_player].x - TILE_SIZE,
-            entity_list[game_state->current_player].y + TILE_SIZE, destination);
+        direction = SOUTH_WEST;
+        *x -= TILE_SIZE;
+        *y += TILE_SIZE;
         break;
 
         case DOWN:
-        placeTile(icons, 0, SOUTH,
-            entity_list[game_state->current_player].x,
-            entity_list[game_state->current_player].y + TILE_SIZE, destination);
+        direction = SOUTH;
+        *y += TILE_SIZE;
         break;
 
         case DOWN_RIGHT:
-        placeTile(icons, 0, SOUTH_EAST,
-            entity_list[game_state->current_player].x + TILE_SIZE,
-            entity_list[game_state->current_player].y + TILE_SIZE, destination);
+        direction = SOUTH_EAST;
+        *x += TILE_SIZE;
+        *y += TILE_SIZE;
         break;
 
         case RIGHT:
-        placeTile(icons, 0, EAST,
-            entity_list[game_state->current_player].x + TILE_SIZE,
-            entity_list[game_state->current_player].y, destination);
+        direction = EAST;
+        *x += TILE_SIZE;
         break;
 
         case UP_RIGHT:
-        placeTile(icons, 0, NORTH_EAST,
-            entity_list[game_state->current_player].x + TILE_SIZE,
-            entity_list[game_state->current_player].y - TILE_SIZE, destination);
+        direction = NORTH_EAST;
+        *x += TILE_SIZE;
+        *y -= TILE_SIZE;
         break;
 
         case UP:
-        placeTile(icons, 0, NORTH,
-            entity_list[game_state->current_player].x,
-            entity_list[game_state->current_player].y - TILE_SIZE, destination);
+        direction = NORTH;
+        *y -= TILE_SIZE;
         break;
 
         case UP_LEFT:
-        placeTile(icons, 0, NORTH_WEST,
-            entity_list[game_state->current_player].x - TILE_SIZE,
-            entity_list[game_state->current_player].y - TILE_SIZE, destination);
+        direction = NORTH_WEST;
+        *x -= TILE_SIZE;
+        *y -= TILE_SIZE;
         break;
 
         case LEFT:
-        placeTile(icons, 0, WEST,
-            entity_list[game_state->current_player].x - TILE_SIZE,
-            entity_list[game_state->current_player].y, destination);
+        direction = WEST;
+        *x -= TILE_SIZE;
         break;
     }
 
+    return direction;
+}
+
+void renderDirectionIcon(TileSheet *icons, EntityStore *entities,
+    SDL_Rect *view, SDL_Surface *destination, GameState *game_state,
+    DirtyTiles *dirty_tiles) {
+
+    int x, y;
+    int direction = directionIcon(game_state, entities, &x, &y);
+    if (direction == EMPTY || !inView(view, x, y)) {
+        return;
+    }
+
+    placeTile(icons, 0, direction, x - view->x, y - view->y, destination);
+    markDirtyTile(dirty_tiles, x, y);
+
     return;
 }
 
@@ -246,28 +815,72 @@ void gameUpdate(GameState *game_state, Resources *resources, GameMap **game_map,
         game_state->status = NEW_GAME;
     }
 
-    if (game_state->last_input == DEBUG_GENERATE_NEW_MAP) {
-        replaceMap(&(*game_map));
-        SDL_FreeSurface(resources->level);
-        resources->level =
-            SDL_CreateRGBSurfaceWithFormat(0,
-                (*game_map)->width * TILE_SIZE, (*game_map)->height * TILE_SIZE,
-                render_target->screen_surface->format->BitsPerPixel,
-                render_target->screen_surface->format->format);
+    if (game_state->last_input == DEBUG_GENERATE_NEW_MAP
+        && game_state->level_count > 0) {
+        // with saved levels, cycle through those instead. keeps the current
+        // one if the next won't load
+        game_state->current_level =
+            (game_state->current_level + 1) % game_state->level_count;
+        uint64_t seed;
+        GameMap *next_map =
+            loadMap(game_state->level_files[game_state->current_level], &seed);
+        if (next_map != NULL) {
+            destroyMap(*game_map);
+            *game_map = next_map;
+            game_state->map_options.seed = seed;
+            mapReplaced(resources, *game_map, game_state, false);
+        }
+        invalidate(render_target, INVALID_ALL);
 
         render_target->debug_info_changed = true;
         game_state->last_input = NONE;
     }
+    else if (game_state->last_input == DEBUG_GENERATE_NEW_MAP) {
+        // the pool only ever makes the frame wait when asked for maps faster
+        // than it can make them
+        PooledMap next;
+        if (game_state->map_pool != NULL
+            && takePooledMap(game_state->map_pool, &next, true)) {
+            PooledMap old = { .game_map = *game_map,
+                              .regions = resources->regions,
+                              .variants = resources->tile_variants };
+            *game_map = next.game_map;
+            resources->regions = next.regions;
+            resources->tile_variants = next.variants;
+            game_state->map_options.seed = next.seed;
+            retirePooledMap(game_state->map_pool, &old);
+            mapReplaced(resources, *game_map, game_state, true);
+        }
+        else {
+            game_state->map_options.seed = rngNext(&game_state->map_rng);
+            replaceMap(&(*game_map), &game_state->map_options);
+            mapReplaced(resources, *game_map, game_state, false);
+        }
+        invalidate(render_target, INVALID_ALL);
 
-    if (game_state->turn_order[game_state->current_turn] == -1) {
-        game_state->current_turn = 0;
-        shuffleTurnOrder(&game_state->turn_order, game_state->total_entities);
+        render_target->debug_info_changed = true;
+        game_state->last_input = NONE;
     }
 
+    // whoever has the turn keeps it until they end it. anything removed in
+    // the meantime just loses it
+    EntityStore *entities = resources->entities;
+    if (entityIndex(entities, game_state->current_actor) < 0) {
+        game_state->current_actor =
+            nextTurn(game_state->turns, entities, &game_state->rng);
+        if (game_state->current_actor == ENTITY_NONE) {
+            return;
+        }
+        // the view shows what the new actor sees
+        if (game_state->fov_radius > 0) {
+            invalidate(render_target, INVALID_SCENE);
+        }
+    }
     game_state->current_player =
-        game_state->turn_order[game_state->current_turn] - 1;
+        entityIndex(entities, game_state->current_actor);
+    int player = game_state->current_player;
 
-    if (resources->entity_list[game_state->current_player].sprite_ID == HERO) {
+    if (entities->flags[player] & ENTITY_HERO) {
         game_state->status = HERO_TURN;
     }
     else {
@@ -275,62 +888,74 @@ void gameUpdate(GameState *game_state, Resources *resources, GameMap **game_map,
     }
 
     if (game_state->status == HERO_TURN) {
-        resources->entity_list[game_state->current_player].x += TILE_SIZE;
-        game_state->current_turn += 1;
+        moveHero(resources, *game_map, player);
+        game_state->current_actor = ENTITY_NONE;
+        invalidate(render_target, INVALID_SCENE);
     }
 
     if (game_state->end_turn == true){
+        int dx = 0;
+        int dy = 0;
         switch (game_state->last_input) {
             case DOWN_LEFT:
-            resources->entity_list[game_state->current_player].x -= TILE_SIZE;
-            resources->entity_list[game_state->current_player].y += TILE_SIZE;
+            dx = -1;
+            dy = 1;
             break;
 
             case DOWN:
-            resources->entity_list[game_state->current_player].y += TILE_SIZE;
+            dy = 1;
             break;
 
             case DOWN_RIGHT:
-            resources->entity_list[game_state->current_player].x += TILE_SIZE;
-            resources->entity_list[game_state->current_player].y += TILE_SIZE;
+            dx = 1;
+            dy = 1;
             break;
 
             case RIGHT:
-            resources->entity_list[game_state->current_player].x += TILE_SIZE;
+            dx = 1;
             break;
 
             case UP_RIGHT:
-            resources->entity_list[game_state->current_player].x += TILE_SIZE;
-            resources->entity_list[game_state->current_player].y -= TILE_SIZE;
+            dx = 1;
+            dy = -1;
             break;
 
             case UP:
-            resources->entity_list[game_state->current_player].y -= TILE_SIZE;
+            dy = -1;
             break;
 
             case UP_LEFT:
-            resources->entity_list[game_state->current_player].x -= TILE_SIZE;
-            resources->entity_list[game_state->current_player].y -= TILE_SIZE;
+            dx = -1;
+            dy = -1;
             break;
 
             case LEFT:
-            resources->entity_list[game_state->current_player].x -= TILE_SIZE;
+            dx = -1;
             break;
         }
-        game_state->current_turn += 1;
+        // bumping into something still uses up the turn
+        if (dx != 0 || dy != 0) {
+            moveEntity(resources, *game_map, player, dx, dy);
+        }
+        game_state->current_actor = ENTITY_NONE;
         game_state->last_input = NONE;
         game_state->end_turn = false;
+        invalidate(render_target, INVALID_SCENE);
     }
 
     return;
 }
 
-void processInputs(SDL_Event *e, GameState *game_state,
+// returns whether any event came in, in which case the next frame may look
+// different
+bool processInputs(SDL_Event *e, GameState *game_state,
                    RenderTarget *render_target, Camera *camera) {
+    bool handled = false;
     while (SDL_PollEvent(e)) {
+        handled = true;
         if (e->type == SDL_QUIT) {
             game_state->status = EXITING;
-            return;
+            return handled;
         }
         if (e->type == SDL_WINDOWEVENT){
             if (e->window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
@@ -340,10 +965,18 @@ void processInputs(SDL_Event *e, GameState *game_state,
                 printf("new screen height: %d\n", render_target->screen_height);
                 render_target->debug_info_changed = true;
                 render_target->resizing = true;
+                invalidate(render_target, INVALID_ALL);
+            }
+            // the window system lost what was on screen
+            if (e->window.event == SDL_WINDOWEVENT_EXPOSED) {
+                invalidate(render_target, INVALID_ALL);
             }
         }
 
+        // any key may change or clear the direction icon. the camera keys
+        // below move everything
         if (e->type == SDL_KEYDOWN) {
+            invalidate(render_target, INVALID_SCENE);
             switch (e->key.keysym.sym) {
                 case SDLK_KP_1:
                 game_state->last_input = DOWN_LEFT;
@@ -393,132 +1026,421 @@ void processInputs(SDL_Event *e, GameState *game_state,
                 // TODO: change these keys to fully qualified camera events (zoom in, zoom out etc)
                 case SDLK_w:
                 camera->y -= 5;
+                invalidate(render_target, INVALID_ALL);
                 break;
 
                 case SDLK_a:
                 camera->x -= 5;
+                invalidate(render_target, INVALID_ALL);
                 break;
 
                 case SDLK_s:
                 camera->y += 5;
+                invalidate(render_target, INVALID_ALL);
                 break;
 
                 case SDLK_d:
                 camera->x +=5;
+                invalidate(render_target, INVALID_ALL);
                 break;
 
                 case SDLK_EQUALS:
                 camera->scale += 1;
                 render_target->debug_info_changed = true;
+                invalidate(render_target, INVALID_ALL);
                 break;
 
                 case SDLK_MINUS:
                 camera->scale -= 1;
                 render_target->debug_info_changed = true;
+                invalidate(render_target, INVALID_ALL);
                 break;
 
                 case SDLK_0:
                 camera->scale = 0;
                 render_target->debug_info_changed = true;
+                invalidate(render_target, INVALID_ALL);
+                break;
+
+                // the profiler, in builds that have it. hiding the HUD takes
+                // a full redraw to get rid of it
+                case SDLK_F3:
+                toggleProfileHud();
+                invalidate(render_target, INVALID_ALL);
+                break;
+
+                case SDLK_F12:
+                writeProfileTrace(game_state->trace_file != NULL
+                                  ? game_state->trace_file
+                                  : "yarz-trace.json");
                 break;
             }
         }
     }
 
-    return;
+    return handled;
 }
 
-void renderTerrain(SDL_Surface *terrain_map, GameMap *game_map,
-                   SDL_Surface *destination) {
-    enum tileset {
-        CAVE,
-        FLOOR,
-        WALLS
-    };
-    enum wall {
-        NORTH,
-        SOUTH,
-        EAST,
-        WEST
-    };
-    for (int i = 0; i < game_map->width; i++) {
-        for (int j = 0; j < game_map->height; j++) {
-            if ((game_map->map_array)[i][j] == 0) {
-                placeTile(terrain_map, FLOOR, 0,
-                          i * TILE_SIZE, j * TILE_SIZE, destination);
-            }
-            if ((game_map->map_array)[i][j] == 1) {
-                placeTile(terrain_map, CAVE, 0,
-                          i * TILE_SIZE, j * TILE_SIZE, destination);
+// picks the row of assets/yarz-terrain.png a map tile is drawn with
+int terrainSprite(int tile) {
+    switch (tile) {
+        case MAP_FLOOR:
+        return FLOOR;
+
+        default:
+        return CAVE;
+    }
+}
+
+// draws every map tile inside view, positioned relative to the view. this
+// should only be needed when the view is first baked; see restoreDirtyTiles
+// for the per-frame path
+void renderTerrain(TileSheet *terrain_map, GameMap *game_map,
+                   TileVariants *tile_variants, FovResult *fov,
+                   SDL_Rect *view, SDL_Surface *destination) {
+    int first_x, first_y, last_x, last_y;
+    visibleTiles(game_map, view, &first_x, &first_y, &last_x, &last_y);
+    // all of view, so the tiles restoreDirtyTiles redraws later are in too
+    if (ensureTileVariants(tile_variants, game_map, first_x, first_y, last_x,
+                           last_y) != 0) {
+        return;
+    }
+    if (fov->valid) {
+        fovClip(fov, &first_x, &first_y, &last_x, &last_y);
+    }
+
+    for (int y = first_y; y < last_y; y++) {
+        for (int x = first_x; x < last_x; x++) {
+            if (tileShown(fov, x, y)) {
+                renderTerrainTile(terrain_map, tile_variants, x, y, view,
+                                  destination);
             }
         }
     }
 }
 
-void place(Critter sprite, SDL_Surface *destination) {
-    SDL_Rect source_rect = { .h = TILE_SIZE, .w = TILE_SIZE, .x = 0,
-                             .y = sprite.sprite_ID * TILE_SIZE };
-    SDL_Rect destination_rect = { .h = 0, .w = 0,
-                                  .x = sprite.x, .y = sprite.y };
+// x and y are in tiles, and have to be inside the cached variants. the tile
+// is drawn, then its wall edges on top
+void renderTerrainTile(TileSheet *terrain_map, TileVariants *tile_variants,
+                       int x, int y, SDL_Rect *view, SDL_Surface *destination) {
+    TileVariant variant = tileVariantAt(tile_variants, x, y);
+    int edges = tileVariantEdges(variant);
+    placeTile(terrain_map, terrainSprite(tileVariantTile(variant)), 0,
+              x * TILE_SIZE - view->x, y * TILE_SIZE - view->y, destination);
+    for (int edge = 0; edges != 0; edge++, edges >>= 1) {
+        if (edges & 1) {
+            placeTile(terrain_map, WALLS, edge, x * TILE_SIZE - view->x,
+                      y * TILE_SIZE - view->y, destination);
+        }
+    }
+}
+
+DirtyTiles* initDirtyTiles() {
+    DirtyTiles *dirty_tiles = (DirtyTiles *) malloc(sizeof(DirtyTiles));
+    dirty_tiles->x = 0;
+    dirty_tiles->y = 0;
+    dirty_tiles->width = 0;
+    dirty_tiles->height = 0;
+    dirty_tiles->capacity = 0;
+    dirty_tiles->marked = NULL;
+    dirty_tiles->list = NULL;
+    dirty_tiles->count = 0;
+    return dirty_tiles;
+}
 
-    SDL_BlitSurface(sprite.source_sprite_map, &source_rect,
-                    destination, &destination_rect);
+// points the tracker at a new block of map tiles (in tiles) and forgets
+// anything marked so far. the buffers only grow when a bigger view shows up
+void resetDirtyTiles(DirtyTiles *dirty_tiles, int x, int y, int width,
+                     int height) {
+    int tiles = width * height;
+    if (tiles > dirty_tiles->capacity) {
+        free(dirty_tiles->marked);
+        free(dirty_tiles->list);
+        dirty_tiles->marked = (bool *) malloc(sizeof(bool) * tiles);
+        dirty_tiles->list = (int *) malloc(sizeof(int) * tiles);
+        dirty_tiles->capacity = tiles;
+    }
 
+    dirty_tiles->x = x;
+    dirty_tiles->y = y;
+    dirty_tiles->width = width;
+    dirty_tiles->height = height;
+    dirty_tiles->count = 0;
+    if (tiles > 0) {
+        memset(dirty_tiles->marked, 0, sizeof(bool) * tiles);
+    }
 }
 
-void placeTile(SDL_Surface *src, int sprite, int offset, int x, int y,
-               SDL_Surface *destination) {
+// x and y are in pixels, same as entities. anything outside the tracked block
+// is ignored since there is no baked terrain there to restore
+void markDirtyTile(DirtyTiles *dirty_tiles, int x, int y) {
+    if (x < 0 || y < 0) {
+        return;
+    }
+
+    int tile_x = x / TILE_SIZE - dirty_tiles->x;
+    int tile_y = y / TILE_SIZE - dirty_tiles->y;
+    if (tile_x < 0 || tile_y < 0
+        || tile_x >= dirty_tiles->width || tile_y >= dirty_tiles->height) {
+        return;
+    }
+
+    int index = tile_y * dirty_tiles->width + tile_x;
+    if (dirty_tiles->marked[index] == false) {
+        dirty_tiles->marked[index] = true;
+        dirty_tiles->list[dirty_tiles->count] = index;
+        dirty_tiles->count++;
+    }
+}
+
+// appends the marked tiles to rects as rectangles in view pixels, clipped to
+// the view, starting at index count. returns the new count, or -1 if they
+// don't all fit in MAX_DAMAGE_RECTS
+int dirtyTileRects(DirtyTiles *dirty_tiles, SDL_Rect *view, SDL_Rect *rects,
+                   int count) {
+    for (int i = 0; i < dirty_tiles->count; i++) {
+        int index = dirty_tiles->list[i];
+        int left = (dirty_tiles->x + index % dirty_tiles->width) * TILE_SIZE
+                   - view->x;
+        int top = (dirty_tiles->y + index / dirty_tiles->width) * TILE_SIZE
+                  - view->y;
+        int right = left + TILE_SIZE > view->w ? view->w : left + TILE_SIZE;
+        int bottom = top + TILE_SIZE > view->h ? view->h : top + TILE_SIZE;
+        left = left < 0 ? 0 : left;
+        top = top < 0 ? 0 : top;
+        if (right <= left || bottom <= top) {
+            continue;
+        }
 
-    SDL_Rect source_rect = {.h = TILE_SIZE, .w = TILE_SIZE,
-                            .x = offset * TILE_SIZE, .y = sprite * TILE_SIZE};
+        if (count == MAX_DAMAGE_RECTS) {
+            return -1;
+        }
+        rects[count].x = left;
+        rects[count].y = top;
+        rects[count].w = right - left;
+        rects[count].h = bottom - top;
+        count++;
+    }
+    return count;
+}
+
+// redraws the terrain under every tile marked since the last call
+void restoreDirtyTiles(TileSheet *terrain_map, TileVariants *tile_variants,
+                       FovResult *fov, SDL_Rect *view, SDL_Surface *destination,
+                       DirtyTiles *dirty_tiles) {
+    for (int i = 0; i < dirty_tiles->count; i++) {
+        int index = dirty_tiles->list[i];
+        int x = dirty_tiles->x + index % dirty_tiles->width;
+        int y = dirty_tiles->y + index / dirty_tiles->width;
+
+        // the terrain sheet is colour keyed, so clear the tile back to the
+        // view's initial black first or bits of the old sprite show through
+        SDL_Rect tile_rect = {.h = TILE_SIZE, .w = TILE_SIZE,
+                              .x = x * TILE_SIZE - view->x,
+                              .y = y * TILE_SIZE - view->y};
+        SDL_FillRect(destination, &tile_rect, 0);
+        if (tileShown(fov, x, y)) {
+            renderTerrainTile(terrain_map, tile_variants, x, y, view,
+                              destination);
+        }
 
-    SDL_Rect destination_rect = {.h = 0, .w = 0, .x = x, .y = y};
+        dirty_tiles->marked[index] = false;
+    }
+    dirty_tiles->count = 0;
+}
+
+void destroyDirtyTiles(DirtyTiles *dirty_tiles) {
+    if (dirty_tiles == NULL) {
+        return;
+    }
+    free(dirty_tiles->marked);
+    free(dirty_tiles->list);
+    free(dirty_tiles);
+}
 
-    SDL_BlitSurface(src, &source_rect, destination, &destination_rect);
+void placeTile(TileSheet *src, int sprite, int offset, int x, int y,
+               SDL_Surface *destination) {
+    blitTile(src, sprite, offset, x, y, destination);
+    PROFILE_COUNT(PROFILE_BLITS, 1);
     return;
 }
 
-void shuffleTurnOrder(int **turn_order, int number_of_entities) {
-    //set up temporary pool of entities
-    int pool[number_of_entities];
-    memset(pool, 0, number_of_entities*sizeof(int));
+// moves the entity at index by dx, dy tiles, if it can go there: only onto
+// floor, and not onto anyone else. returns whether it moved
+bool moveEntity(Resources *resources, GameMap *game_map, int index, int dx,
+                int dy) {
+    EntityStore *entities = resources->entities;
+    int x = entities->x[index] / TILE_SIZE + dx;
+    int y = entities->y[index] / TILE_SIZE + dy;
+    if (game_map->chunks == NULL
+        && (x < 0 || y < 0 || x >= game_map->width || y >= game_map->height)) {
+        return false;
+    }
+    if (mapTileAt(game_map, x, y) != MAP_FLOOR
+        || spatialOccupied(resources->spatial, x, y)) {
+        return false;
+    }
+    entities->x[index] = x * TILE_SIZE;
+    entities->y[index] = y * TILE_SIZE;
+    spatialMove(resources->spatial, entities->handle[index], x, y);
+    return true;
+}
 
-    //seed the pool
-    for (int i = 0; i < number_of_entities; i++) {
-        pool[i] = i+1;
+// steps the hero at index towards the nearest critter, or leaves it be if
+// none are in range. the flow map is one breadth first search out from every
+// critter at once, done once a turn, and any number of hunters could follow
+// it for free
+void moveHero(Resources *resources, GameMap *game_map, int index) {
+    EntityStore *entities = resources->entities;
+    FlowMap *flow = resources->hero_flow;
+    int x = entities->x[index] / TILE_SIZE;
+    int y = entities->y[index] / TILE_SIZE;
+    if (ensureOpacityMap(resources->opacity, game_map, x - HERO_HUNT_RANGE,
+                         y - HERO_HUNT_RANGE, x + HERO_HUNT_RANGE + 1,
+                         y + HERO_HUNT_RANGE + 1) != 0
+        || clearFlowMap(flow, resources->opacity) != 0) {
+        return;
     }
 
-    bool doneDrawing = false;
-    int remaining = number_of_entities;
-    int index = 0;
-    while (!doneDrawing) {
-        int draw = randomRange(0, number_of_entities - 1);
-        if (pool[draw] != 0) {
-            (*turn_order)[index] = pool[draw];
-            pool[draw] = 0;
-            index++;
-            remaining--;
+    SDL_Rect range = { (x - HERO_HUNT_RANGE) * TILE_SIZE,
+                       (y - HERO_HUNT_RANGE) * TILE_SIZE,
+                       (HERO_HUNT_RANGE * 2 + 1) * TILE_SIZE,
+                       (HERO_HUNT_RANGE * 2 + 1) * TILE_SIZE };
+    int found = visibleEntities(resources, &range);
+    for (int i = 0; i < found; i++) {
+        int critter = entityIndex(entities, resources->visible[i]);
+        if (critter >= 0 && !(entities->flags[critter] & ENTITY_HERO)) {
+            addFlowSource(flow, entities->x[critter] / TILE_SIZE,
+                          entities->y[critter] / TILE_SIZE);
         }
-        if (remaining == 0) {
-            doneDrawing = true;
+    }
+    computeFlowMap(flow, resources->opacity, HERO_HUNT_RANGE);
+
+    int next_x;
+    int next_y;
+    if (flowStep(flow, resources->opacity, x, y, &next_x, &next_y)) {
+        moveEntity(resources, game_map, index, next_x - x, next_y - y);
+    }
+}
+
+// forgets everything worked out from the previous map. a prepared map (see
+// MapPool) came with its regions and tile variants already worked out
+void mapReplaced(Resources *resources, GameMap *game_map,
+                 GameState *game_state, bool prepared) {
+    if (!prepared) {
+        labelRegions(resources->regions, game_map,
+                     game_state->map_options.threads);
+        resources->tile_variants->valid = false;
+    }
+    rebuildSpatialIndex(resources, game_map);
+    placeEntities(resources, &game_state->rng);
+    resources->terrain_baked = false;
+    resources->opacity->valid = false;
+}
+
+// puts every entity on a free floor tile of the map's largest region, so
+// nobody starts inside a wall or cut off from everyone else. a streamed world
+// has no regions, and leaves everyone where they are
+void placeEntities(Resources *resources, Rng *rng) {
+    MapRegions *regions = resources->regions;
+    EntityStore *entities = resources->entities;
+    if (!regions->valid || regions->largest < 0) {
+        return;
+    }
+    for (int i = 0; i < entities->count; i++) {
+        int x = 0;
+        int y = 0;
+        // a crowded cave may run out of room, then they share
+        for (int tries = 0; tries < 8; tries++) {
+            regionRandomTile(regions, regions->largest, rng, &x, &y);
+            if (!spatialOccupied(resources->spatial, x, y)) {
+                break;
+            }
         }
+        entities->x[i] = x * TILE_SIZE;
+        entities->y[i] = y * TILE_SIZE;
+        spatialMove(resources->spatial, entities->handle[i], x, y);
     }
-    (*turn_order)[index] = -1; //mark the end of shuffled players
+}
 
-    printf("Turn order is player:");
-    for (int i = 0; i < number_of_entities + 1; i++) {
-        printf(" %d", (*turn_order)[i]);
-        if (i < number_of_entities) printf(",");
-        printf(" ");
+// indexes every entity for game_map from scratch. only needed when the map
+// itself changes, since the occupancy grid is sized to it. a streamed world
+// has no end, so it goes without the grid
+int rebuildSpatialIndex(Resources *resources, GameMap *game_map) {
+    EntityStore *entities = resources->entities;
+    bool grid = game_map->chunks == NULL;
+    SpatialIndex *spatial =
+        initSpatialIndex(grid ? game_map->width : 0,
+                         grid ? game_map->height : 0, entities->slot_count);
+    if (spatial == NULL) {
+        return -1;
     }
-    printf("\n");
+    for (int i = 0; i < entities->count; i++) {
+        spatialInsert(spatial, entities->handle[i],
+                      entities->x[i] / TILE_SIZE, entities->y[i] / TILE_SIZE);
+    }
+    destroySpatialIndex(resources->spatial);
+    resources->spatial = spatial;
+    return 0;
+}
 
-    return;
+// scatters count critters over random free floor tiles of the map. on a
+// streamed world they stay near the origin so they don't drag in far away
+// chunks
+void spawnCritters(EntityStore *entities, SpatialIndex *spatial,
+                   MapRegions *regions, GameMap *game_map, Rng *rng,
+                   int count) {
+    int width = game_map->chunks != NULL ? 256 : game_map->width;
+    int height = game_map->chunks != NULL ? 256 : game_map->height;
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    // on a labelled map, only where the hero can get to
+    bool labelled = regions->valid && regions->largest >= 0;
+
+    for (int i = 0; i < count; i++) {
+        int x = 0;
+        int y = 0;
+        // walls are the common case near the edges, so a few tries are fine
+        for (int tries = 0; tries < 8; tries++) {
+            if (labelled) {
+                regionRandomTile(regions, regions->largest, rng, &x, &y);
+            }
+            else {
+                x = rngRange(rng, 0, width - 1);
+                y = rngRange(rng, 0, height - 1);
+                if (mapTileAt(game_map, x, y) != MAP_FLOOR) {
+                    continue;
+                }
+            }
+            if (!spatialOccupied(spatial, x, y)) {
+                break;
+            }
+        }
+        int sprite = rngRange(rng, LEGGY, BOOTS);
+        Entity critter =
+            addEntity(entities, sprite, x * TILE_SIZE, y * TILE_SIZE, 0);
+        if (critter == ENTITY_NONE) {
+            return;
+        }
+        spatialInsert(spatial, critter, x, y);
+        // all those legs are good for something
+        if (sprite == LEGGY) {
+            entities->speed[entityIndex(entities, critter)] =
+                ENTITY_NORMAL_SPEED * 3 / 2;
+        }
+    }
 }
 
 int init(RenderTarget *render_target, Resources *resources,
          GameState *game_state, GameMap *game_map, Camera *camera) {
 
+    // the dummy driver gives us a window surface and events without any
+    // display, which is all the game needs to run
+    if (game_state->headless) {
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("SDL not initialized! SDL_Error: %s\n", SDL_GetError());
         cleanup(NULL);
@@ -558,43 +1480,98 @@ int init(RenderTarget *render_target, Resources *resources,
         return -1;
     }
 
-    render_target->screen_surface = SDL_GetWindowSurface(render_target->window);
-    if (render_target->screen_surface == NULL) {
-        printf("Could not capture screen surface! SDL_Error: %s\n",
-               SDL_GetError());
-        cleanup(render_target->window);
-        game_state->status = EXITING;
-        return -1;
+    // a window can't mix SDL_Renderer drawing with its window surface, so the
+    // two backends part ways here. if no renderer can be had we fall back to
+    // the surface path, which works everywhere
+    if (render_target->backend != SURFACE_BACKEND
+        && initRendererBackend(render_target) < 0) {
+        printf("Falling back to surface rendering\n");
+        render_target->backend = SURFACE_BACKEND;
     }
 
+    render_target->screen_surface = NULL;
+    render_target->backdrop = NULL;
     render_target->screen_width = INITIAL_SCREEN_WIDTH;
     render_target->screen_height = INITIAL_SCREEN_HEIGHT;
     render_target->resizing = false;
     render_target->debug_info_changed = false;
+    render_target->invalid = INVALID_ALL;
+
+    // sprite maps are converted to the screen format on load. textures get
+    // uploaded from a plain 32-bit format and the renderer converts from there
+    SDL_PixelFormat *format = NULL;
+    if (render_target->backend == SURFACE_BACKEND) {
+        // window surfaces are never synced to the display
+        render_target->vsync = false;
+        render_target->screen_surface =
+            SDL_GetWindowSurface(render_target->window);
+        if (render_target->screen_surface == NULL) {
+            printf("Could not capture screen surface! SDL_Error: %s\n",
+                   SDL_GetError());
+            cleanup(render_target->window);
+            game_state->status = EXITING;
+            return -1;
+        }
 
-    render_target->backdrop =
-        SDL_CreateRGBSurfaceWithFormat(0,
-            render_target->screen_width, render_target->screen_height,
-            render_target->screen_surface->format->BitsPerPixel,
-            render_target->screen_surface->format->format);
+        render_target->backdrop =
+            SDL_CreateRGBSurfaceWithFormat(0,
+                render_target->screen_width, render_target->screen_height,
+                render_target->screen_surface->format->BitsPerPixel,
+                render_target->screen_surface->format->format);
 
-    SDL_FillRect(render_target->backdrop , NULL, 0);
+        SDL_FillRect(render_target->backdrop , NULL, 0);
+        format = render_target->screen_surface->format;
+    }
+    else {
+        format = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB8888);
+    }
 
-    SDL_PixelFormat *format = render_target->screen_surface->format;
-    resources->sprites = loadSpritemap("assets/yarz-sprites.png", format);
-    resources->terrain = loadSpritemap("assets/yarz-terrain.png", format);
-    resources->icons = loadSpritemap("assets/yarz-icons.png", format);
+    // baked into one atlas on the first run, one for each pixel format, and
+    // mapped straight in from then on
+    const char *sheets[] = { "assets/yarz-sprites.png",
+                             "assets/yarz-terrain.png",
+                             "assets/yarz-icons.png" };
+    char atlas_path[64];
+    snprintf(atlas_path, sizeof(atlas_path), "assets/yarz-atlas-%08x.bin",
+             (unsigned)format->format);
+    Uint64 assets_start = SDL_GetPerformanceCounter();
+    resources->atlas = loadSpriteAtlas(sheets, 3, format, atlas_path);
+    game_state->asset_seconds =
+        (double)(SDL_GetPerformanceCounter() - assets_start)
+        / SDL_GetPerformanceFrequency();
+
+    // the overlay's glyphs are rasterized once, in the same format as the
+    // sprites
+    resources->game_font =
+        TTF_OpenFont("assets/MajorMonoDisplay-Regular.ttf", 14);
+    SDL_Color yellow = {.r = 227, .g = 227, .b = 18};
+    resources->glyphs = resources->game_font == NULL ? NULL
+                        : initGlyphCache(resources->game_font, yellow, format);
 
-    if (resources->sprites == NULL || resources->terrain == NULL
-        || resources->icons == NULL) {
+    if (render_target->backend != SURFACE_BACKEND) {
+        SDL_FreeFormat(format);
+    }
 
+    if (resources->atlas == NULL) {
         cleanup(render_target->window);
         game_state->status = EXITING;
         return -1;
     }
-
-    resources->game_font =
-        TTF_OpenFont("assets/MajorMonoDisplay-Regular.ttf", 14);
+    resources->sprites = resources->atlas->sheets[0];
+    resources->terrain = resources->atlas->sheets[1];
+    resources->icons = resources->atlas->sheets[2];
+    resources->sprite_tiles = initTileSheet(resources->sprites);
+    resources->terrain_tiles = initTileSheet(resources->terrain);
+    resources->icon_tiles = initTileSheet(resources->icons);
+    if (resources->sprite_tiles == NULL || resources->terrain_tiles == NULL
+        || resources->icon_tiles == NULL) {
+        cleanup(render_target->window);
+        game_state->status = EXITING;
+        return -1;
+    }
+    printf("%s sprite atlas %s in %.1f ms\n",
+           resources->atlas->mapped ? "Loaded" : "Baked", atlas_path,
+           game_state->asset_seconds * 1000.0);
 
     if (resources->game_font == NULL) {
         printf("Could not open font MajorMonoDisplay-Regular! TTF_Error: %s\n",
@@ -605,86 +1582,247 @@ int init(RenderTarget *render_target, Resources *resources,
         return -1;
     }
 
-    generateCaveTerrain(game_map);
-
-    // this monster of a declaration basically says
-    // 'give me a surface the size of the level in the same format as the screen'
-    // the other surfaces are optimized to the screen format on load
-    resources->level =
-        SDL_CreateRGBSurfaceWithFormat(
-            0,
-            game_map->width * TILE_SIZE,
-            game_map->height * TILE_SIZE,
-            render_target->screen_surface->format->BitsPerPixel,
-            render_target->screen_surface->format->format);
-
-    if (resources->level == NULL) {
-        printf("Could not create level surface! SDL_Error: %s\n",
-                                                     SDL_GetError());
+    if (resources->glyphs == NULL) {
+        cleanup(render_target->window);
+        game_state->status = EXITING;
+        return -1;
+    }
 
+    if (render_target->backend != SURFACE_BACKEND
+        && uploadTextures(render_target, resources) < 0) {
         cleanup(render_target->window);
         game_state->status = EXITING;
         return -1;
     }
 
-    // FIXME: this malloc has no destroy! :3
-    // FIXME: the value of 10 is hardcoded, we may have more than 10 entities that require turn shuffling
-    game_state->turn_order = (int *) malloc(sizeof(int) * 10);
-    for (int i = 0; i < 10; i++) {
-        game_state->turn_order[i] = -1;
+    if (game_state->level_count > 0) {
+        printf("Loaded map %s, generated from seed %llu\n",
+               game_state->level_files[0],
+               (unsigned long long)game_state->map_options.seed);
+    }
+    else {
+        generateCaveTerrain(game_map, &game_state->map_options);
+        printf("Game seed %llu, generated map from seed %llu\n",
+               (unsigned long long)game_state->seed,
+               (unsigned long long)game_state->map_options.seed);
     }
 
-    // TODO: This critter list should be loaded from disk
-    Critter tempCritterList[] =
-        { { .source_sprite_map = resources->sprites, .sprite_ID = HERO, .x = 0, .y = 0} ,
-          { .source_sprite_map = resources->sprites, .sprite_ID = LEGGY, .x = 32, .y = 32},
-          { .source_sprite_map = resources->sprites, .sprite_ID = BOOTS, .x = 64, .y = 64} };
+    if (game_state->save_map_file != NULL) {
+        saveMap(game_map, game_state->map_options.seed,
+                game_state->save_map_file, game_state->save_map_encoding);
+    }
 
-    resources->entity_list = (Critter *) malloc(sizeof(tempCritterList));
-    memcpy(resources->entity_list, tempCritterList, sizeof(tempCritterList));
+    // the view surface is sized to the camera, so render sets it up on the
+    // first frame
+    resources->view = NULL;
+    resources->dirty_tiles = initDirtyTiles();
+    resources->terrain_baked = false;
+    resources->tile_variants = initTileVariants();
+    resources->opacity = initOpacityMap();
+    resources->fov = initFovCache();
+    resources->hero_flow = initFlowMap();
+    resources->regions = initMapRegions();
+    if (resources->tile_variants == NULL || resources->opacity == NULL
+        || resources->fov == NULL || resources->hero_flow == NULL
+        || resources->regions == NULL) {
+        cleanup(render_target->window);
+        game_state->status = EXITING;
+        return -1;
+    }
 
-    render_target->debug_info =
-        updateDebugInfo(resources->game_font, render_target,
-                        game_map, camera->scale);
+    // TODO: This critter list should be loaded from disk
+    resources->entities = initEntityStore(3 + game_state->extra_critters);
+    if (resources->entities == NULL) {
+        cleanup(render_target->window);
+        game_state->status = EXITING;
+        return -1;
+    }
+    addEntity(resources->entities, HERO, 0, 0, ENTITY_HERO);
+    Entity leggy = addEntity(resources->entities, LEGGY, 32, 32, 0);
+    resources->entities->speed[entityIndex(resources->entities, leggy)] =
+        ENTITY_NORMAL_SPEED * 3 / 2;
+    addEntity(resources->entities, BOOTS, 64, 64, 0);
+    labelRegions(resources->regions, game_map,
+                 game_state->map_options.threads);
+    if (rebuildSpatialIndex(resources, game_map) != 0) {
+        cleanup(render_target->window);
+        game_state->status = EXITING;
+        return -1;
+    }
+    placeEntities(resources, &game_state->rng);
+    spawnCritters(resources->entities, resources->spatial, resources->regions,
+                  game_map, &game_state->rng, game_state->extra_critters);
+
+    // saved levels are loaded, not generated, so they have no use for it
+    if (game_state->level_count == 0) {
+        game_state->map_pool = initMapPool(&game_state->map_options,
+                                           &game_state->map_rng,
+                                           MAP_POOL_SIZE);
+    }
+
+    game_state->turns = initTurnScheduler(game_state->turn_mode);
+    if (game_state->turns == NULL) {
+        cleanup(render_target->window);
+        game_state->status = EXITING;
+        return -1;
+    }
+    for (int i = 0; i < resources->entities->count; i++) {
+        scheduleEntity(game_state->turns, resources->entities,
+                       &game_state->rng, resources->entities->handle[i]);
+    }
 
     render_target->debug_info_rect = (SDL_Rect *) malloc(sizeof(SDL_Rect));
-    render_target->debug_info_rect->h = render_target->debug_info->h;
-    render_target->debug_info_rect->w = render_target->debug_info->w;
     render_target->debug_info_rect->x = 0;
     render_target->debug_info_rect->y = 0;
+    updateDebugInfo(resources->glyphs, render_target, game_map, camera->scale);
 
     return 0;
 }
 
-SDL_Surface* loadSpritemap(const char *path, SDL_PixelFormat *pixelFormat) {
-    SDL_Surface* image = IMG_Load(path);
-    if (image == NULL) {
-        printf("Unable to load image %s! SDL Error: %s\n", path, IMG_GetError());
-        return NULL;
-    }
-    SDL_Surface* optimizedSurface = SDL_ConvertSurface(image, pixelFormat, 0);
-    if(optimizedSurface == NULL) {
-        printf("Unable to optimize image %s! SDL Error: %s\n",
-                                        path,       SDL_GetError());
-
-        return NULL;
+// --seed N     seed the game with N. the same seed gives the same maps
+// --threads N  use N threads for map generation (default: one per CPU)
+// --world      play on a huge streamed world instead of a single cave
+// --world-budget MB  how much memory world chunks may use (default: 64)
+// --world-dir D      where modified world chunks are kept (default: world)
+// --map-size WxH  generate W by H tile caves instead of 50 to 100 a side
+// --load-map F start on the level saved in F. give it more than once to have
+//              the new map key cycle through several saved levels
+// --save-map F save the starting level to F
+// --map-encoding E  save levels "raw" (the default, loads without copying) or
+//                   "rle" (smaller)
+// --headless   run without a display, on SDL's dummy video driver
+// --bench N    play N frames of scripted input as fast as possible, then
+//              report timings for each phase and a few standalone benchmarks
+// --check-cave  check every cave generator kernel, on several thread counts,
+//               against the one-cell-at-a-time reference, then quit
+// --bench-json F  also write the benchmark results to F as JSON ("-" for
+//                 stdout)
+// --trace F    write the profiler's trace to F as Chrome trace JSON on the
+//              way out, and when F12 is pressed (profiling builds only, see
+//              profile.h. F3 shows the profiler's HUD)
+// --tick-rate N  run the simulation at N ticks a second (default: 10)
+// --fps N      draw at most N frames a second, 0 for no limit (default: 60)
+// --no-vsync   don't wait for the display between frames
+// --connect C  what to do about parts of a cave cut off from the rest:
+//              "tunnel" (the default) digs through to them, "cull" fills them
+//              in, "none" leaves them be
+// --critters N scatter N more critters over the map
+// --turns M    "shuffled" (the default) gives everyone one turn a round in
+//              random order, "energy" gives faster critters more turns
+// --backend B  draw with "surface" (the default), "renderer" (SDL_Renderer,
+//              hardware accelerated if available) or "software" (SDL_Renderer
+//              forced onto its software renderer)
+void parseArguments(int argc, char *args[], GameState *game_state,
+                    RenderTarget *render_target) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(args[i], "--seed") == 0 && i + 1 < argc) {
+            game_state->seed = strtoull(args[++i], NULL, 10);
+        }
+        else if (strcmp(args[i], "--world") == 0) {
+            game_state->map_options.chunked = true;
+        }
+        else if (strcmp(args[i], "--world-budget") == 0 && i + 1 < argc) {
+            game_state->map_options.memory_budget =
+                (size_t)strtoull(args[++i], NULL, 10) * 1024 * 1024;
+        }
+        else if (strcmp(args[i], "--world-dir") == 0 && i + 1 < argc) {
+            game_state->map_options.chunk_directory = args[++i];
+        }
+        else if (strcmp(args[i], "--map-size") == 0 && i + 1 < argc) {
+            i++;
+            int width, height;
+            if (sscanf(args[i], "%dx%d", &width, &height) == 2 && width > 0
+                && height > 0) {
+                game_state->map_options.width = width;
+                game_state->map_options.height = height;
+            }
+            else {
+                printf("Ignoring map size %s, expected WxH\n", args[i]);
+            }
+        }
+        else if (strcmp(args[i], "--load-map") == 0 && i + 1 < argc) {
+            i++;
+            if (game_state->level_count < MAX_LEVEL_FILES) {
+                game_state->level_files[game_state->level_count++] = args[i];
+            }
+        }
+        else if (strcmp(args[i], "--save-map") == 0 && i + 1 < argc) {
+            game_state->save_map_file = args[++i];
+        }
+        else if (strcmp(args[i], "--map-encoding") == 0 && i + 1 < argc) {
+            i++;
+            game_state->save_map_encoding =
+                strcmp(args[i], "rle") == 0 ? MAP_ENCODING_RLE
+                                            : MAP_ENCODING_RAW;
+        }
+        else if (strcmp(args[i], "--tick-rate") == 0 && i + 1 < argc) {
+            game_state->tick_rate = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--fps") == 0 && i + 1 < argc) {
+            game_state->frame_cap = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--no-vsync") == 0) {
+            render_target->vsync = false;
+        }
+        else if (strcmp(args[i], "--connect") == 0 && i + 1 < argc) {
+            i++;
+            game_state->map_options.connectivity =
+                strcmp(args[i], "cull") == 0 ? MAP_CONNECT_CULL
+                : strcmp(args[i], "none") == 0 ? MAP_CONNECT_NONE
+                                               : MAP_CONNECT_TUNNEL;
+        }
+        else if (strcmp(args[i], "--critters") == 0 && i + 1 < argc) {
+            game_state->extra_critters = atoi(args[++i]);
+            if (game_state->extra_critters < 0) {
+                game_state->extra_critters = 0;
+            }
+        }
+        else if (strcmp(args[i], "--fov") == 0 && i + 1 < argc) {
+            game_state->fov_radius = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--turns") == 0 && i + 1 < argc) {
+            i++;
+            game_state->turn_mode = strcmp(args[i], "energy") == 0
+                                    ? TURN_ENERGY : TURN_SHUFFLED;
+        }
+        else if (strcmp(args[i], "--headless") == 0) {
+            game_state->headless = true;
+        }
+        else if (strcmp(args[i], "--bench") == 0 && i + 1 < argc) {
+            game_state->bench_frames = atoi(args[++i]);
+        }
+        else if (strcmp(args[i], "--check-cave") == 0) {
+            game_state->check_cave = true;
+        }
+        else if (strcmp(args[i], "--bench-json") == 0 && i + 1 < argc) {
+            game_state->bench_json = args[++i];
+        }
+        else if (strcmp(args[i], "--trace") == 0 && i + 1 < argc) {
+            game_state->trace_file = args[++i];
+        }
+        else if (strcmp(args[i], "--backend") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(args[i], "renderer") == 0) {
+                render_target->backend = RENDERER_BACKEND;
+            }
+            else if (strcmp(args[i], "software") == 0) {
+                render_target->backend = SOFTWARE_RENDERER_BACKEND;
+            }
+            else {
+                render_target->backend = SURFACE_BACKEND;
+            }
+        }
+        else if (strcmp(args[i], "--threads") == 0 && i + 1 < argc) {
+            game_state->map_options.threads = atoi(args[++i]);
+        }
+        else {
+            printf("Ignoring unknown argument %s\n", args[i]);
+        }
     }
 
-    SDL_FreeSurface(image);
-
-    // TODO: may want to remap alpha color to something other than black
-    int set_color_key_status =
-        SDL_SetColorKey(optimizedSurface, SDL_TRUE,
-                        SDL_MapRGB(optimizedSurface->format, 0, 0, 0));
-
-    if (set_color_key_status < 0) {
-        printf("Unable to set transparent pixel for image %s! SDL Error: %s\n",
-                                                         path,  SDL_GetError());
-
-        return NULL;
+    if (game_state->map_options.threads < 1) {
+        game_state->map_options.threads = 1;
     }
-
-    return optimizedSurface;
 }
 
 void cleanup(SDL_Window *window)
@@ -3,45 +3,189 @@
 
 #include "SDL2/SDL.h"
 #include "map.h"
+#include "entity.h"
+#include "turn.h"
+#include "spatial.h"
+#include "autotile.h"
+#include "fov.h"
+#include "path.h"
+#include "region.h"
+#include "mappool.h"
+#include "assets.h"
+#include "text.h"
+#include "blit.h"
+#include "profile.h"
 
-typedef struct Critter {
-    SDL_Surface *source_sprite_map;
-    int sprite_ID;
-    int x;
-    int y;
-} Critter;
+enum gameStatus {
+    EXITING,
+    INIT,
+    NEW_GAME,
+    PLAYER_TURN,
+    HERO_TURN,
+    GAME_OVER
+};
+
+enum inputs {
+    NONE,
+    UP_LEFT,
+    UP,
+    UP_RIGHT,
+    RIGHT,
+    DOWN_RIGHT,
+    DOWN,
+    DOWN_LEFT,
+    LEFT,
+    SKIP,
+    DEBUG_GENERATE_NEW_MAP
+};
+
+enum directions {
+    EMPTY,
+    NORTH_WEST,
+    NORTH,
+    NORTH_EAST,
+    EAST,
+    SOUTH_EAST,
+    SOUTH,
+    SOUTH_WEST,
+    WEST
+};
+
+// the rows of assets/yarz-terrain.png. WALLS has the wall edge overlays, in
+// the order of enum tileEdge
+enum tileset {
+    CAVE,
+    FLOOR,
+    WALLS
+};
+
+enum renderBackend {
+    SURFACE_BACKEND,
+    RENDERER_BACKEND,
+    SOFTWARE_RENDERER_BACKEND
+};
+
+// what has to be drawn again before the next frame. anything that changes
+// what is on screen marks it with invalidate, and render does nothing at all
+// while nothing is marked
+enum invalidation {
+    INVALID_NONE = 0,
+    INVALID_SCENE = 1,  // sprites or icons changed, but the camera did not
+    INVALID_ALL = 2     // the camera, the map or the window changed
+};
+
+// frames with only INVALID_SCENE present at most this many rectangles, more
+// than that and the whole window is presented instead
+#define MAX_DAMAGE_RECTS 64
 
 typedef struct RenderTarget {
+    int backend;
     SDL_Window *window;
+    SDL_Renderer *renderer;
+    struct TileBatch *tile_batch;
     SDL_Surface *screen_surface;
     int screen_width;
     int screen_height;
     bool resizing;
     SDL_Surface *backdrop;
-    SDL_Surface *debug_info;
+    char debug_text[256];  // the debug overlay, drawn from the glyph cache
     SDL_Rect *debug_info_rect;
     bool debug_info_changed;
+    int invalid;  // enum invalidation flags
+    bool vsync;  // asked for before init, whether we actually got it after
 } RenderTarget;
 
+// tracks which tiles of the baked view surface have been drawn over since
+// the last frame, so only those need restoring from the terrain sheet.
+// x, y, width and height are the block of map tiles the view covers
+typedef struct DirtyTiles {
+    int x;
+    int y;
+    int width;
+    int height;
+    int capacity;
+    bool *marked;
+    int *list;
+    int count;
+} DirtyTiles;
+
 typedef struct Resources {
-    SDL_Surface *level;
+    SDL_Surface *view;
+    SDL_Rect baked_view;
+    bool terrain_baked;
+    DirtyTiles *dirty_tiles;
+    SpriteAtlas *atlas;     // owns the three sheets below
     SDL_Surface *sprites;
     SDL_Surface *terrain;
     SDL_Surface *icons;
+    TileSheet *sprite_tiles;   // the three sheets again, for blitTile
+    TileSheet *terrain_tiles;
+    TileSheet *icon_tiles;
+    SDL_Texture *sprites_texture;
+    SDL_Texture *terrain_texture;
+    SDL_Texture *icons_texture;
     TTF_Font *game_font;
-    struct Critter *entity_list;
+    GlyphCache *glyphs;     // game_font's glyphs, in the overlay's colour
+    SDL_Texture *glyphs_texture;
+    EntityStore *entities;  // drawn with the sprites sheet
+    TileVariants *tile_variants;  // how each terrain tile is drawn
+    SpatialIndex *spatial;  // where the entities are, in tiles
+    Entity *visible;        // scratch space for visibleEntities
+    int visible_capacity;
+    OpacityMap *opacity;    // what blocks sight
+    FovCache *fov;          // what each entity saw last
+    FovResult shown_fov;    // what the view was drawn with. invalid: all of it
+    FlowMap *hero_flow;     // steps to the nearest critter, for the hero
+    MapRegions *regions;    // which floor connects to which
 } Resources;
 
+#define MAX_LEVEL_FILES 16
+
 typedef struct GameState {
     int last_input;
     bool end_turn;
     int status;
-    int current_player;
-    int *turn_order;
-    int current_turn;
-    int total_entities; // intentionally 1-based index
+    int current_player;  // entity index, refreshed every update
+    Entity current_actor;  // whose turn it is, ENTITY_NONE between turns
+    int turn_mode;
+    TurnScheduler *turns;
+    int extra_critters;  // spawned at random on top of the starting three
+    int fov_radius;      // how far entities see, 0 to see the whole map
+    uint64_t seed;
+    Rng rng;
+    Rng map_rng;
+    MapPool *map_pool;  // maps made ahead, NULL to make them on the spot
+    MapGenOptions map_options;
+    // saved levels given with --load-map. when there are any, the game plays
+    // those instead of generating new maps
+    const char *level_files[MAX_LEVEL_FILES];
+    int level_count;
+    int current_level;
+    const char *save_map_file;
+    int save_map_encoding;
+    int tick_rate;   // simulation ticks per second
+    int frame_cap;   // most frames drawn per second, 0 for no limit
+    bool headless;
+    bool check_cave;         // check the cave kernels against the reference
+    int bench_frames;        // play this many scripted frames then quit
+    const char *bench_json;  // where to write the results as JSON
+    const char *trace_file;  // where the profile trace goes, written at exit
+    uint64_t launched;       // performance counter when main started
+    double asset_seconds;    // spent loading the sprite sheets
+    double startup_seconds;  // launch to the first frame, 0 until then
 } GameState;
 
+// where the pieces of the profiler's HUD go on screen
+typedef struct ProfileHudLayout {
+    SDL_Rect panel;  // behind everything else
+    SDL_Rect bars[PROFILE_HISTORY];  // a frame each, oldest first
+    int bar_count;
+    SDL_Rect budget;  // a line across the graph at one 60 Hz frame
+    int text_x;
+    int text_y;
+    char text[1024];
+} ProfileHudLayout;
+
 typedef struct Camera {
     int x;
     int y;
@@ -49,16 +193,48 @@ typedef struct Camera {
 } Camera;
 
 int init(RenderTarget *, Resources *, GameState *, GameMap *, Camera *);
-SDL_Surface* loadSpritemap(const char *, SDL_PixelFormat *);
-void renderTerrain(SDL_Surface *, GameMap *, SDL_Surface *);
-void placeTile(SDL_Surface *, int, int, int, int, SDL_Surface *);
-void place(Critter, SDL_Surface *);
-void processInputs(SDL_Event *, GameState *, RenderTarget *, Camera *);
+void runGameLoop(GameState *, RenderTarget *, Resources *, GameMap **,
+                 Camera *);
+SDL_Rect cameraView(RenderTarget *, Camera *);
+void visibleTiles(GameMap *, SDL_Rect *, int *, int *, int *, int *);
+bool inView(SDL_Rect *, int, int);
+int prepareViewSurface(RenderTarget *, Resources *, SDL_Rect *);
+void renderView(Resources *, GameMap *, GameState *, SDL_Rect *);
+int terrainSprite(int);
+void renderTerrain(TileSheet *, GameMap *, TileVariants *, FovResult *,
+                   SDL_Rect *, SDL_Surface *);
+void renderTerrainTile(TileSheet *, TileVariants *, int, int, SDL_Rect *,
+                       SDL_Surface *);
+DirtyTiles* initDirtyTiles();
+void resetDirtyTiles(DirtyTiles *, int, int, int, int);
+void markDirtyTile(DirtyTiles *, int, int);
+int dirtyTileRects(DirtyTiles *, SDL_Rect *, SDL_Rect *, int);
+void restoreDirtyTiles(TileSheet *, TileVariants *, FovResult *, SDL_Rect *,
+                       SDL_Surface *, DirtyTiles *);
+void destroyDirtyTiles(DirtyTiles *);
+void placeTile(TileSheet *, int, int, int, int, SDL_Surface *);
+bool processInputs(SDL_Event *, GameState *, RenderTarget *, Camera *);
 void gameUpdate(GameState *, Resources *, GameMap **, RenderTarget *);
-void render(RenderTarget *, Camera *, Resources *, GameMap *, GameState *);
-void shuffleTurnOrder(int**, int);
-void renderDirectionIcon(SDL_Surface *, Critter *, SDL_Surface *, GameState *);
-SDL_Surface* updateDebugInfo(TTF_Font *, RenderTarget *, GameMap *, int);
+void invalidate(RenderTarget *, int);
+bool layoutProfileHud(RenderTarget *, GlyphCache *, ProfileHudLayout *);
+SDL_Rect renderProfileHud(RenderTarget *, GlyphCache *);
+bool render(RenderTarget *, Camera *, Resources *, GameMap *, GameState *);
+void noteFirstFrame(GameState *);
+void spawnCritters(EntityStore *, SpatialIndex *, MapRegions *, GameMap *,
+                   Rng *, int);
+void mapReplaced(Resources *, GameMap *, GameState *, bool);
+void placeEntities(Resources *, Rng *);
+int rebuildSpatialIndex(Resources *, GameMap *);
+bool moveEntity(Resources *, GameMap *, int, int, int);
+void moveHero(Resources *, GameMap *, int);
+int visibleEntities(Resources *, SDL_Rect *);
+bool updateViewFov(Resources *, GameMap *, GameState *, DirtyTiles *);
+bool tileShown(FovResult *, int, int);
+int directionIcon(GameState *, EntityStore *, int *, int *);
+void renderDirectionIcon(TileSheet *, EntityStore *, SDL_Rect *, SDL_Surface *,
+                         GameState *, DirtyTiles *);
+void updateDebugInfo(GlyphCache *, RenderTarget *, GameMap *, int);
+void parseArguments(int, char *[], GameState *, RenderTarget *);
 void cleanup(SDL_Window *);
 
 #endif /* __YARZ_H__ */